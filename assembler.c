@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "instruction.h"
+#include "printRoutines.h"
+#include "assembler.h"
+
+/* One instruction or data item found in the first pass. Its operand
+   may refer to a label, which is only resolved in the second pass,
+   once every label is known. */
+typedef struct statement {
+
+  uint64_t     address;
+  uint64_t     value;
+  const char  *symbol;
+  uint32_t     symbolLength;
+  uint32_t     line;
+
+  uint8_t      size;
+  uint8_t      isData;
+  uint8_t      icode;
+  uint8_t      ifun;
+  uint8_t      rA;
+  uint8_t      rB;
+} statement_t;
+
+typedef struct parser {
+
+  assembly_t  *assembly;
+  statement_t *statements;
+  uint64_t     count;
+  uint64_t     capacity;
+  uint32_t     line;
+} parser_t;
+
+static int isSymbolStart(char c)
+{
+  return isalpha((unsigned char)c) || c == '_';
+}
+
+static int isSymbolChar(char c)
+{
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+static char *skipSpace(char *p)
+{
+  while (isspace((unsigned char)*p))
+    p++;
+  return p;
+}
+
+/* Records an error message for the current line. Always returns 0, so
+   it can be used as the result of a failing parse routine. */
+static int parseError(parser_t *parser, const char *message, const char *near)
+{
+  snprintf(parser->assembly->error, ASSEMBLER_MAX_ERROR, "line %u: %s%s%.20s%s",
+	   parser->line, message, near ? " near '" : "", near ? near : "",
+	   near ? "'" : "");
+  return 0;
+}
+
+/* Removes comments from a line of assembly source. Block comments may
+   span several lines, so *inComment carries that state between
+   calls. */
+static void stripComments(char *line, int *inComment)
+{
+  char *read = line, *write = line;
+
+  while (*read)
+  {
+    if (*inComment)
+    {
+      if (read[0] == '*' && read[1] == '/')
+      {
+	*inComment = 0;
+	read += 2;
+      }
+      else
+	read++;
+    }
+    else if (read[0] == '/' && read[1] == '*')
+    {
+      *inComment = 1;
+      read += 2;
+    }
+    else if (read[0] == '#')
+      break;
+    else
+      *write++ = *read++;
+  }
+  *write = '\0';
+}
+
+/* Parses a register name such as %rax. */
+static int parseRegister(parser_t *parser, char **p, uint8_t *reg)
+{
+  char *start = skipSpace(*p), *q = start;
+  y86_register_t value;
+
+  if (*q != '%')
+    return parseError(parser, "expected a register", start);
+  for (q++; isSymbolChar(*q); q++)
+    ;
+  if (!parseRegisterName(start, q - start, &value))
+    return parseError(parser, "invalid register", start);
+
+  *reg = value;
+  *p = q;
+  return 1;
+}
+
+/* Parses a constant, optionally prefixed by $: either a number, or a
+   label optionally followed by +number or -number. */
+static int parseValue(parser_t *parser, char **p, statement_t *statement)
+{
+  char *q = skipSpace(*p), *end;
+  int negative = 0;
+
+  if (*q == '$')
+    q = skipSpace(q + 1);
+
+  statement->symbol = NULL;
+  statement->value = 0;
+
+  if (isSymbolStart(*q))
+  {
+    statement->symbol = q;
+    for (; isSymbolChar(*q); q++)
+      ;
+    statement->symbolLength = q - statement->symbol;
+    q = skipSpace(q);
+    if (*q != '+' && *q != '-')
+    {
+      *p = q;
+      return 1;
+    }
+  }
+
+  if (*q == '+' || *q == '-')
+  {
+    negative = *q == '-';
+    q = skipSpace(q + 1);
+  }
+
+  if (!isdigit((unsigned char)*q))
+    return parseError(parser, "expected a constant", *p);
+
+  errno = 0;
+  statement->value = strtoull(q, &end, 0);
+  if (errno != 0 || isSymbolChar(*end))
+    return parseError(parser, "invalid constant", q);
+  if (negative)
+    statement->value = -statement->value;
+
+  *p = end;
+  return 1;
+}
+
+/* Parses a memory operand of the form D(%reg), where the displacement
+   D is optional. */
+static int parseMemory(parser_t *parser, char **p, statement_t *statement)
+{
+  char *q = skipSpace(*p);
+
+  if (*q != '(')
+  {
+    if (!parseValue(parser, &q, statement))
+      return 0;
+    q = skipSpace(q);
+  }
+  else
+  {
+    statement->symbol = NULL;
+    statement->value = 0;
+  }
+
+  if (*q != '(')
+    return parseError(parser, "expected '('", q);
+  q++;
+  if (!parseRegister(parser, &q, &statement->rB))
+    return 0;
+  q = skipSpace(q);
+  if (*q != ')')
+    return parseError(parser, "expected ')'", q);
+
+  *p = q + 1;
+  return 1;
+}
+
+static int parseComma(parser_t *parser, char **p)
+{
+  char *q = skipSpace(*p);
+  if (*q != ',')
+    return parseError(parser, "expected ','", q);
+  *p = q + 1;
+  return 1;
+}
+
+/* Parses the operands of an instruction, according to its icode. */
+static int parseOperands(parser_t *parser, char **p, statement_t *statement)
+{
+  statement->rA = R_NONE;
+  statement->rB = R_NONE;
+  statement->symbol = NULL;
+  statement->value = 0;
+
+  switch (statement->icode)
+  {
+  case I_RRMVXX:
+  case I_OPQ:
+    return parseRegister(parser, p, &statement->rA) && parseComma(parser, p) &&
+      parseRegister(parser, p, &statement->rB);
+  case I_IRMOVQ:
+    return parseValue(parser, p, statement) && parseComma(parser, p) &&
+      parseRegister(parser, p, &statement->rB);
+  case I_RMMOVQ:
+    return parseRegister(parser, p, &statement->rA) && parseComma(parser, p) &&
+      parseMemory(parser, p, statement);
+  case I_MRMOVQ:
+    return parseMemory(parser, p, statement) && parseComma(parser, p) &&
+      parseRegister(parser, p, &statement->rA);
+  case I_JXX:
+  case I_CALL:
+    return parseValue(parser, p, statement);
+  case I_PUSHQ:
+  case I_POPQ:
+    return parseRegister(parser, p, &statement->rA);
+  default:
+    return 1;
+  }
+}
+
+static statement_t *newStatement(parser_t *parser)
+{
+  if (parser->count == parser->capacity)
+  {
+    uint64_t capacity = parser->capacity ? 2 * parser->capacity : 1024;
+    statement_t *statements = realloc(parser->statements,
+				      capacity * sizeof(statement_t));
+    if (!statements)
+      return NULL;
+    parser->statements = statements;
+    parser->capacity = capacity;
+  }
+  return &parser->statements[parser->count++];
+}
+
+/* First pass over one line: defines its labels, handles the layout
+   directives and records instructions and data items with their
+   address. */
+static int parseLine(parser_t *parser, char *p, uint64_t *address)
+{
+  char *start;
+  statement_t *statement;
+
+  // Labels, possibly several on the same line.
+  while (1)
+  {
+    p = skipSpace(p);
+    if (!isSymbolStart(*p))
+      break;
+    for (start = p; isSymbolChar(*p); p++)
+      ;
+    char *colon = skipSpace(p);
+    if (*colon != ':')
+    {
+      p = start;
+      break;
+    }
+    if (!symbolTableAdd(&parser->assembly->symbols, start, p - start, *address))
+    {
+      *p = '\0';
+      return parseError(parser, "duplicate label", start);
+    }
+    p = colon + 1;
+  }
+
+  if (!*p)
+    return 1;
+
+  if (*p == '.')
+  {
+    uint64_t size;
+    for (start = ++p; isSymbolChar(*p); p++)
+      ;
+    size_t length = p - start;
+
+    if ((length == 3 && strncmp(start, "pos", 3) == 0) ||
+	(length == 5 && strncmp(start, "align", 5) == 0))
+    {
+      statement_t operand;
+      if (!parseValue(parser, &p, &operand))
+	return 0;
+      if (operand.symbol)
+	return parseError(parser, "expected a number", start);
+      if (operand.value > ASSEMBLER_MAX_IMAGE)
+	return parseError(parser, "address out of range", start - 1);
+      if (*start == 'p')
+	*address = operand.value;
+      else if (operand.value)
+	*address = (*address + operand.value - 1) / operand.value * operand.value;
+      p = skipSpace(p);
+      return *p ? parseError(parser, "unexpected text", p) : 1;
+    }
+    else if (length == 4 && strncmp(start, "quad", 4) == 0)
+      size = 8;
+    else if (length == 4 && strncmp(start, "long", 4) == 0)
+      size = 4;
+    else if (length == 4 && strncmp(start, "word", 4) == 0)
+      size = 2;
+    else if (length == 4 && strncmp(start, "byte", 4) == 0)
+      size = 1;
+    else
+      return parseError(parser, "unknown directive", start - 1);
+
+    if (!(statement = newStatement(parser)))
+      return parseError(parser, "out of memory", NULL);
+    statement->isData = 1;
+    statement->size = size;
+    if (!parseValue(parser, &p, statement))
+      return 0;
+  }
+  else
+  {
+    y86_icode_t icode;
+    uint8_t ifun;
+
+    for (start = p; isSymbolChar(*p); p++)
+      ;
+    if (!parseInstructionName(start, p - start, &icode, &ifun))
+    {
+      *p = '\0';
+      return parseError(parser, "unknown instruction", start);
+    }
+
+    if (!(statement = newStatement(parser)))
+      return parseError(parser, "out of memory", NULL);
+    statement->isData = 0;
+    statement->size = instructionLength(icode);
+    statement->icode = icode;
+    statement->ifun = ifun;
+    if (!parseOperands(parser, &p, statement))
+      return 0;
+  }
+
+  // Addresses stay below the limit, so the end of a statement cannot wrap.
+  if (*address > ASSEMBLER_MAX_IMAGE - statement->size)
+    return parseError(parser, "address out of range", NULL);
+  statement->address = *address;
+  statement->line = parser->line;
+  *address += statement->size;
+
+  p = skipSpace(p);
+  return *p ? parseError(parser, "unexpected text", p) : 1;
+}
+
+/* Second pass: resolves the labels used as operands and encodes every
+   statement into the image. */
+static int emitStatements(parser_t *parser)
+{
+  assembly_t *assembly = parser->assembly;
+  uint64_t size = 0;
+
+  for (uint64_t i = 0; i < parser->count; i++)
+  {
+    statement_t *statement = &parser->statements[i];
+    if (statement->address + statement->size > size)
+      size = statement->address + statement->size;
+  }
+
+  assembly->image = calloc(size ? size : 1, 1);
+  assembly->lines = malloc((parser->count ? parser->count : 1) *
+			   sizeof(assembly_line_t));
+  if (!assembly->image || !assembly->lines)
+    return parseError(parser, "image too large", NULL);
+  assembly->size = size;
+  assembly->lineCount = parser->count;
+
+  for (uint64_t i = 0; i < parser->count; i++)
+  {
+    statement_t *statement = &parser->statements[i];
+    uint8_t *out = assembly->image + statement->address;
+    uint64_t value = statement->value;
+    int valueBytes = statement->size;
+
+    assembly->lines[i].address = statement->address;
+    assembly->lines[i].line = statement->line;
+    assembly->lines[i].size = statement->size;
+    assembly->lines[i].isData = statement->isData;
+
+    if (statement->symbol)
+    {
+      const symbol_t *symbol = symbolLookupName(&assembly->symbols,
+						statement->symbol,
+						statement->symbolLength);
+      if (!symbol)
+      {
+	parser->line = statement->line;
+	statement->symbol = strndup(statement->symbol, statement->symbolLength);
+	parseError(parser, "undefined label", statement->symbol);
+	free((char *)statement->symbol);
+	return 0;
+      }
+      value += symbol->address;
+    }
+
+    if (!statement->isData)
+    {
+      *out++ = statement->icode << 4 | statement->ifun;
+      valueBytes = 0;
+      switch (statement->icode)
+      {
+      case I_RRMVXX:
+      case I_OPQ:
+      case I_PUSHQ:
+      case I_POPQ:
+	*out++ = statement->rA << 4 | statement->rB;
+	break;
+      case I_IRMOVQ:
+      case I_RMMOVQ:
+      case I_MRMOVQ:
+	*out++ = statement->rA << 4 | statement->rB;
+	valueBytes = 8;
+	break;
+      case I_JXX:
+      case I_CALL:
+	valueBytes = 8;
+	break;
+      default:
+	break;
+      }
+    }
+
+    // Constants are stored in little-endian format.
+    for (int b = 0; b < valueBytes; b++)
+      out[b] = value >> (8 * b);
+  }
+  return 1;
+}
+
+void assemblyInit(assembly_t *assembly)
+{
+  memset(assembly, 0, sizeof(*assembly));
+  symbolTableInit(&assembly->symbols);
+}
+
+void assemblyFree(assembly_t *assembly)
+{
+  free(assembly->image);
+  free(assembly->lines);
+  symbolTableFree(&assembly->symbols);
+  assemblyInit(assembly);
+}
+
+/* Assembles the Y86 source in the given null-terminated, writable
+   buffer, which is modified in the process. */
+static int assembleBuffer(assembly_t *assembly, char *text, size_t length)
+{
+  parser_t parser = { .assembly = assembly };
+  char *p = text, *end = text + length;
+  uint64_t address = 0;
+  int inComment = 0, result = 1;
+
+  while (p < end && result)
+  {
+    char *lineEnd = memchr(p, '\n', end - p);
+    if (!lineEnd)
+      lineEnd = end;
+    *lineEnd = '\0';
+    parser.line++;
+
+    stripComments(p, &inComment);
+    result = parseLine(&parser, p, &address);
+    p = lineEnd + 1;
+  }
+
+  if (result)
+  {
+    symbolTableFinalize(&assembly->symbols);
+    result = emitStatements(&parser);
+  }
+
+  free(parser.statements);
+  return result;
+}
+
+/* Assembles the given Y86 source text into *assembly, which must have
+   been initialized with assemblyInit. Returns 1 in case of success,
+   or 0 in case of failure, in which case assembly->error describes
+   the problem. */
+int assembleSource(assembly_t *assembly, const char *text, size_t length)
+{
+  char *copy = malloc(length + 1);
+  if (!copy)
+  {
+    snprintf(assembly->error, ASSEMBLER_MAX_ERROR, "out of memory");
+    return 0;
+  }
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+
+  int result = assembleBuffer(assembly, copy, length);
+  free(copy);
+  return result;
+}
+
+/* Same as assembleSource, reading the source from a file. */
+int assembleFile(assembly_t *assembly, const char *filename)
+{
+  FILE *file = fopen(filename, "r");
+  char *text;
+  long length;
+  int result;
+
+  if (!file || fseek(file, 0, SEEK_END) < 0 || (length = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) < 0)
+  {
+    snprintf(assembly->error, ASSEMBLER_MAX_ERROR, "%s: %s", filename,
+	     strerror(errno));
+    if (file)
+      fclose(file);
+    return 0;
+  }
+
+  text = malloc(length + 1);
+  if (!text || fread(text, 1, length, file) != (size_t)length)
+  {
+    snprintf(assembly->error, ASSEMBLER_MAX_ERROR, "%s: %s", filename,
+	     text ? "read error" : "out of memory");
+    free(text);
+    fclose(file);
+    return 0;
+  }
+  fclose(file);
+  text[length] = '\0';
+
+  result = assembleBuffer(assembly, text, length);
+  free(text);
+  return result;
+}
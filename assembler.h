@@ -0,0 +1,49 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in assembler.c
+*/
+
+#ifndef _ASSEMBLER_H_
+#define _ASSEMBLER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "symbols.h"
+
+#define ASSEMBLER_MAX_ERROR 256
+#define ASSEMBLER_MAX_IMAGE (1ULL << 32) // no byte is placed at or past this
+
+/* Location in the image of the instruction or data item defined on
+   a line of the source. */
+typedef struct assembly_line {
+
+  uint64_t address;
+  uint32_t line;
+  uint8_t  size;
+  uint8_t  isData;
+} assembly_line_t;
+
+/* Result of assembling a Y86 source file: a memory image starting at
+   address 0 and ending after the last byte emitted, and the labels
+   defined by the source, along with a listing of where each source
+   line was placed, ordered by line number. */
+typedef struct assembly {
+
+  uint8_t        *image;
+  uint64_t        size;
+
+  symbol_table_t  symbols;
+
+  assembly_line_t *lines;
+  uint64_t        lineCount;
+
+  char            error[ASSEMBLER_MAX_ERROR];
+} assembly_t;
+
+void assemblyInit(assembly_t *assembly);
+void assemblyFree(assembly_t *assembly);
+
+int assembleSource(assembly_t *assembly, const char *text, size_t length);
+int assembleFile(assembly_t *assembly, const char *filename);
+
+#endif /* ASSEMBLER */
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "instruction.h"
+#include "assembler.h"
+#include "coverage.h"
+
+/* On-disk header of a coverage file; the three bitmaps follow it. */
+typedef struct coverage_header {
+
+  char     magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t size;
+} coverage_header_t;
+
+/* Allocates empty bitmaps for an image of the given size. Returns 1
+   in case of success, or 0 if memory could not be allocated. */
+int coverageInit(coverage_t *coverage, uint64_t size)
+{
+  coverage->size = size;
+  coverage->words = (size + 63) / 64;
+  coverage->executed = calloc(3 * coverage->words + 1, sizeof(uint64_t));
+  coverage->taken = coverage->executed + coverage->words;
+  coverage->notTaken = coverage->taken + coverage->words;
+  return coverage->executed != NULL;
+}
+
+void coverageFree(coverage_t *coverage)
+{
+  free(coverage->executed);
+  memset(coverage, 0, sizeof(*coverage));
+}
+
+void coverageReset(coverage_t *coverage)
+{
+  memset(coverage->executed, 0, 3 * coverage->words * sizeof(uint64_t));
+}
+
+/* ORs the bitmaps stored in the open file into the given ones (which
+   hold the three bitmaps back to back). A file of size zero is taken
+   as empty coverage. Returns 1 in case of success, or 0 in case of
+   failure (with errno set). */
+static int mergeFromFile(int fd, uint64_t size, uint64_t *bitmaps)
+{
+  coverage_header_t header;
+  uint64_t words = 3 * ((size + 63) / 64);
+  uint64_t buffer[4096];
+  ssize_t count;
+
+  count = pread(fd, &header, sizeof(header), 0);
+  if (count == 0)
+    return 1;
+  if (count != sizeof(header) ||
+      memcmp(header.magic, COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC)) != 0 ||
+      header.version != COVERAGE_VERSION || header.size != size)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+
+  for (uint64_t done = 0; done < words; )
+  {
+    uint64_t chunk = words - done < 4096 ? words - done : 4096;
+    count = pread(fd, buffer, chunk * sizeof(uint64_t),
+		  sizeof(header) + done * sizeof(uint64_t));
+    if (count != (ssize_t)(chunk * sizeof(uint64_t)))
+    {
+      if (count >= 0)
+	errno = EINVAL;
+      return 0;
+    }
+    for (uint64_t i = 0; i < chunk; i++)
+      bitmaps[done + i] |= buffer[i];
+    done += chunk;
+  }
+  return 1;
+}
+
+/* Adds the coverage stored in a file (written by coverageSave for an
+   image of the same size) to *coverage. Returns 1 in case of success,
+   or 0 in case of failure (with errno set). */
+int coverageMerge(coverage_t *coverage, const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  int result = mergeFromFile(fd, coverage->size, coverage->executed);
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  return result;
+}
+
+/* Adds *coverage to the coverage stored in a file, creating the file
+   if needed. The file is locked while it is updated, so many runs
+   can accumulate into the same file concurrently. Returns 1 in case
+   of success, or 0 in case of failure (with errno set). */
+int coverageSave(coverage_t *coverage, const char *filename)
+{
+  coverage_header_t header;
+  uint64_t bytes = 3 * coverage->words * sizeof(uint64_t);
+  uint64_t *merged;
+  int fd, result = 0, saved;
+
+  merged = malloc(bytes + 1);
+  if (!merged)
+    return 0;
+  memcpy(merged, coverage->executed, bytes);
+
+  fd = open(filename, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    free(merged);
+    return 0;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COVERAGE_MAGIC, sizeof(COVERAGE_MAGIC));
+  header.version = COVERAGE_VERSION;
+  header.size = coverage->size;
+
+  if (flock(fd, LOCK_EX) == 0 &&
+      mergeFromFile(fd, coverage->size, merged) &&
+      pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      pwrite(fd, merged, bytes, sizeof(header)) == (ssize_t)bytes)
+    result = 1;
+
+  saved = errno;
+  close(fd);
+  free(merged);
+  errno = saved;
+  return result;
+}
+
+static int testBit(const uint64_t *bitmap, uint64_t size, uint64_t address)
+{
+  return address < size && (bitmap[address >> 6] >> (address & 63)) & 1;
+}
+
+/* Prints the given Y86 source file annotated with coverage. Each line
+   is prefixed by '*' if its instruction was executed, "#####" if it
+   was not and '-' if it has no instruction, and conditional jumps by
+   T and/or N for the directions they went. A summary follows. Returns
+   1 in case of success, or 0 if the source could not be assembled or
+   read, in which case an error is printed. */
+int coverageReport(FILE *file, coverage_t *coverage, const char *source)
+{
+  assembly_t assembly;
+  FILE *text;
+  char *line = NULL;
+  size_t size = 0;
+  uint64_t next = 0, number = 0;
+  uint64_t instructions = 0, executed = 0, directions = 0, covered = 0;
+
+  assemblyInit(&assembly);
+  if (!assembleFile(&assembly, source) || !(text = fopen(source, "r")))
+  {
+    fprintf(file, "    # Cannot report coverage for %s: %s\n", source,
+	    assembly.error[0] ? assembly.error : strerror(errno));
+    assemblyFree(&assembly);
+    return 0;
+  }
+
+  while (getline(&line, &size, text) >= 0)
+  {
+    const char *mark = "-", *branch = "";
+    number++;
+
+    while (next < assembly.lineCount && assembly.lines[next].line < number)
+      next++;
+
+    if (next < assembly.lineCount && assembly.lines[next].line == number &&
+	!assembly.lines[next].isData)
+    {
+      uint64_t address = assembly.lines[next].address;
+      uint8_t opcode = assembly.image[address];
+
+      instructions++;
+      if (testBit(coverage->executed, coverage->size, address))
+      {
+	executed++;
+	mark = "*";
+      }
+      else
+	mark = "#####";
+
+      // Conditional jumps have two directions to cover.
+      if (opcode >> 4 == I_JXX && (opcode & 0xf) != C_NC)
+      {
+	int taken = testBit(coverage->taken, coverage->size, address);
+	int notTaken = testBit(coverage->notTaken, coverage->size, address);
+	static const char *marks[] = { "--", "-N", "T-", "TN" };
+
+	directions += 2;
+	covered += taken + notTaken;
+	branch = marks[taken * 2 + notTaken];
+      }
+    }
+
+    fprintf(file, "%6s %2s %5lu: %s", mark, branch, number, line);
+    if (!strchr(line, '\n'))
+      fputc('\n', file);
+  }
+
+  fprintf(file, "# Instructions executed: %lu of %lu\n", executed, instructions);
+  fprintf(file, "# Branch directions taken: %lu of %lu\n", covered, directions);
+
+  free(line);
+  fclose(text);
+  assemblyFree(&assembly);
+  return 1;
+}
@@ -0,0 +1,51 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in coverage.c
+*/
+
+#ifndef _COVERAGE_H_
+#define _COVERAGE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define COVERAGE_MAGIC   "Y86COV"
+#define COVERAGE_VERSION 1
+
+/* Coverage of a guest image, as one bit per guest address. executed
+   has the bit of every address an instruction was executed at, taken
+   and notTaken the bit of every conditional jump that went each way. */
+typedef struct coverage {
+
+  uint64_t  size;
+  uint64_t  words;
+
+  uint64_t *executed;
+  uint64_t *taken;
+  uint64_t *notTaken;
+} coverage_t;
+
+int coverageInit(coverage_t *coverage, uint64_t size);
+void coverageFree(coverage_t *coverage);
+void coverageReset(coverage_t *coverage);
+
+/* Marks the instruction at the given address as executed. */
+static inline void coverageRecord(coverage_t *coverage, uint64_t address)
+{
+  if (address < coverage->size)
+    coverage->executed[address >> 6] |= 1ULL << (address & 63);
+}
+
+/* Marks the direction a conditional jump at the given address went. */
+static inline void coverageRecordBranch(coverage_t *coverage,
+					uint64_t address, int taken)
+{
+  if (address < coverage->size)
+    (taken ? coverage->taken : coverage->notTaken)[address >> 6] |=
+      1ULL << (address & 63);
+}
+
+int coverageMerge(coverage_t *coverage, const char *filename);
+int coverageSave(coverage_t *coverage, const char *filename);
+int coverageReport(FILE *file, coverage_t *coverage, const char *source);
+
+#endif /* COVERAGE */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -11,15 +12,40 @@
 #include <errno.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
 
 #include "instruction.h"
 #include "printRoutines.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "assembler.h"
+#include "coverage.h"
+#include "history.h"
+#include "dirty.h"
+#include "memscan.h"
+#include "hoststats.h"
+#include "heatmap.h"
+#include "reload.h"
+#include "display.h"
+#include "ranges.h"
+#include "explore.h"
+#include "fusion.h"
+#include "imageload.h"
+#include "mi.h"
 
 #define ERROR_RETURN -1
 #define SUCCESS 0
 
 #define MAX_LINE 256
 
+// matches printed by find, the others are only counted
+#define MAX_MATCHES 100
+
+// instructions executed between checks of the clock and of SIGINT
+#define WATCHDOG_INTERVAL 1024
+
 // structure for linked list node
 struct breakpoint
 {
@@ -30,16 +56,129 @@ struct breakpoint
 struct breakpoint *head = NULL;
 struct breakpoint *end = NULL;
 
+// address ranges stopping execution when the PC enters them, or when
+// the guest writes to them, and where the last instruction was
+range_set_t breakRanges;
+range_set_t watchRanges;
+uint64_t lastLocation;
+
+// labels of the program being debugged, if its source is available
+symbol_table_t symbols;
+char *sourceFile = NULL;
+
+// checkpoints used to go back to an earlier instruction count
+history_t history;
+
+// guest code coverage, recorded while enabled
+coverage_t coverage;
+int coverageEnabled = 0;
+
+// pages written since the last execution command; named marks are
+// also attached to the machine, after it
+dirty_tracker_t lastStop;
+
+// pages written since the image was loaded, kept when it is reloaded
+dirty_tracker_t imageWrites;
+
+// when the image file was last modified as loaded, and the inotify
+// watch reloading it when it is rebuilt, or -1
+struct timespec imageModified;
+int reloadWatchFd = -1;
+
+// the machine interface, with --mi: the command in progress, with its
+// id, where it started and the message it failed with, if it did, and
+// why execution last stopped if not at the instruction reached
+mi_channel_t mi;
+int miEnabled = 0;
+int miCommandPending = 0;
+char miId[64], miCommand[MAX_LINE + 1], miError[MAX_LINE + 1];
+uint64_t miStartCount, miStartPC;
+const char *stopReason;
+
+// the thread faulting in the image in the background, with --prefault
+image_prefault_t prefault;
+int prefaultEnabled = 0;
+
+// expressions shown when they change, and the pages written since
+// they were last shown, attached while there are displays
+display_list_t displays;
+dirty_tracker_t displayWrites;
+
+// limits on each run, in instructions and in nanoseconds, 0 for none
+uint64_t instructionBudget = 0;
+uint64_t timeLimit = 0;
+
+// progress of the current run, and whether SIGINT asked to stop it
+uint64_t runStart, runSteps, runDeadline;
+volatile sig_atomic_t interrupted = 0;
+
+// host counters of the interpreter, per guest icode, while enabled
+hoststats_t hostStats;
+int hostStatsOpened = 0, hostStatsEnabled = 0;
+
+// guest memory accesses, counted while state.heatmap points to it
+heatmap_t heatmap;
+
+// decoded and fused instructions, attached to the machine during runs
+fusion_cache_t fusion;
+int fusionEnabled = 1;
+
+// parts of the state taken as unknown by explore, and its limits
+explore_free_t freeState;
+explore_limits_t exploreLimits = { EXPLORE_DEFAULT_DEPTH,
+                                   EXPLORE_DEFAULT_STATES,
+                                   EXPLORE_DEFAULT_STEPS, 0 };
+
 static void addBreakpoint(uint64_t address);
 static void deleteBreakpoint(uint64_t address);
 static void deleteAllBreakpoints(void);
 static int hasBreakpoint(uint64_t address);
+static int breakpointHit(machine_state_t *state);
+static void reportWatch(void);
+static int parseRange(const char *text, uint64_t *start, uint64_t *end);
+static int collectBreakpoints(uint64_t **addresses, uint64_t *count);
+static void loadSymbols(const char *filename);
+static void loadImageSymbols(const char *inputFile);
+static int stepInstruction(machine_state_t *state, y86_instruction_t *instr);
+static int enableCoverage(machine_state_t *state);
+static void startHistory(machine_state_t *state, uint64_t interval);
+static void seekInstructionCount(machine_state_t *state,
+                                 y86_instruction_t *instr, uint64_t target);
+static dirty_tracker_t *findMark(machine_state_t *state, const char *name);
+static void restartTrackers(machine_state_t *state);
+static size_t parsePattern(const char *text, uint8_t *pattern);
+static void findPattern(machine_state_t *state, uint64_t address,
+                        uint64_t size, const uint8_t *pattern,
+                        size_t patternLength);
+static void handleInterrupt(int signal);
+static uint64_t monotonicTime(void);
+static void startWatchdog(machine_state_t *state);
+static const char *watchdogStop(machine_state_t *state);
+static int parseSeconds(const char *text, uint64_t *nanoseconds);
+static void enableHostStats(void);
+static int enableHeatmap(machine_state_t *state, uint64_t interval);
+static void reloadInput(machine_state_t *state, y86_instruction_t *instr,
+                        int *fd, const char *inputFile);
+static int fusionStop(void *context, uint64_t address);
+static void startFusion(machine_state_t *state);
+static int stepFused(machine_state_t *state, y86_instruction_t *instr);
+static void traceInstruction(machine_state_t *state, y86_instruction_t *instr);
+static void finishMiCommand(machine_state_t *state, y86_instruction_t *instr);
+static void commandFailed(const char *format, ...);
+static void invalidCommand(char *command, char *parameters);
+static int parseFree(const char *text, int value);
+static void printFreeState(void);
+static int parseExploreLimits(char *parameters, explore_limits_t *limits);
 
 int main(int argc, char **argv)
 {
 
-  int fd;
+  int fd = -1;
   struct stat st;
+  const char *inputFile = NULL, *startingPC = NULL, *resumeFile = NULL;
+  const char *coverageFile = NULL, *budget = NULL, *timeout = NULL;
+  const char *heatmapPrefix = NULL;
+  int badUsage = 0;
 
   machine_state_t state;
   y86_instruction_t nextInstruction;
@@ -49,82 +188,195 @@ int main(int argc, char **argv)
   char *command, *parameters;
   int c;
 
-  // Verify that the command line has an appropriate number of
-  // arguments
-  if (argc < 2 || argc > 3)
+  // Separate the options from the positional arguments.
+  for (int i = 1; i < argc; i++)
   {
-    fprintf(stderr, "Usage: %s InputFilename [startingPC]\n", argv[0]);
-    return ERROR_RETURN;
+    if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+      resumeFile = argv[++i];
+    else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc)
+      coverageFile = argv[++i];
+    else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc)
+      heatmapPrefix = argv[++i];
+    else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+      budget = argv[++i];
+    else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+      timeout = argv[++i];
+    else if (strcmp(argv[i], "--prefault") == 0)
+      prefaultEnabled = 1;
+    else if (strcmp(argv[i], "--mi") == 0)
+      miEnabled = 1;
+    else if (!inputFile)
+      inputFile = argv[i];
+    else if (!startingPC)
+      startingPC = argv[i];
+    else
+      badUsage = 1;
   }
 
-  // First argument is the file to read, attempt to open it for
-  // reading and verify that the open did occur.
-  fd = open(argv[1], O_RDONLY);
+  if (budget)
+  {
+    char *end;
+    instructionBudget = strtoull(budget, &end, 0);
+    if (end == budget || *end)
+      badUsage = 1;
+  }
+  if (timeout && !parseSeconds(timeout, &timeLimit))
+    badUsage = 1;
 
-  if (fd < 0)
+  // Verify that the command line has an appropriate number of
+  // arguments: either an input file or a snapshot to resume, not both.
+  if (badUsage || !inputFile == !resumeFile || (resumeFile && startingPC))
   {
-    fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+    fprintf(stderr, "Usage: %s [options] InputFilename [startingPC]\n"
+                    "       %s [options] --resume SnapshotFilename\n"
+                    "Options: --coverage CoverageFilename\n"
+                    "         --heatmap HeatmapPrefix\n"
+                    "         --budget Instructions (per run)\n"
+                    "         --timeout Seconds (per run)\n"
+                    "         --prefault\n"
+                    "         --mi (JSON records, one per line)\n",
+            argv[0], argv[0]);
     return ERROR_RETURN;
   }
 
-  if (fstat(fd, &st) < 0)
+  // From here on, standard output is captured into console records.
+  if (miEnabled && !miInit(&mi))
   {
-    fprintf(stderr, "Failed to stat %s: %s\n", argv[1], strerror(errno));
-    close(fd);
+    fprintf(stderr, "Failed to start the machine interface: %s\n",
+            strerror(errno));
     return ERROR_RETURN;
   }
 
-  state.programSize = st.st_size;
+  if (resumeFile)
+  {
+    uint64_t *breakpoints, breakpointCount;
+    if (!loadSnapshot(resumeFile, &state, &breakpoints, &breakpointCount))
+    {
+      fprintf(stderr, "Failed to resume %s: %s\n", resumeFile, strerror(errno));
+      return ERROR_RETURN;
+    }
+    for (uint64_t i = 0; i < breakpointCount; i++)
+      addBreakpoint(breakpoints[i]);
+    free(breakpoints);
 
-  // If there is a 2nd argument present it is an offset so convert it
-  // to a numeric value.
-  if (3 <= argc)
+    printf("# Resumed %s, PC 0x%lX\n", resumeFile, state.programCounter);
+  }
+  else
   {
-    errno = 0;
-    state.programCounter = strtoul(argv[2], NULL, 0);
-    if (errno != 0)
+    // First argument is the file to read, attempt to open it for
+    // reading and verify that the open did occur.
+    fd = open(inputFile, O_RDONLY);
+
+    if (fd < 0)
     {
-      perror("Invalid program counter on command line");
+      fprintf(stderr, "Failed to open %s: %s\n", inputFile, strerror(errno));
+      return ERROR_RETURN;
+    }
+
+    if (fstat(fd, &st) < 0)
+    {
+      fprintf(stderr, "Failed to stat %s: %s\n", inputFile, strerror(errno));
       close(fd);
       return ERROR_RETURN;
     }
-    if (state.programCounter > state.programSize)
+
+    state.programSize = st.st_size;
+    imageModified = st.st_mtim;
+
+    // If there is a 2nd argument present it is an offset so convert it
+    // to a numeric value.
+    if (startingPC)
+    {
+      errno = 0;
+      state.programCounter = strtoul(startingPC, NULL, 0);
+      if (errno != 0)
+      {
+        perror("Invalid program counter on command line");
+        close(fd);
+        return ERROR_RETURN;
+      }
+      if (state.programCounter > state.programSize)
+      {
+        fprintf(stderr, "Program counter on command line (%lu) "
+                        "larger than file size (%lu).\n",
+                state.programCounter, state.programSize);
+        close(fd);
+        return ERROR_RETURN;
+      }
+    }
+
+    // Maps the entire file to memory. This is equivalent to reading the
+    // entire file using functions like fread, but the data is only
+    // retrieved on demand, i.e., when the specific region of the file
+    // is needed.
+    state.programMap = mmap(NULL, state.programSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+    if (state.programMap == MAP_FAILED)
     {
-      fprintf(stderr, "Program counter on command line (%lu) "
-                      "larger than file size (%lu).\n",
-              state.programCounter, state.programSize);
+      fprintf(stderr, "Failed to map %s: %s\n", inputFile, strerror(errno));
       close(fd);
       return ERROR_RETURN;
     }
+
+    // Move to first non-zero byte, skipping holes in the file and
+    // reading the rest a word at a time, then read ahead only the
+    // code found there.
+    state.programCounter = imageFirstData(fd, state.programMap,
+                                          state.programSize,
+                                          state.programCounter);
+    imageAdvise(state.programMap, state.programSize, state.programCounter);
+    if (prefaultEnabled &&
+        !imagePrefaultStart(&prefault, fd, state.programMap, state.programSize))
+      fprintf(stderr, "Failed to prefault %s: %s\n", inputFile,
+              strerror(errno));
+
+    printf("# Opened %s, starting PC 0x%lX\n", inputFile, state.programCounter);
+
+    loadImageSymbols(inputFile);
   }
 
-  // Maps the entire file to memory. This is equivalent to reading the
-  // entire file using functions like fread, but the data is only
-  // retrieved on demand, i.e., when the specific region of the file
-  // is needed.
-  state.programMap = mmap(NULL, state.programSize, PROT_READ | PROT_WRITE,
-                          MAP_PRIVATE, fd, 0);
-  if (state.programMap == MAP_FAILED)
-  {
-    fprintf(stderr, "Failed to map %s: %s\n", argv[1], strerror(errno));
-    close(fd);
+  if (coverageFile && !enableCoverage(&state))
+    return ERROR_RETURN;
+  if (heatmapPrefix && !enableHeatmap(&state, HEATMAP_DEFAULT_INTERVAL))
     return ERROR_RETURN;
-  }
 
-  // Move to first non-zero byte
-  while (!state.programMap[state.programCounter])
-    state.programCounter++;
+  startHistory(&state, HISTORY_DEFAULT_INTERVAL);
+  dirtyInit(&lastStop, NULL, state.programSize);
+  dirtyAttach(&state, &lastStop);
+  dirtyInit(&imageWrites, NULL, state.programSize);
+  dirtyAttach(&state, &imageWrites);
+  displayInit(&displays);
+  exploreFreeInit(&freeState);
 
-  printf("# Opened %s, starting PC 0x%lX\n", argv[1], state.programCounter);
+  // SIGINT stops the guest at the next check instead of the debugger.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleInterrupt;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
 
   fetchInstruction(&state, &nextInstruction);
-  printInstruction(stdout, &nextInstruction);
+  if (miEnabled)
+    miStop(&mi, "start", &state, &nextInstruction);
+  else
+    printInstruction(stdout, &nextInstruction);
 
   while (1)
   {
 
+    // Waiting for a command is not part of the last instruction.
+    if (hostStatsEnabled)
+      hoststatsPause(&hostStats, nextInstruction.icode);
+
+    if (displays.count)
+      displayRender(stdout, &displays, &state, &displayWrites);
+
+    if (miEnabled)
+      finishMiCommand(&state, &nextInstruction);
+
     // Show prompt, but only if input comes from a terminal
-    if (isatty(STDIN_FILENO))
+    else if (isatty(STDIN_FILENO))
       printf("> ");
 
     // Read one line, if EOF break loop
@@ -140,6 +392,8 @@ int main(int argc, char **argv)
       if (c == '\n')
       {
         printErrorCommandTooLong(stdout);
+        if (miEnabled)
+          miResult(&mi, NULL, NULL, "error", "Command is too long");
         continue;
       }
       else
@@ -149,6 +403,14 @@ int main(int argc, char **argv)
       }
     }
 
+    // Commands may come as JSON objects in MI mode.
+    if (miEnabled && miParseCommand(line, sizeof(line), miId,
+                                    sizeof(miId)) < 0)
+    {
+      miResult(&mi, NULL, NULL, "error", "Invalid JSON command");
+      continue;
+    }
+
     // Obtain the command name, separate it from the arguments.
     command = strtok(line, " \t\n\f\r\v");
     // If line is blank, repeat previous command.
@@ -166,6 +428,20 @@ int main(int argc, char **argv)
 
     sprintf(previousLine, "%s %s\n", command, parameters ? parameters : "");
 
+    stopReason = NULL;
+    if (miEnabled)
+    {
+      strcpy(miCommand, command);
+      miStartCount = state.instructionCount;
+      miStartPC = state.programCounter;
+      miError[0] = '\0';
+      miCommandPending = 1;
+    }
+
+    // Run the command against the image as rebuilt since the last one.
+    if (reloadWatchFd >= 0 && reloadPending(reloadWatchFd, inputFile))
+      reloadInput(&state, &nextInstruction, &fd, inputFile);
+
     /* Quit or Exit */
     if (strcasecmp(command, "quit") == 0 || strcasecmp(command, "exit") == 0)
     {
@@ -175,10 +451,12 @@ int main(int argc, char **argv)
     /* Step */
     else if (strcasecmp(command, "step") == 0)
     {
+      dirtyReset(&lastStop);
+      watchRanges.hit = 0;
 
       // Execute instruction at current program counter. Print instruction if
       // instruction is invalid.
-      if (executeInstruction(&state, &nextInstruction) == 0)
+      if (stepInstruction(&state, &nextInstruction) == 0)
       {
         printInstruction(stdout, &nextInstruction);
         continue;
@@ -187,57 +465,77 @@ int main(int argc, char **argv)
       // executed.
       else
       {
-        fetchInstruction(&state, &nextInstruction);
         printInstruction(stdout, &nextInstruction);
       }
+      reportWatch();
     }
 
     /* Run */
     else if (strcasecmp(command, "run") == 0)
     {
+      const char *reason = NULL;
+
+      dirtyReset(&lastStop);
+      watchRanges.hit = 0;
+      startWatchdog(&state);
+      startFusion(&state);
 
-      if (executeInstruction(&state, &nextInstruction) == 0)
+      if (stepInstruction(&state, &nextInstruction) == 0)
       {
-        printInstruction(stdout, &nextInstruction);
+        traceInstruction(&state, &nextInstruction);
         continue;
       }
       else
       {
-        fetchInstruction(&state, &nextInstruction);
-        printInstruction(stdout, &nextInstruction);
+        traceInstruction(&state, &nextInstruction);
       }
 
       // Repeated Execution
-      while (!hasBreakpoint(state.programCounter) &&
+      while (!breakpointHit(&state) &&
              nextInstruction.icode != I_HALT &&
-             nextInstruction.icode != I_INVALID)
+             nextInstruction.icode != I_INVALID &&
+             !(reason = watchdogStop(&state)))
       {
 
+        if (state.fusion && stepFused(&state, &nextInstruction))
+          continue;
+
         // Execute current instruction. Print if invalid.
         // Fetch next instruction otherwise.
-        if (executeInstruction(&state, &nextInstruction) == 0)
+        if (stepInstruction(&state, &nextInstruction) == 0)
         {
-          printInstruction(stdout, &nextInstruction);
+          traceInstruction(&state, &nextInstruction);
           continue;
         }
         else
         {
-          fetchInstruction(&state, &nextInstruction);
-          printInstruction(stdout, &nextInstruction);
+          traceInstruction(&state, &nextInstruction);
         }
       }
+
+      state.fusion = NULL;
+      reportWatch();
+      if (reason)
+      {
+        stopReason = reason;
+        printf("    # Stopped: %s at instruction count %lu\n", reason,
+               state.instructionCount);
+      }
     }
 
     /* Next */
     else if (strcasecmp(command, "next") == 0)
     {
+      dirtyReset(&lastStop);
+      watchRanges.hit = 0;
+      lastLocation = state.programCounter;
 
       // Instruction is not function call
       if (nextInstruction.icode != I_CALL)
       {
 
         // Same as Step command.
-        if (executeInstruction(&state, &nextInstruction) == 0)
+        if (stepInstruction(&state, &nextInstruction) == 0)
         {
           printf("In execute failure case.");
           printInstruction(stdout, &nextInstruction);
@@ -246,7 +544,6 @@ int main(int argc, char **argv)
         else
         {
           printf("execute worked, calling fetch.");
-          fetchInstruction(&state, &nextInstruction);
           printf("execute worked, fetch worked.");
           printInstruction(stdout, &nextInstruction);
         }
@@ -256,21 +553,24 @@ int main(int argc, char **argv)
 
         // Save stack pointer
         uint64_t stackPointer = state.registerFile[R_RSP];
+        const char *reason = NULL;
+
+        startWatchdog(&state);
 
         // Repeated execution
-        while (!hasBreakpoint(state.programCounter) &&
+        while (!breakpointHit(&state) &&
                nextInstruction.icode != I_HALT &&
-               nextInstruction.icode != I_INVALID)
+               nextInstruction.icode != I_INVALID &&
+               !(reason = watchdogStop(&state)))
         {
 
-          if (executeInstruction(&state, &nextInstruction) == 0)
+          if (stepInstruction(&state, &nextInstruction) == 0)
           {
             printInstruction(stdout, &nextInstruction);
             break;
           }
           else
           {
-            fetchInstruction(&state, &nextInstruction);
 
             // Break if the function has returned
             if (stackPointer == state.registerFile[R_RSP])
@@ -280,7 +580,17 @@ int main(int argc, char **argv)
             }
           }
         }
+
+        stopReason = reason;
+        if (reason || watchRanges.hit)
+        {
+          if (reason)
+            printf("    # Stopped: %s at instruction count %lu\n", reason,
+                   state.instructionCount);
+          printInstruction(stdout, &nextInstruction);
+        }
       }
+      reportWatch();
     }
 
     /* Jump */
@@ -289,13 +599,21 @@ int main(int argc, char **argv)
       // prints invalid command if address parameter provided
       if (!parameters)
       {
-        printErrorInvalidCommand(stdout, command, parameters);
+        invalidCommand(command, parameters);
         continue;
       }
       else
       {
-        uint64_t address = strtoul(parameters, NULL, 16);
+        uint64_t address;
+        if (!parseAddress(&symbols, parameters, &address))
+        {
+          invalidCommand(command, parameters);
+          continue;
+        }
         state.programCounter = address;
+        // Replaying from an earlier checkpoint must not miss the jump.
+        if (state.history)
+          historyCheckpoint(state.history, &state);
         fetchInstruction(&state, &nextInstruction);
         printInstruction(stdout, &nextInstruction);
       }
@@ -304,30 +622,173 @@ int main(int argc, char **argv)
     /* Break */
     else if (strcasecmp(command, "break") == 0)
     {
-      if (parameters)
+      uint64_t start, end;
+
+      if (!parameters)
+      {
+        for (uint64_t i = 0; i < breakRanges.count; i++)
+          printf("    # Break on entering 0x%lx-0x%lx\n",
+                 breakRanges.ranges[i].start, breakRanges.ranges[i].end);
+      }
+      else if (strchr(parameters, '-'))
+      {
+        if (!parseRange(parameters, &start, &end))
+          invalidCommand(command, parameters);
+        else
+          rangeAdd(&breakRanges, start, end);
+      }
+      else
       {
-        uint64_t address = strtoul(parameters, NULL, 16);
-        addBreakpoint(address);
+        uint64_t address;
+        if (!parseAddress(&symbols, parameters, &address))
+          invalidCommand(command, parameters);
+        else
+          addBreakpoint(address);
       }
     }
 
     /* Delete */
     else if (strcasecmp(command, "delete") == 0)
     {
-      if (parameters)
+      uint64_t start, end;
+
+      if (parameters && strchr(parameters, '-'))
+      {
+        if (!parseRange(parameters, &start, &end))
+          invalidCommand(command, parameters);
+        else if (!rangeDelete(&breakRanges, start, end))
+          commandFailed("No break range 0x%lx-0x%lx", start, end);
+      }
+      else if (parameters)
+      {
+        uint64_t address;
+        if (!parseAddress(&symbols, parameters, &address))
+          invalidCommand(command, parameters);
+        else
+          deleteBreakpoint(address);
+      }
+    }
+
+    /* Watch */
+    else if (strcasecmp(command, "watch") == 0)
+    {
+      uint64_t start, end;
+
+      if (!parameters)
+      {
+        for (uint64_t i = 0; i < watchRanges.count; i++)
+          printf("    # Watching writes to 0x%lx-0x%lx\n",
+                 watchRanges.ranges[i].start, watchRanges.ranges[i].end);
+      }
+      else if (!parseRange(parameters, &start, &end))
+        invalidCommand(command, parameters);
+      else
       {
-        uint64_t address = strtoul(parameters, NULL, 16);
-        deleteBreakpoint(address);
+        rangeAdd(&watchRanges, start, end);
+        state.watches = &watchRanges;
       }
     }
 
+    /* Unwatch */
+    else if (strcasecmp(command, "unwatch") == 0)
+    {
+      uint64_t start, end;
+
+      if (!parameters)
+        rangeSetFree(&watchRanges);
+      else if (!parseRange(parameters, &start, &end))
+        invalidCommand(command, parameters);
+      else if (!rangeDelete(&watchRanges, start, end))
+        printf("    # Not watching 0x%lx-0x%lx\n", start, end);
+      if (!watchRanges.count)
+        state.watches = NULL;
+    }
+
     /* Registers */
     else if (strcasecmp(command, "registers") == 0)
     {
-      for (int i = R_RAX; i < R_NONE; ++i)
+      if (miEnabled)
+        miRegisters(&mi, &state);
+      else
+        for (int i = R_RAX; i < R_NONE; ++i)
+        {
+          printRegisterValue(stdout, &state, i);
+        }
+    }
+
+    /* Display */
+    else if (strcasecmp(command, "display") == 0 ||
+             strncasecmp(command, "display/", 8) == 0)
+    {
+      char *end = command + 7;
+      uint64_t count = command[7] ? strtoull(command + 8, &end, 0) : 1;
+      char *expression = parameters ? strtok(parameters, " \t") : NULL;
+      char text[MAX_LINE + 32];
+      y86_register_t reg = R_NONE;
+      display_kind_t kind;
+      uint64_t address = 0;
+
+      if (!expression && !command[7])
+      {
+        displayPrintList(stdout, &displays);
+        continue;
+      }
+      if (end == command + 8 || *end || count == 0 || !expression)
+      {
+        invalidCommand(command, parameters);
+        continue;
+      }
+
+      if (strcasecmp(expression, "registers") == 0)
+        kind = DISPLAY_REGISTERS;
+      else if (strcasecmp(expression, "cc") == 0)
+        kind = DISPLAY_CC;
+      else if (parseRegisterName(expression, strlen(expression), &reg))
+        kind = DISPLAY_REGISTER;
+      else if (parseAddress(&symbols, expression, &address))
+        kind = DISPLAY_MEMORY;
+      else
+      {
+        invalidCommand(command, parameters);
+        continue;
+      }
+      if (kind != DISPLAY_MEMORY && command[7])
       {
-        printRegisterValue(stdout, &state, i);
+        invalidCommand(command, parameters);
+        continue;
+      }
+
+      if (command[7])
+        sprintf(text, "/%lu %s", count, expression);
+      else
+        strcpy(text, expression);
+      if (!displays.count)
+      {
+        dirtyFree(&displayWrites);
+        dirtyInit(&displayWrites, NULL, state.programSize);
+        dirtyAttach(&state, &displayWrites);
       }
+      if (!displayAdd(stdout, &displays, &state, text, kind, reg, address,
+                      count))
+        printf("    # Not enough memory to display %s\n", text);
+      if (!displays.count)
+        dirtyDetach(&state, &displayWrites);
+    }
+
+    /* Undisplay */
+    else if (strcasecmp(command, "undisplay") == 0)
+    {
+      char *end;
+      uint64_t number = parameters ? strtoull(parameters, &end, 0) : 0;
+
+      if (parameters && end == parameters)
+        invalidCommand(command, parameters);
+      else if (parameters && !displayDelete(&displays, number))
+        printf("    # There is no display %lu\n", number);
+      else if (!parameters)
+        displayDeleteAll(&displays);
+      if (!displays.count)
+        dirtyDetach(&state, &displayWrites);
     }
 
     /* Examine */
@@ -336,120 +797,1428 @@ int main(int argc, char **argv)
       // print invalid command if address parameter not provided
       if (!parameters)
       {
-        printErrorInvalidCommand(stdout, command, parameters);
+        invalidCommand(command, parameters);
       }
       else
       {
-        uint64_t address = strtoul(parameters, NULL, 16);
-        printMemoryValueQuad(stdout, &state, address);
+        uint64_t address;
+        if (!parseAddress(&symbols, parameters, &address))
+          invalidCommand(command, parameters);
+        else if (miEnabled)
+          miMemory(&mi, &state, address, 8);
+        else
+          printMemoryValueQuad(stdout, &state, address);
       }
     }
 
-    /* Command not listed above */
-    else
+    /* Dump memory, x/<count in bytes> or x for a single line */
+    else if (strncasecmp(command, "x/", 2) == 0 || strcasecmp(command, "x") == 0)
     {
-      printErrorInvalidCommand(stdout, command, parameters);
-    }
-  }
+      char *end = command + 1;
+      uint64_t count = command[1] ? strtoull(command + 2, &end, 0) :
+                                    MEMSCAN_LINE_BYTES;
+      uint64_t address;
 
-  /* Close all resources, delete breakpoints and terminate debugger */
-  deleteAllBreakpoints();
-  munmap(state.programMap, state.programSize);
-  close(fd);
-  return SUCCESS;
-}
+      if (end == command + 2 || *end || !parameters ||
+          !parseAddress(&symbols, parameters, &address))
+        invalidCommand(command, parameters);
+      else if (miEnabled)
+        miMemory(&mi, &state, address, count);
+      else
+        printMemoryDump(stdout, &state, address, count);
+    }
 
-/* Adds an address to the list of breakpoints. If the address is
- * already in the list, it is not added again. */
-static void addBreakpoint(uint64_t address)
-{
+    /* Find */
+    else if (strcasecmp(command, "find") == 0)
+    {
+      char *start = parameters ? strtok(parameters, " \t") : NULL;
+      char *length = start ? strtok(NULL, " \t") : NULL;
+      char *text = length ? strtok(NULL, "") : NULL;
+      uint8_t pattern[MAX_LINE];
+      size_t patternLength = text ? parsePattern(text, pattern) : 0;
+      uint64_t address, size = 0;
+      char *end = length;
 
-  if (hasBreakpoint(address) == 0)
-  {
-    struct breakpoint *newBreakpoint = (struct breakpoint *)malloc(sizeof(struct breakpoint));
-    newBreakpoint->value = address;
-    newBreakpoint->next = NULL;
+      if (length)
+        size = strtoull(length, &end, 0);
+      if (!patternLength || end == length || *end ||
+          !parseAddress(&symbols, start, &address))
+        invalidCommand(command, parameters);
+      else
+        findPattern(&state, address, size, pattern, patternLength);
+    }
 
-    if (head == NULL && end == NULL)
+    /* Save */
+    else if (strcasecmp(command, "save") == 0)
     {
-      head = newBreakpoint;
-      end = newBreakpoint;
+      char *filename = parameters ? strtok(parameters, " \t") : NULL;
+      uint64_t *breakpoints, breakpointCount;
+
+      if (!filename)
+      {
+        invalidCommand(command, parameters);
+        continue;
+      }
+
+      if (!collectBreakpoints(&breakpoints, &breakpointCount))
+      {
+        commandFailed("Failed to save %s: %s", filename, strerror(errno));
+        continue;
+      }
+      if (saveSnapshot(filename, &state, breakpoints, breakpointCount))
+        printf("    # Session saved to %s\n", filename);
+      else
+        commandFailed("Failed to save %s: %s", filename, strerror(errno));
+      free(breakpoints);
     }
-    else
+
+    /* Load */
+    else if (strcasecmp(command, "load") == 0)
     {
-      end->next = newBreakpoint;
-      end = newBreakpoint;
-    }
-  }
-}
+      char *filename = parameters ? strtok(parameters, " \t") : NULL;
+      machine_state_t loaded = state;
+      uint64_t *breakpoints, breakpointCount;
 
-/* Deletes an address from the list of breakpoints. If the address is
- * not in the list, nothing happens. */
-static void deleteBreakpoint(uint64_t address)
-{
-  struct breakpoint *pointer = head;
-  struct breakpoint *previous = NULL;
+      if (!filename)
+      {
+        invalidCommand(command, parameters);
+        continue;
+      }
 
-  while (pointer != NULL)
-  {
-    if (pointer->value == address)
-    {
-      if (previous == NULL && pointer == head)
+      if (!loadSnapshot(filename, &loaded, &breakpoints, &breakpointCount))
       {
-        previous = head;
-        head = head->next;
+        commandFailed("Failed to load %s: %s", filename, strerror(errno));
+        continue;
       }
-      else
+
+      // Replace the current session with the loaded one. The image
+      // faulted in is about to be unmapped; a snapshot has no file of
+      // its own behind it, so there is nothing to fault in after.
+      imagePrefaultStop(&prefault);
+      munmap(state.programMap, state.programSize);
+      if (coverage.executed && loaded.programSize != state.programSize)
       {
-        previous->next = pointer->next;
+        coverageFree(&coverage);
+        if (coverageEnabled && !enableCoverage(&loaded))
+          coverageEnabled = 0;
       }
-      free(pointer);
-      pointer = NULL;
-      break;
-    }
-    previous = pointer;
-    pointer = pointer->next;
-  }
-}
+      if (heatmap.lineReads && loaded.programSize != state.programSize)
+      {
+        uint64_t interval = heatmap.interval;
+        heatmapFree(&heatmap);
+        loaded.heatmap = NULL;
+        if (state.heatmap)
+          enableHeatmap(&loaded, interval);
+      }
+      state = loaded;
+      startHistory(&state, history.interval);
+      restartTrackers(&state);
+      // Snapshots keep breakpoints but not ranges, which belonged to
+      // the image replaced.
+      deleteAllBreakpoints();
+      rangeSetFree(&breakRanges);
+      rangeSetFree(&watchRanges);
+      state.watches = NULL;
+      for (uint64_t i = 0; i < breakpointCount; i++)
+        addBreakpoint(breakpoints[i]);
+      free(breakpoints);
 
-/* Deletes and frees all breakpoints. */
-static void deleteAllBreakpoints(void)
-{
+      // The session no longer comes from the image file.
+      inputFile = NULL;
+      if (fd >= 0)
+        close(fd);
+      fd = -1;
+      if (reloadWatchFd >= 0)
+        close(reloadWatchFd);
+      reloadWatchFd = -1;
 
-  struct breakpoint *pointer = head;
-  struct breakpoint *temp = NULL;
+      printf("    # Session loaded from %s\n", filename);
+      fetchInstruction(&state, &nextInstruction);
+      printInstruction(stdout, &nextInstruction);
+    }
 
-  while (pointer != NULL)
-  {
-    temp = pointer->next;
-    free(pointer);
-    pointer = temp;
-  }
+    /* Reload */
+    else if (strcasecmp(command, "reload") == 0)
+    {
+      char *option = parameters ? strtok(parameters, " \t") : NULL;
+      char *value = option ? strtok(NULL, " \t") : NULL;
 
-  head = NULL;
-  end = NULL;
-}
+      if (option && (strcasecmp(option, "auto") != 0 || !value ||
+                     (strcasecmp(value, "on") != 0 &&
+                      strcasecmp(value, "off") != 0)))
+        invalidCommand(command, parameters);
+      else if (!inputFile)
+        printf("    # There is no image file to reload\n");
+      else if (!option)
+        reloadInput(&state, &nextInstruction, &fd, inputFile);
+      else if (strcasecmp(value, "off") == 0)
+      {
+        if (reloadWatchFd >= 0)
+          close(reloadWatchFd);
+        reloadWatchFd = -1;
+        printf("    # Automatic reload is off\n");
+      }
+      else if (reloadWatchFd < 0 && (reloadWatchFd = reloadWatch(inputFile)) < 0)
+        commandFailed("Failed to watch %s: %s", inputFile, strerror(errno));
+      else
+        printf("    # Reloading %s when it changes\n", inputFile);
+    }
 
-/* Returns true (non-zero) if the address corresponds to a breakpoint
- * in the list of breakpoints, or false (zero) otherwise. */
-static int hasBreakpoint(uint64_t address)
-{
+    /* Symbols */
+    else if (strcasecmp(command, "symbols") == 0)
+    {
+      char *filename = parameters ? strtok(parameters, " \t") : NULL;
 
-  struct breakpoint *pointer = head;
-  int found = 0;
+      if (!filename)
+        invalidCommand(command, parameters);
+      else
+        loadSymbols(filename);
+    }
 
-  while (pointer != NULL)
-  {
-    if (pointer->value == address)
+    /* Instruction count */
+    else if (strcasecmp(command, "icount") == 0)
     {
-      found = 1;
-      break;
+      printf("    # Instruction count = %lu\n", state.instructionCount);
     }
-    else
+
+    /* Go to instruction count */
+    else if (strcasecmp(command, "goto-icount") == 0)
     {
-      pointer = pointer->next;
+      char *end;
+      uint64_t target = parameters ? strtoull(parameters, &end, 0) : 0;
+
+      if (!parameters || end == parameters)
+        invalidCommand(command, parameters);
+      else
+      {
+        dirtyReset(&lastStop);
+        seekInstructionCount(&state, &nextInstruction, target);
+      }
     }
-  }
 
-  return found;
+    /* Checkpoints */
+    else if (strcasecmp(command, "checkpoints") == 0)
+    {
+      char *end;
+      uint64_t interval = parameters ? strtoull(parameters, &end, 0) : 0;
+
+      if (!parameters)
+      {
+        if (state.history)
+          printf("    # %lu checkpoints every %lu instructions, %lu bytes\n",
+                 history.checkpointCount, history.interval,
+                 historyMemoryUsed(&history));
+        else
+          printf("    # Checkpoints are off\n");
+      }
+      else if (end == parameters)
+        invalidCommand(command, parameters);
+      else
+        // Earlier checkpoints are dropped; 0 turns checkpoints off.
+        startHistory(&state, interval);
+    }
+
+    /* Coverage */
+    else if (strcasecmp(command, "coverage") == 0)
+    {
+      char *action = parameters ? strtok(parameters, " \t") : NULL;
+      char *filename = action ? strtok(NULL, " \t") : NULL;
+
+      if (!action)
+        printf("    # Coverage is %s\n", coverageEnabled ? "on" : "off");
+      else if (strcasecmp(action, "on") == 0)
+        enableCoverage(&state);
+      else if (strcasecmp(action, "off") == 0)
+        coverageEnabled = 0;
+      else if (!coverage.executed)
+        printf("    # Coverage was never enabled\n");
+      else if (strcasecmp(action, "reset") == 0)
+        coverageReset(&coverage);
+      else if (strcasecmp(action, "save") == 0 && filename)
+      {
+        if (!coverageSave(&coverage, filename))
+          commandFailed("Failed to save coverage to %s: %s", filename,
+                      strerror(errno));
+      }
+      else if (strcasecmp(action, "merge") == 0 && filename)
+      {
+        if (!coverageMerge(&coverage, filename))
+          commandFailed("Failed to merge coverage from %s: %s", filename,
+                      strerror(errno));
+      }
+      else if (strcasecmp(action, "report") == 0 && (filename || sourceFile))
+        coverageReport(stdout, &coverage, filename ? filename : sourceFile);
+      else
+        invalidCommand(command, parameters);
+    }
+
+    /* Mark */
+    else if (strcasecmp(command, "mark") == 0)
+    {
+      char *name = parameters ? strtok(parameters, " \t") : NULL;
+      dirty_tracker_t *mark;
+
+      if (!name)
+      {
+        for (mark = state.trackers; mark; mark = mark->next)
+          if (mark->name)
+            printf("    # Mark %s, %lu pages written\n", mark->name,
+                   mark->count);
+      }
+      else if ((mark = findMark(&state, name)))
+        dirtyReset(mark);
+      else if (!(mark = malloc(sizeof(*mark))) ||
+               !dirtyInit(mark, name, state.programSize))
+      {
+        if (mark)
+          dirtyFree(mark);
+        free(mark);
+        printf("    # Not enough memory to set mark %s\n", name);
+      }
+      else
+        dirtyAttach(&state, mark);
+    }
+
+    /* Changes */
+    else if (strcasecmp(command, "changes") == 0)
+    {
+      char *name = parameters ? strtok(parameters, " \t") : NULL;
+      dirty_tracker_t *mark = name ? findMark(&state, name) : &lastStop;
+
+      if (!mark)
+        commandFailed("No mark named %s", name);
+      else if (dirtyPrintChanges(stdout, mark, &state) == 0)
+        printf("    # No changes\n");
+    }
+
+    /* Instruction budget */
+    else if (strcasecmp(command, "budget") == 0)
+    {
+      char *end;
+      uint64_t value = parameters ? strtoull(parameters, &end, 0) : 0;
+
+      if (!parameters)
+      {
+        if (instructionBudget)
+          printf("    # Runs stop after %lu instructions\n", instructionBudget);
+        else
+          printf("    # No instruction budget\n");
+      }
+      else if (end == parameters)
+        invalidCommand(command, parameters);
+      else
+        // 0 removes the budget.
+        instructionBudget = value;
+    }
+
+    /* Time limit */
+    else if (strcasecmp(command, "timeout") == 0)
+    {
+      if (!parameters)
+      {
+        if (timeLimit)
+          printf("    # Runs stop after %.3f seconds\n", timeLimit / 1e9);
+        else
+          printf("    # No time limit\n");
+      }
+      else if (!parseSeconds(parameters, &timeLimit))
+        invalidCommand(command, parameters);
+    }
+
+    /* Host statistics */
+    else if (strcasecmp(command, "hoststats") == 0)
+    {
+      char *action = parameters ? strtok(parameters, " \t") : NULL;
+
+      if (action && strcasecmp(action, "on") == 0)
+        enableHostStats();
+      else if (action && strcasecmp(action, "off") == 0)
+        hostStatsEnabled = 0;
+      else if (!hostStatsOpened)
+        printf("    # Host statistics were never enabled\n");
+      else if (!action)
+        hoststatsReport(stdout, &hostStats);
+      else if (strcasecmp(action, "reset") == 0)
+        hoststatsReset(&hostStats);
+      else
+        invalidCommand(command, parameters);
+    }
+
+    /* Heatmap */
+    else if (strcasecmp(command, "heatmap") == 0)
+    {
+      char *action = parameters ? strtok(parameters, " \t") : NULL;
+      char *argument = action ? strtok(NULL, " \t") : NULL;
+      char *end = argument;
+      uint64_t interval = argument ? strtoull(argument, &end, 0) : 0;
+
+      if (action && strcasecmp(action, "on") == 0)
+      {
+        if (argument && (end == argument || *end))
+          invalidCommand(command, parameters);
+        else
+          enableHeatmap(&state, argument ? interval : HEATMAP_DEFAULT_INTERVAL);
+      }
+      else if (action && strcasecmp(action, "off") == 0)
+        state.heatmap = NULL;
+      else if (!heatmap.lineReads)
+        printf("    # Heatmap was never enabled\n");
+      else if (!action)
+        heatmapReport(stdout, &heatmap);
+      else if (strcasecmp(action, "reset") == 0)
+        heatmapReset(&heatmap, state.instructionCount);
+      else if (strcasecmp(action, "save") == 0 && argument)
+      {
+        if (!heatmapSave(&heatmap, argument))
+          commandFailed("Failed to save heatmap to %s: %s", argument,
+                      strerror(errno));
+      }
+      else
+        invalidCommand(command, parameters);
+    }
+
+    /* Fusion */
+    else if (strcasecmp(command, "fusion") == 0)
+    {
+      char *action = parameters ? strtok(parameters, " \t") : NULL;
+
+      if (action && strcasecmp(action, "on") == 0)
+        fusionEnabled = 1;
+      else if (action && strcasecmp(action, "off") == 0)
+        fusionEnabled = 0;
+      else if (!action || strcasecmp(action, "stats") == 0)
+        fusionReport(stdout, &fusion);
+      else if (strcasecmp(action, "reset") == 0)
+        fusionResetStats(&fusion);
+      else
+        invalidCommand(command, parameters);
+    }
+
+    /* Free */
+    else if (strcasecmp(command, "free") == 0 ||
+             strcasecmp(command, "unfree") == 0)
+    {
+      int value = strcasecmp(command, "free") == 0;
+
+      if (!parameters && value)
+        printFreeState();
+      else if (!parameters)
+        exploreFreeClear(&freeState);
+      else
+        for (char *item = strtok(parameters, " \t"); item;
+             item = strtok(NULL, " \t"))
+          if (!parseFree(item, value))
+            invalidCommand(command, item);
+    }
+
+    /* Explore */
+    else if (strcasecmp(command, "explore") == 0)
+    {
+      explore_limits_t limits = exploreLimits;
+      explore_result_t result;
+
+      if (parameters && !parseExploreLimits(parameters, &limits))
+      {
+        invalidCommand(command, parameters);
+        continue;
+      }
+      if (!exploreRun(&state, &freeState, &limits, &result))
+        commandFailed("Exploration stopped early: %s", strerror(errno));
+      exploreReport(stdout, &result, &symbols);
+      exploreResultFree(&result);
+    }
+
+    /* Command not listed above */
+    else
+    {
+      invalidCommand(command, parameters);
+    }
+  }
+
+  if (miEnabled)
+    finishMiCommand(&state, &nextInstruction);
+
+  /* Close all resources, delete breakpoints and terminate debugger */
+  deleteAllBreakpoints();
+  rangeSetFree(&breakRanges);
+  rangeSetFree(&watchRanges);
+  symbolTableFree(&symbols);
+  free(sourceFile);
+  historyFree(&history);
+  if (coverageFile && !coverageSave(&coverage, coverageFile))
+    fprintf(stderr, "Failed to save coverage to %s: %s\n", coverageFile,
+            strerror(errno));
+  coverageFree(&coverage);
+  if (hostStatsOpened)
+    hoststatsFree(&hostStats);
+  if (heatmapPrefix && !heatmapSave(&heatmap, heatmapPrefix))
+    fprintf(stderr, "Failed to save heatmap to %s: %s\n", heatmapPrefix,
+            strerror(errno));
+  heatmapFree(&heatmap);
+  while (state.trackers)
+  {
+    dirty_tracker_t *tracker = state.trackers;
+    dirtyDetach(&state, tracker);
+    dirtyFree(tracker);
+    if (tracker != &lastStop && tracker != &imageWrites &&
+        tracker != &displayWrites)
+      free(tracker);
+  }
+  dirtyFree(&displayWrites);
+  displayFree(&displays);
+  exploreFreeClear(&freeState);
+  fusionFree(&fusion);
+  if (reloadWatchFd >= 0)
+    close(reloadWatchFd);
+  imagePrefaultStop(&prefault);
+  munmap(state.programMap, state.programSize);
+  if (fd >= 0)
+    close(fd);
+  miFree(&mi);
+  return SUCCESS;
+}
+
+/* Adds an address to the list of breakpoints. If the address is
+ * already in the list, it is not added again. */
+static void addBreakpoint(uint64_t address)
+{
+
+  if (hasBreakpoint(address) == 0)
+  {
+    struct breakpoint *newBreakpoint = (struct breakpoint *)malloc(sizeof(struct breakpoint));
+    newBreakpoint->value = address;
+    newBreakpoint->next = NULL;
+
+    if (head == NULL && end == NULL)
+    {
+      head = newBreakpoint;
+      end = newBreakpoint;
+    }
+    else
+    {
+      end->next = newBreakpoint;
+      end = newBreakpoint;
+    }
+  }
+}
+
+/* Deletes an address from the list of breakpoints. If the address is
+ * not in the list, nothing happens. */
+static void deleteBreakpoint(uint64_t address)
+{
+  struct breakpoint *pointer = head;
+  struct breakpoint *previous = NULL;
+
+  while (pointer != NULL)
+  {
+    if (pointer->value == address)
+    {
+      if (previous == NULL && pointer == head)
+      {
+        previous = head;
+        head = head->next;
+      }
+      else
+      {
+        previous->next = pointer->next;
+      }
+      free(pointer);
+      pointer = NULL;
+      break;
+    }
+    previous = pointer;
+    pointer = pointer->next;
+  }
+}
+
+/* Deletes and frees all breakpoints. */
+static void deleteAllBreakpoints(void)
+{
+
+  struct breakpoint *pointer = head;
+  struct breakpoint *temp = NULL;
+
+  while (pointer != NULL)
+  {
+    temp = pointer->next;
+    free(pointer);
+    pointer = temp;
+  }
+
+  head = NULL;
+  end = NULL;
+}
+
+/* Returns true (non-zero) if the address corresponds to a breakpoint
+ * in the list of breakpoints, or false (zero) otherwise. */
+static int hasBreakpoint(uint64_t address)
+{
+
+  struct breakpoint *pointer = head;
+  int found = 0;
+
+  while (pointer != NULL)
+  {
+    if (pointer->value == address)
+    {
+      found = 1;
+      break;
+    }
+    else
+    {
+      pointer = pointer->next;
+    }
+  }
+
+  return found;
+}
+
+/* Returns true (non-zero) if execution should stop before the next
+ * instruction: at a breakpoint, on entering a break range from outside
+ * it, or after a write to a watched range. */
+static int breakpointHit(machine_state_t *state)
+{
+
+  return hasBreakpoint(state->programCounter) || watchRanges.hit ||
+         (rangeContains(&breakRanges, state->programCounter) &&
+          !rangeContains(&breakRanges, lastLocation));
+}
+
+/* Tells where the guest wrote to a watched range, if it did since the
+ * last execution command. */
+static void reportWatch(void)
+{
+
+  if (watchRanges.hit)
+  {
+    const range_t *range = rangeSearch(&watchRanges, watchRanges.hitAddress);
+    printf("    # Write to 0x%lx, watching 0x%lx-0x%lx\n",
+           watchRanges.hitAddress, range->start, range->end);
+    stopReason = "watched write";
+    watchRanges.hit = 0;
+  }
+}
+
+/* Reads a range of addresses written start-end, end excluded, or a
+ * single address, taken as the quad-word at it. Returns 1 in case of
+ * success, or 0 if the range is invalid or empty. */
+static int parseRange(const char *text, uint64_t *start, uint64_t *end)
+{
+
+  char first[strlen(text) + 1];
+  char *dash;
+
+  strcpy(first, text);
+  dash = strchr(first, '-');
+  if (!dash)
+  {
+    if (!parseAddress(&symbols, first, start))
+      return 0;
+    *end = *start + 8;
+    return 1;
+  }
+  *dash = '\0';
+  return parseAddress(&symbols, first, start) &&
+         parseAddress(&symbols, dash + 1, end) && *end > *start;
+}
+
+/* Stores the addresses of all breakpoints into a newly allocated
+ * array (to be freed by the caller), and how many there are into
+ * *count. Returns 1 in case of success, or 0 with errno set if memory
+ * could not be allocated. */
+static int collectBreakpoints(uint64_t **addresses, uint64_t *count)
+{
+
+  struct breakpoint *pointer;
+
+  *count = 0;
+  for (pointer = head; pointer != NULL; pointer = pointer->next)
+    (*count)++;
+
+  *addresses = malloc((*count ? *count : 1) * sizeof(uint64_t));
+  if (!*addresses)
+    return 0;
+  *count = 0;
+  for (pointer = head; pointer != NULL; pointer = pointer->next)
+    (*addresses)[(*count)++] = pointer->value;
+
+  return 1;
+}
+
+/* Replaces the current labels with the ones defined in the given
+ * symbol map (.sym) or assembly source file, and uses them to
+ * annotate instructions. */
+static void loadSymbols(const char *filename)
+{
+
+  const char *extension = strrchr(filename, '.');
+  symbol_table_t loaded;
+
+  if (extension && strcmp(extension, ".sym") == 0)
+  {
+    symbolTableInit(&loaded);
+    if (!loadSymbolsFromMap(&loaded, filename))
+    {
+      commandFailed("Failed to read symbols from %s: %s", filename,
+                  strerror(errno));
+      return;
+    }
+  }
+  else
+  {
+    assembly_t assembly;
+    assemblyInit(&assembly);
+    if (!assembleFile(&assembly, filename))
+    {
+      printf("    # Failed to read symbols from %s: %s\n", filename,
+             assembly.error);
+      assemblyFree(&assembly);
+      return;
+    }
+    // Keep the labels, drop the rest of the assembly.
+    loaded = assembly.symbols;
+    symbolTableInit(&assembly.symbols);
+    assemblyFree(&assembly);
+
+    // Remember the source, to report coverage against it.
+    free(sourceFile);
+    sourceFile = strdup(filename);
+  }
+
+  symbolTableFree(&symbols);
+  symbols = loaded;
+  printSetSymbols(&symbols);
+  printf("# Loaded %lu symbols from %s\n", symbols.count, filename);
+}
+
+/* Loads the labels of an image from the symbol map or the assembly
+ * source next to it, with the same name and a .sym or .ys extension,
+ * if there is one. */
+static void loadImageSymbols(const char *inputFile)
+{
+
+  char source[strlen(inputFile) + sizeof(".sym")];
+  char *extension;
+
+  strcpy(source, inputFile);
+  extension = strrchr(source, '.');
+  if (extension && !strchr(extension, '/'))
+    *extension = '\0';
+  extension = source + strlen(source);
+  strcpy(extension, ".sym");
+  if (access(source, R_OK) != 0)
+    strcpy(extension, ".ys");
+  if (access(source, R_OK) == 0)
+    loadSymbols(source);
+}
+
+/* Executes the instruction in *instr and, if that succeeded, fetches
+ * the following one into *instr. Coverage is recorded here when
+ * enabled, so every way of running the guest is accounted for.
+ * Returns 0 if the instruction could not be executed, 1 otherwise. */
+static int stepInstruction(machine_state_t *state, y86_instruction_t *instr)
+{
+
+  y86_icode_t icode = instr->icode;
+
+  lastLocation = instr->location;
+  if (hostStatsEnabled)
+    hoststatsCharge(&hostStats, PHASE_OUTPUT, icode);
+
+  if (coverageEnabled && instr->icode < I_INVALID)
+    coverageRecord(&coverage, instr->location);
+
+  if (executeInstruction(state, instr) == 0)
+  {
+    stopReason = "execution error";
+    return 0;
+  }
+
+  if (hostStatsEnabled)
+    hoststatsCharge(&hostStats, PHASE_EXECUTE, icode);
+
+  if (state->history)
+    historyRecordInstruction(state->history, state);
+
+  if (state->heatmap)
+    heatmapRecordInstruction(state->heatmap, state->instructionCount);
+
+  if (coverageEnabled && instr->icode == I_JXX && instr->ifun != C_NC)
+    coverageRecordBranch(&coverage, instr->location,
+                         state->programCounter == instr->valC);
+
+  fetchInstruction(state, instr);
+  if (hostStatsEnabled)
+    hoststatsCharge(&hostStats, PHASE_DECODE, instr->icode);
+  return 1;
+}
+
+/* Starts recording coverage, allocating the bitmaps for the current
+ * image if needed. Returns 1 in case of success, 0 otherwise. */
+static int enableCoverage(machine_state_t *state)
+{
+
+  if (!coverage.executed && !coverageInit(&coverage, state->programSize))
+  {
+    printf("    # Not enough memory to record coverage\n");
+    return 0;
+  }
+  coverageEnabled = 1;
+  return 1;
+}
+
+/* Starts counting memory accesses, allocating the counters for the
+ * current image if needed, with a working set sample every interval
+ * instructions. Returns 1 in case of success, 0 otherwise. */
+static int enableHeatmap(machine_state_t *state, uint64_t interval)
+{
+
+  if (interval == 0)
+  {
+    printf("    # The sampling interval must not be zero\n");
+    return 0;
+  }
+  if (!heatmap.lineReads &&
+      !heatmapInit(&heatmap, state->programSize, interval,
+                   state->instructionCount))
+  {
+    printf("    # Not enough memory to record the heatmap\n");
+    return 0;
+  }
+  heatmap.interval = interval;
+  state->heatmap = &heatmap;
+  return 1;
+}
+
+/* Restarts the execution history from the current state, with a
+ * checkpoint every interval instructions, or turns it off if the
+ * interval is zero. */
+static void startHistory(machine_state_t *state, uint64_t interval)
+{
+
+  historyFree(&history);
+  state->history = NULL;
+  if (interval == 0)
+    return;
+
+  if (historyInit(&history, state, interval))
+    state->history = &history;
+  else
+  {
+    historyFree(&history);
+    printf("    # Not enough memory to record checkpoints\n");
+  }
+}
+
+/* Brings the machine to the given instruction count, by restoring the
+ * closest earlier checkpoint when going back, then executing forward
+ * without stopping at breakpoints. Prints the next instruction. */
+static void seekInstructionCount(machine_state_t *state,
+                                 y86_instruction_t *instr, uint64_t target)
+{
+
+  if (target < state->instructionCount)
+  {
+    if (!state->history || !historyRewind(state->history, state, target))
+    {
+      commandFailed("No checkpoint before instruction count %lu", target);
+      return;
+    }
+    fetchInstruction(state, instr);
+  }
+
+  const char *reason = NULL;
+  startWatchdog(state);
+  while (state->instructionCount < target && !(reason = watchdogStop(state)))
+    if (stepInstruction(state, instr) == 0)
+      break;
+
+  if (reason)
+    printf("    # Stopped: %s at instruction count %lu\n", reason,
+           state->instructionCount);
+  else if (state->instructionCount != target)
+    printf("    # Stopped at instruction count %lu\n", state->instructionCount);
+  printInstruction(stdout, instr);
+}
+
+/* Returns the mark with the given name, or NULL if there is none. */
+static dirty_tracker_t *findMark(machine_state_t *state, const char *name)
+{
+
+  for (dirty_tracker_t *tracker = state->trackers; tracker;
+       tracker = tracker->next)
+    if (tracker->name && strcmp(tracker->name, name) == 0)
+      return tracker;
+  return NULL;
+}
+
+/* Starts every tracker again from the current memory, which may now
+ * have a different size. */
+static void restartTrackers(machine_state_t *state)
+{
+
+  for (dirty_tracker_t *tracker = state->trackers; tracker;
+       tracker = tracker->next)
+  {
+    dirty_tracker_t *next = tracker->next;
+    char *name = tracker->name;
+
+    tracker->name = NULL;
+    dirtyFree(tracker);
+    if (!dirtyInit(tracker, name, state->programSize))
+      printf("    # Not enough memory to track changes\n");
+    tracker->next = next;
+    free(name);
+  }
+
+  // Displays cannot tell which pages changed either.
+  displays.stale = 1;
+}
+
+/* Converts the pattern given to find into bytes: a quad-word if it
+ * starts with 0x (stored little-endian, as in memory), text between
+ * double quotes, or else a sequence of hex bytes, optionally separated
+ * by spaces. Returns the number of bytes, or 0 if the pattern is
+ * invalid. */
+static size_t parsePattern(const char *text, uint8_t *pattern)
+{
+
+  size_t length = 0;
+  char *end;
+
+  while (isspace((unsigned char)*text))
+    text++;
+
+  if (strncasecmp(text, "0x", 2) == 0)
+  {
+    errno = 0;
+    uint64_t value = strtoull(text, &end, 16);
+    while (isspace((unsigned char)*end))
+      end++;
+    if (errno || end == text + 2 || *end)
+      return 0;
+    for (length = 0; length < 8; length++)
+      pattern[length] = value >> (8 * length);
+    return length;
+  }
+
+  if (*text == '"')
+  {
+    end = strchr(text + 1, '"');
+    if (!end)
+      return 0;
+    memcpy(pattern, text + 1, end - text - 1);
+    return end - text - 1;
+  }
+
+  while (*text)
+  {
+    if (isspace((unsigned char)*text))
+    {
+      text++;
+      continue;
+    }
+    if (!isxdigit((unsigned char)text[0]) || !isxdigit((unsigned char)text[1]))
+      return 0;
+    char digits[3] = {text[0], text[1], '\0'};
+    pattern[length++] = strtoul(digits, NULL, 16);
+    text += 2;
+  }
+  return length;
+}
+
+/* Prints where the pattern occurs in size bytes of memory from the
+ * address, up to MAX_MATCHES of them, then how many were found. */
+static void findPattern(machine_state_t *state, uint64_t address,
+                        uint64_t size, const uint8_t *pattern,
+                        size_t patternLength)
+{
+
+  uint64_t valid = address < state->programSize ?
+                   state->programSize - address : 0;
+  uint64_t length = size < valid ? size : valid;
+  const uint8_t *data = state->programMap + address;
+  uint64_t offset = 0, found = 0;
+
+  while (offset < length)
+  {
+    size_t match = memFind(data + offset, length - offset, pattern,
+                           patternLength);
+    if (match == length - offset)
+      break;
+    if (found < MAX_MATCHES)
+      printMemoryMatch(stdout, address + offset + match);
+    found++;
+    offset += match + 1;
+  }
+
+  if (found > MAX_MATCHES)
+    printf("    # %lu more not shown\n", found - MAX_MATCHES);
+  printf("    # %lu matches\n", found);
+  if (length < size)
+    printErrorInvalidMemoryLocation(stdout, NULL, address + length);
+}
+
+static void handleInterrupt(int signal)
+{
+
+  interrupted = 1;
+}
+
+/* Returns the time in nanoseconds on a clock that never goes back. */
+static uint64_t monotonicTime(void)
+{
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Starts the budget and the time limit of a run from now. An earlier
+ * SIGINT received at the prompt is forgotten. */
+static void startWatchdog(machine_state_t *state)
+{
+
+  runStart = state->instructionCount;
+  runSteps = 0;
+  runDeadline = timeLimit ? monotonicTime() + timeLimit : 0;
+  interrupted = 0;
+}
+
+/* Returns why a run must stop before its next instruction, or NULL to
+ * go on. The budget is a comparison done every time; the clock and
+ * SIGINT are only checked every WATCHDOG_INTERVAL calls, which also
+ * catches a run stuck on an instruction that cannot execute. */
+static const char *watchdogStop(machine_state_t *state)
+{
+
+  if (instructionBudget &&
+      state->instructionCount - runStart >= instructionBudget)
+    return "instruction budget reached";
+  if (++runSteps % WATCHDOG_INTERVAL)
+    return NULL;
+  if (interrupted)
+    return "interrupted";
+  if (runDeadline && monotonicTime() >= runDeadline)
+    return "time limit reached";
+  return NULL;
+}
+
+/* Converts a number of seconds, possibly fractional, to nanoseconds.
+ * Returns 1 in case of success, or 0 if the text is not a valid
+ * number of seconds. */
+static int parseSeconds(const char *text, uint64_t *nanoseconds)
+{
+
+  char *end;
+  double seconds = strtod(text, &end);
+
+  while (isspace((unsigned char)*end))
+    end++;
+  if (end == text || *end || !(seconds >= 0) || seconds > 1e9)
+    return 0;
+  *nanoseconds = seconds * 1e9;
+  return 1;
+}
+
+/* Starts attributing host counters to guest instructions, opening the
+ * counters the first time. */
+static void enableHostStats(void)
+{
+
+  if (!hostStatsOpened)
+  {
+    if (hoststatsInit(&hostStats))
+      printf("    # Host statistics use perf_event, %d counters\n",
+             hostStats.counterCount);
+    else
+      printf("    # Host statistics use rdtsc, perf_event_open failed: %s\n",
+             strerror(errno));
+    hostStatsOpened = 1;
+  }
+  hostStatsEnabled = 1;
+}
+
+/* Replaces the image with the current contents of its file, keeping
+ * the registers and the data the guest wrote on pages that did not
+ * change in the file. Breakpoints on changed pages follow their label
+ * to its new address, and are deleted if the label is gone. The next
+ * instruction is fetched again only if its bytes may have changed. */
+static void reloadInput(machine_state_t *state, y86_instruction_t *instr,
+                        int *fd, const char *inputFile)
+{
+
+  uint64_t *breakpoints, breakpointCount, *offsets;
+  uint64_t oldSize = state->programSize;
+  reload_result_t result;
+  struct stat current, loaded;
+  char **labels;
+
+  if (!collectBreakpoints(&breakpoints, &breakpointCount))
+  {
+    printf("    # Failed to reload %s: %s\n", inputFile, strerror(errno));
+    return;
+  }
+  labels = malloc((breakpointCount ? breakpointCount : 1) * sizeof(char *));
+  offsets = malloc((breakpointCount ? breakpointCount : 1) * sizeof(uint64_t));
+  if (!labels || !offsets)
+  {
+    printf("    # Failed to reload %s: %s\n", inputFile, strerror(errno));
+    free(labels);
+    free(offsets);
+    free(breakpoints);
+    return;
+  }
+
+  // A file rewritten in place cannot be compared with what it was, so
+  // do not take it as changed unless it was modified.
+  if (stat(inputFile, &current) == 0 && fstat(*fd, &loaded) == 0 &&
+      current.st_dev == loaded.st_dev && current.st_ino == loaded.st_ino &&
+      current.st_size == (off_t)oldSize &&
+      current.st_mtim.tv_sec == imageModified.tv_sec &&
+      current.st_mtim.tv_nsec == imageModified.tv_nsec)
+  {
+    printf("    # %s has not changed\n", inputFile);
+    free(labels);
+    free(offsets);
+    free(breakpoints);
+    return;
+  }
+
+  // Remember where each breakpoint is relative to its label, in case
+  // the code around it moves.
+  for (uint64_t i = 0; i < breakpointCount; i++)
+  {
+    const symbol_t *symbol = symbolLookupAddress(&symbols, breakpoints[i],
+                                                 &offsets[i]);
+    labels[i] = symbol ? strdup(symbol->name) : NULL;
+  }
+
+  // The image faulted in is about to be unmapped.
+  imagePrefaultStop(&prefault);
+  if (!reloadImage(state, fd, inputFile, &imageWrites, &result))
+  {
+    printf("    # Failed to reload %s: %s\n", inputFile, strerror(errno));
+    if (prefaultEnabled)
+      imagePrefaultStart(&prefault, *fd, state->programMap,
+                         state->programSize);
+    for (uint64_t i = 0; i < breakpointCount; i++)
+      free(labels[i]);
+    free(labels);
+    free(offsets);
+    free(breakpoints);
+    return;
+  }
+  if (fstat(*fd, &loaded) == 0)
+    imageModified = loaded.st_mtim;
+  imageAdvise(state->programMap, state->programSize, state->programCounter);
+  if (prefaultEnabled)
+    imagePrefaultStart(&prefault, *fd, state->programMap, state->programSize);
+
+  if (state->programSize != oldSize)
+  {
+    if (coverage.executed)
+    {
+      coverageFree(&coverage);
+      if (coverageEnabled && !enableCoverage(state))
+        coverageEnabled = 0;
+    }
+    if (heatmap.lineReads)
+    {
+      uint64_t interval = heatmap.interval;
+      int enabled = state->heatmap != NULL;
+      heatmapFree(&heatmap);
+      state->heatmap = NULL;
+      if (enabled)
+        enableHeatmap(state, interval);
+    }
+    restartTrackers(state);
+  }
+  else
+    dirtyReset(&imageWrites);
+  for (uint64_t page = 0; page < result.pageCount; page++)
+    if (result.kept[page >> 6] & (1ULL << (page & 63)))
+      dirtySavePage(&imageWrites, state, page);
+  startHistory(state, history.interval);
+
+  printf("    # Reloaded %s: %lu of %lu pages changed, %lu written pages "
+         "kept\n", inputFile, result.changedPages, result.pageCount,
+         result.keptPages);
+  if (result.inPlace)
+    printf("    # %s was rewritten in place: only the pages written by "
+           "the program were kept\n", inputFile);
+  else if (result.replacedPages)
+    printf("    # %lu pages written by the program changed in %s and were "
+           "replaced\n", result.replacedPages, inputFile);
+
+  loadImageSymbols(inputFile);
+
+  deleteAllBreakpoints();
+  for (uint64_t i = 0; i < breakpointCount; i++)
+  {
+    uint64_t address = breakpoints[i];
+
+    if (reloadPageMarked(&result, result.changed, address) && labels[i])
+    {
+      const symbol_t *symbol = symbolLookupName(&symbols, labels[i],
+                                                strlen(labels[i]));
+      if (!symbol || symbol->address + offsets[i] >= state->programSize)
+      {
+        printf("    # Deleted breakpoint at 0x%lx, %s is gone\n", address,
+               labels[i]);
+        address = UINT64_MAX;
+      }
+      else if (symbol->address + offsets[i] != address)
+      {
+        printf("    # Moved breakpoint at 0x%lx to 0x%lx (%s+%lu)\n",
+               address, symbol->address + offsets[i], labels[i], offsets[i]);
+        address = symbol->address + offsets[i];
+      }
+    }
+    else if (address >= state->programSize)
+    {
+      printf("    # Deleted breakpoint at 0x%lx, past the end of the image\n",
+             address);
+      address = UINT64_MAX;
+    }
+
+    if (address != UINT64_MAX)
+      addBreakpoint(address);
+    free(labels[i]);
+  }
+  free(labels);
+  free(offsets);
+  free(breakpoints);
+
+  // An instruction may span two pages.
+  if (reloadPageMarked(&result, result.changed, state->programCounter) ||
+      reloadPageMarked(&result, result.changed, state->programCounter + 9))
+  {
+    fetchInstruction(state, instr);
+    printInstruction(stdout, instr);
+  }
+  reloadResultFree(&result);
+}
+
+/* Tells the fusion cache where a run must be able to stop: at the
+ * breakpoints and in the break ranges. */
+static int fusionStop(void *context, uint64_t address)
+{
+
+  return hasBreakpoint(address) || rangeContains(&breakRanges, address);
+}
+
+/* Attaches the fusion cache to the machine for a run, emptied since
+ * memory and breakpoints may have changed since the last one. Nothing
+ * is fused while fusion is off or host statistics are counted per
+ * instruction. */
+static void startFusion(machine_state_t *state)
+{
+
+  fusion_cache_t stats = fusion;
+
+  state->fusion = NULL;
+  if (!fusionEnabled || hostStatsEnabled)
+    return;
+
+  if (fusion.entries && fusion.memorySize == state->programSize)
+    fusionReset(&fusion);
+  else
+  {
+    fusionFree(&fusion);
+    if (!fusionInit(&fusion, state->programSize))
+      return;
+    fusion.instructions = stats.instructions;
+    fusion.fusedInstructions = stats.fusedInstructions;
+    memcpy(fusion.groups, stats.groups, sizeof(fusion.groups));
+    fusion.invalidations = stats.invalidations;
+  }
+  state->fusion = &fusion;
+}
+
+/* Executes the sequence fused at the PC, if there is one and the
+ * budget allows it, recording it as stepInstruction would and printing
+ * each instruction after it, as a run does. Returns 1 if it did, or 0
+ * if the next instruction is to be executed alone. */
+static int stepFused(machine_state_t *state, y86_instruction_t *instr)
+{
+
+  const fusion_entry_t *entry = fusionLookup(&fusion, state, fusionStop,
+                                             NULL);
+  const y86_instruction_t *last = &entry->instr[entry->count - 1];
+
+  if (entry->count < 2 || (instructionBudget &&
+                           state->instructionCount - runStart + entry->count >
+                           instructionBudget))
+  {
+    fusion.instructions++;
+    return 0;
+  }
+
+  if (coverageEnabled)
+    for (int i = 0; i < entry->count; i++)
+      coverageRecord(&coverage, entry->instr[i].location);
+
+  fusionExecute(&fusion, state, entry);
+  lastLocation = last->location;
+
+  if (state->history)
+    historyRecordInstruction(state->history, state);
+  if (state->heatmap)
+    heatmapRecordInstruction(state->heatmap, state->instructionCount);
+  if (coverageEnabled && last->icode == I_JXX && last->ifun != C_NC)
+    coverageRecordBranch(&coverage, last->location,
+                         state->programCounter == last->valC);
+
+  for (int i = 1; i < entry->count; i++)
+    traceInstruction(state, (y86_instruction_t *)&entry->instr[i]);
+  fetchInstruction(state, instr);
+  traceInstruction(state, instr);
+  return 1;
+}
+
+/* Shows an instruction reached during a run: printed, or in MI mode
+ * only counted, for the next progress event. */
+static void traceInstruction(machine_state_t *state, y86_instruction_t *instr)
+{
+
+  if (miEnabled)
+    miTick(&mi, state);
+  else
+    printInstruction(stdout, instr);
+}
+
+/* Ends the MI command in progress: a stop event if it moved the
+ * machine, then its result, sent along with every record batched
+ * while it ran. */
+static void finishMiCommand(machine_state_t *state, y86_instruction_t *instr)
+{
+
+  const char *reason = stopReason;
+
+  if (!miCommandPending)
+    return;
+  miCommandPending = 0;
+
+  if (state->instructionCount != miStartCount ||
+      state->programCounter != miStartPC)
+  {
+    if (instr->icode == I_HALT)
+      reason = "halt";
+    else if (instr->icode == I_INVALID)
+      reason = "invalid instruction";
+    else if (instr->icode == I_TOO_SHORT)
+      reason = "incomplete instruction";
+    else if (!reason && hasBreakpoint(state->programCounter))
+      reason = "breakpoint";
+    else if (!reason && rangeContains(&breakRanges, state->programCounter))
+      reason = "break range";
+    miStop(&mi, reason ? reason : miCommand, state, instr);
+  }
+  if (miError[0])
+    miResult(&mi, miId, miCommand, "error", miError);
+  else
+    miResult(&mi, miId, miCommand, "done", NULL);
+}
+
+/* Tells that the command failed, with the message as printf formats
+ * it, which is also the message of its MI result. */
+static void commandFailed(const char *format, ...)
+{
+
+  va_list arguments;
+
+  va_start(arguments, format);
+  vsnprintf(miError, sizeof(miError), format, arguments);
+  va_end(arguments);
+  printf("    # %s\n", miError);
+}
+
+/* Tells that the command, or its parameters, are not valid. */
+static void invalidCommand(char *command, char *parameters)
+{
+
+  printErrorInvalidCommand(stdout, command, parameters);
+  snprintf(miError, sizeof(miError), "Invalid command or parameters: %s%s%s",
+           command, parameters ? " " : "", parameters ? parameters : "");
+}
+
+/* Marks a register (%rax), the condition codes (cc) or a range of
+ * memory as free for explore if value is 1, or as known if it is 0.
+ * Returns 1 in case of success, 0 if the text is none of these. */
+static int parseFree(const char *text, int value)
+{
+
+  y86_register_t reg;
+  uint64_t start, end;
+
+  if (strcasecmp(text, "cc") == 0)
+    freeState.conditionCodes = value;
+  else if (parseRegisterName(text, strlen(text), &reg) && reg < R_NONE)
+  {
+    if (value)
+      freeState.registers |= 1 << reg;
+    else
+      freeState.registers &= ~(1 << reg);
+  }
+  else if (!parseRange(text, &start, &end))
+    return 0;
+  else if (value)
+    rangeAdd(&freeState.memory, start, end);
+  else if (!rangeDelete(&freeState.memory, start, end))
+    printf("    # 0x%lx-0x%lx is not free\n", start, end);
+  return 1;
+}
+
+/* Lists what explore takes as free. */
+static void printFreeState(void)
+{
+
+  if (!freeState.registers && !freeState.conditionCodes &&
+      !freeState.memory.count)
+  {
+    printf("    # Nothing is free\n");
+    return;
+  }
+
+  printf("    # Free:");
+  for (int reg = R_RAX; reg < R_NONE; reg++)
+    if (freeState.registers & (1 << reg))
+    {
+      printf(" ");
+      printRegisterName(stdout, reg);
+    }
+  if (freeState.conditionCodes)
+    printf(" cc");
+  for (uint64_t i = 0; i < freeState.memory.count; i++)
+    printf(" 0x%lx-0x%lx", freeState.memory.ranges[i].start,
+           freeState.memory.ranges[i].end);
+  printf("\n");
+}
+
+/* Reads "depth N", "states N", "steps N" and "threads N" pairs into
+ * the limits. Returns 1 in case of success, 0 otherwise. */
+static int parseExploreLimits(char *parameters, explore_limits_t *limits)
+{
+
+  for (char *name = strtok(parameters, " \t"); name;
+       name = strtok(NULL, " \t"))
+  {
+    char *argument = strtok(NULL, " \t"), *end;
+    uint64_t value = argument ? strtoull(argument, &end, 0) : 0;
+
+    if (!argument || end == argument || *end)
+      return 0;
+    if (strcasecmp(name, "depth") == 0)
+      limits->depth = value;
+    else if (strcasecmp(name, "states") == 0 && value > 0)
+      limits->states = value;
+    else if (strcasecmp(name, "steps") == 0 && value > 0)
+      limits->steps = value;
+    else if (strcasecmp(name, "threads") == 0)
+      limits->threads = value;
+    else
+      return 0;
+  }
+  return 1;
 }
@@ -0,0 +1,30 @@
+/* This file contains the declarations of the decode tables, which are
+   generated at build time by mkdecode.c into decodeTable.c
+*/
+
+#ifndef _DECODE_H_
+#define _DECODE_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+/* How to decode an instruction, given its first byte. */
+typedef struct decode_entry {
+
+  uint8_t valid;             // icode and ifun form a valid instruction
+  uint8_t length;            // bytes taken by the instruction
+  uint8_t advance;           // bytes the PC moves past it (0 for halt)
+  uint8_t hasRegisters;      // a register byte follows
+  uint8_t hasValC;           // an 8-byte constant follows
+  uint8_t checkTarget;       // valC must be a valid address
+  uint8_t checkDisplacement; // valC + rB must be a valid address
+} decode_entry_t;
+
+extern const decode_entry_t decodeTable[256];
+
+/* Whether a register byte is valid for an instruction, indexed by
+   icode and by the register byte. */
+extern const uint8_t registerByteValid[16][256];
+
+#endif /* DECODE */
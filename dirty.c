@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dirty.h"
+#include "printRoutines.h"
+
+/* Starts tracking the pages of a memory of the given size, from now.
+   The name is copied, and may be NULL. Returns 1 in case of success,
+   or 0 if memory could not be allocated, in which case the tracker
+   sees no page. */
+int dirtyInit(dirty_tracker_t *tracker, const char *name, uint64_t memorySize)
+{
+  uint64_t pages = (memorySize + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+
+  memset(tracker, 0, sizeof(*tracker));
+  tracker->memorySize = memorySize;
+  tracker->bits = calloc((pages + 63) / 64 + 1, sizeof(uint64_t));
+  tracker->name = name ? strdup(name) : NULL;
+  if (!tracker->bits || (name && !tracker->name))
+  {
+    tracker->memorySize = 0;
+    return 0;
+  }
+  return 1;
+}
+
+void dirtyFree(dirty_tracker_t *tracker)
+{
+  free(tracker->name);
+  free(tracker->bits);
+  free(tracker->pages);
+  free(tracker->shadow);
+  memset(tracker, 0, sizeof(*tracker));
+}
+
+/* Moves the mark to now: no page is considered written any more. */
+void dirtyReset(dirty_tracker_t *tracker)
+{
+  for (uint64_t i = 0; i < tracker->count; i++)
+    tracker->bits[tracker->pages[i] >> 6] &= ~(1ULL << (tracker->pages[i] & 63));
+  tracker->count = 0;
+}
+
+/* Makes the tracker see the writes made to the machine's memory. */
+void dirtyAttach(machine_state_t *state, dirty_tracker_t *tracker)
+{
+  tracker->next = state->trackers;
+  state->trackers = tracker;
+}
+
+void dirtyDetach(machine_state_t *state, dirty_tracker_t *tracker)
+{
+  for (dirty_tracker_t **link = &state->trackers; *link; link = &(*link)->next)
+    if (*link == tracker)
+    {
+      *link = tracker->next;
+      break;
+    }
+  tracker->next = NULL;
+}
+
+/* Marks a page as written and saves its contents as of the mark, on
+   the first write to it. Returns 1 in case of success, or 0 if memory
+   could not be allocated (the page is then not tracked). */
+int dirtySavePage(dirty_tracker_t *tracker, machine_state_t *state,
+		  uint64_t page)
+{
+  uint64_t start = page * DIRTY_PAGE_SIZE;
+  uint64_t size = tracker->memorySize - start < DIRTY_PAGE_SIZE ?
+    tracker->memorySize - start : DIRTY_PAGE_SIZE;
+
+  if (tracker->count == tracker->capacity)
+  {
+    uint64_t capacity = tracker->capacity ? 2 * tracker->capacity : 16;
+    uint64_t *pages = realloc(tracker->pages, capacity * sizeof(uint64_t));
+    if (!pages)
+      return 0;
+    tracker->pages = pages;
+    uint8_t *shadow = realloc(tracker->shadow, capacity * DIRTY_PAGE_SIZE);
+    if (!shadow)
+      return 0;
+    tracker->shadow = shadow;
+    tracker->capacity = capacity;
+  }
+
+  tracker->pages[tracker->count] = page;
+  memcpy(tracker->shadow + tracker->count * DIRTY_PAGE_SIZE,
+	 state->programMap + start, size);
+  tracker->count++;
+  tracker->bits[page >> 6] |= 1ULL << (page & 63);
+  return 1;
+}
+
+/* Marks every page in a range of memory as written, for changes made
+   to memory other than through a guest store. Called before the range
+   is modified. */
+void dirtyRecordRange(machine_state_t *state, uint64_t address, uint64_t size)
+{
+  uint64_t first = address / DIRTY_PAGE_SIZE * DIRTY_PAGE_SIZE;
+
+  for (uint64_t page = first; page < address + size; page += DIRTY_PAGE_SIZE)
+    dirtyRecordWrite(state, page);
+}
+
+static int comparePages(const void *a, const void *b, void *pages)
+{
+  uint64_t left = ((const uint64_t *)pages)[*(const uint64_t *)a];
+  uint64_t right = ((const uint64_t *)pages)[*(const uint64_t *)b];
+  return left < right ? -1 : left > right;
+}
+
+/* Prints every quad-word that differs from its value at the mark, with
+   the old and new values, in address order. Only the pages written
+   since the mark are visited. Returns the number of quad-words
+   printed. */
+uint64_t dirtyPrintChanges(FILE *file, dirty_tracker_t *tracker,
+			   machine_state_t *state)
+{
+  uint64_t *order = malloc((tracker->count + 1) * sizeof(uint64_t));
+  uint64_t changes = 0;
+
+  if (!order)
+    return 0;
+
+  for (uint64_t i = 0; i < tracker->count; i++)
+    order[i] = i;
+  qsort_r(order, tracker->count, sizeof(uint64_t), comparePages,
+	  tracker->pages);
+
+  for (uint64_t i = 0; i < tracker->count; i++)
+  {
+    uint64_t start = tracker->pages[order[i]] * DIRTY_PAGE_SIZE;
+    const uint8_t *before = tracker->shadow + order[i] * DIRTY_PAGE_SIZE;
+    const uint8_t *after = state->programMap + start;
+    uint64_t size = tracker->memorySize - start < DIRTY_PAGE_SIZE ?
+      tracker->memorySize - start : DIRTY_PAGE_SIZE;
+
+    for (uint64_t offset = 0; offset < size; offset += 8)
+    {
+      uint64_t length = size - offset < 8 ? size - offset : 8;
+      uint64_t old = 0, new = 0;
+
+      if (memcmp(before + offset, after + offset, length) == 0)
+	continue;
+
+      // Memory is little-endian, like the host.
+      memcpy(&old, before + offset, length);
+      memcpy(&new, after + offset, length);
+      printMemoryChangeQuad(file, start + offset, old, new);
+      changes++;
+    }
+  }
+
+  free(order);
+  return changes;
+}
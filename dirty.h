@@ -0,0 +1,59 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in dirty.c
+*/
+
+#ifndef _DIRTY_H_
+#define _DIRTY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define DIRTY_PAGE_SIZE 4096
+
+/* Tracks the guest memory pages written since a mark. The bitmap has
+   one bit per page; the pages written are also listed, along with a
+   copy of their contents at the mark, so changes can be found by
+   visiting only those pages. */
+typedef struct dirty_tracker {
+
+  char     *name;
+  uint64_t  memorySize;
+
+  uint64_t *bits;
+  uint64_t *pages;
+  uint8_t  *shadow;
+  uint64_t  count;
+  uint64_t  capacity;
+
+  struct dirty_tracker *next;
+} dirty_tracker_t;
+
+int dirtyInit(dirty_tracker_t *tracker, const char *name, uint64_t memorySize);
+void dirtyFree(dirty_tracker_t *tracker);
+void dirtyReset(dirty_tracker_t *tracker);
+
+void dirtyAttach(machine_state_t *state, dirty_tracker_t *tracker);
+void dirtyDetach(machine_state_t *state, dirty_tracker_t *tracker);
+
+int dirtySavePage(dirty_tracker_t *tracker, machine_state_t *state,
+		  uint64_t page);
+void dirtyRecordRange(machine_state_t *state, uint64_t address, uint64_t size);
+uint64_t dirtyPrintChanges(FILE *file, dirty_tracker_t *tracker,
+			   machine_state_t *state);
+
+/* Marks the page containing the address as written, in every tracker
+   attached to the machine. Called before every guest store. */
+static inline void dirtyRecordWrite(machine_state_t *state, uint64_t address)
+{
+  uint64_t page = address / DIRTY_PAGE_SIZE;
+
+  for (dirty_tracker_t *tracker = state->trackers; tracker;
+       tracker = tracker->next)
+    if (address < tracker->memorySize &&
+	!(tracker->bits[page >> 6] & (1ULL << (page & 63))))
+      dirtySavePage(tracker, state, page);
+}
+
+#endif /* DIRTY */
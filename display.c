@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "display.h"
+#include "printRoutines.h"
+
+void displayInit(display_list_t *list)
+{
+  memset(list, 0, sizeof(*list));
+  list->nextNumber = 1;
+}
+
+static void freeDisplay(display_t *display)
+{
+  free(display->text);
+  free(display->shown);
+}
+
+void displayFree(display_list_t *list)
+{
+  for (uint64_t i = 0; i < list->count; i++)
+    freeDisplay(&list->displays[i]);
+  free(list->displays);
+  memset(list, 0, sizeof(*list));
+}
+
+/* Reads up to a quad-word of memory, little-endian. */
+static uint64_t readQuad(const uint8_t *bytes, uint64_t length)
+{
+  uint64_t value = 0;
+  memcpy(&value, bytes, length < 8 ? length : 8);
+  return value;
+}
+
+/* Sets which registers and condition codes are compared from the
+   displays left. */
+static void updateMasks(display_list_t *list)
+{
+  list->registerMask = 0;
+  list->showCC = 0;
+  for (uint64_t i = 0; i < list->count; i++)
+    switch (list->displays[i].kind)
+    {
+    case DISPLAY_REGISTER:
+      list->registerMask |= 1 << list->displays[i].reg;
+      break;
+    case DISPLAY_REGISTERS:
+      list->registerMask = (1 << R_NONE) - 1;
+      break;
+    case DISPLAY_CC:
+      list->showCC = 1;
+      break;
+    default:
+      break;
+    }
+}
+
+/* Clamps a memory display to the memory and copies what it shows now.
+   Returns 1 in case of success, or 0 if memory could not be allocated. */
+static int captureMemory(display_t *display, machine_state_t *state)
+{
+  uint64_t valid = display->address < state->programSize ?
+    state->programSize - display->address : 0;
+  uint64_t length = display->size < valid ? display->size : valid;
+  uint8_t *shown = realloc(display->shown, length ? length : 1);
+
+  if (!shown)
+    return 0;
+  display->shown = shown;
+  display->length = length;
+  memcpy(shown, state->programMap + display->address, length);
+  return 1;
+}
+
+/* Prints the quad-words of a memory display, or only those that differ
+   from what it showed last if changes is set, and keeps them. */
+static int showMemory(FILE *file, display_t *display, machine_state_t *state,
+		      int changes)
+{
+  const uint8_t *now = state->programMap + display->address;
+  int chars = 0;
+
+  for (uint64_t offset = 0; offset < display->length; offset += 8)
+  {
+    uint64_t length = display->length - offset;
+    uint64_t value = readQuad(now + offset, length);
+
+    if (!changes)
+      chars += fprintf(file, "    # M_8[0x%lx] = 0x%lx\n",
+		       display->address + offset, value);
+    else if (memcmp(display->shown + offset, now + offset,
+		    length < 8 ? length : 8) != 0)
+      chars += printMemoryChangeQuad(file, display->address + offset,
+				     readQuad(display->shown + offset, length),
+				     value);
+  }
+  memcpy(display->shown, now, display->length);
+  if (!changes && display->length < display->size)
+    chars += printErrorInvalidMemoryLocation(file, NULL,
+					     display->address + display->length);
+  return chars;
+}
+
+/* Adds a display of the given kind, numbered after the previous ones,
+   and prints its current value. For memory, count quad-words are
+   shown from the address. Returns 1 in case of success, or 0 if
+   memory could not be allocated. */
+int displayAdd(FILE *file, display_list_t *list, machine_state_t *state,
+	       const char *text, display_kind_t kind, y86_register_t reg,
+	       uint64_t address, uint64_t count)
+{
+  display_t display = {list->nextNumber, strdup(text), kind, reg, address,
+		       count * 8, 0, NULL};
+
+  if (!display.text ||
+      (kind == DISPLAY_MEMORY && !captureMemory(&display, state)))
+  {
+    freeDisplay(&display);
+    return 0;
+  }
+
+  if (list->count == list->capacity)
+  {
+    uint64_t capacity = list->capacity ? 2 * list->capacity : 8;
+    display_t *displays = realloc(list->displays,
+				  capacity * sizeof(display_t));
+    if (!displays)
+    {
+      freeDisplay(&display);
+      return 0;
+    }
+    list->displays = displays;
+    list->capacity = capacity;
+  }
+  list->displays[list->count++] = display;
+  list->nextNumber++;
+  updateMasks(list);
+
+  // Everything is compared with now from here on.
+  memcpy(list->registers, state->registerFile, sizeof(list->registers));
+  list->conditionCodes = state->conditionCodes;
+
+  switch (kind)
+  {
+  case DISPLAY_REGISTER:
+    printRegisterValue(file, state, reg);
+    break;
+  case DISPLAY_REGISTERS:
+    for (int r = R_RAX; r < R_NONE; r++)
+      printRegisterValue(file, state, r);
+    break;
+  case DISPLAY_CC:
+    printConditionCodes(file, state->conditionCodes);
+    break;
+  case DISPLAY_MEMORY:
+    showMemory(file, &list->displays[list->count - 1], state, 0);
+    break;
+  }
+  return 1;
+}
+
+/* Deletes the display with the given number. Returns 1 if there was
+   one, 0 otherwise. */
+int displayDelete(display_list_t *list, uint64_t number)
+{
+  for (uint64_t i = 0; i < list->count; i++)
+    if (list->displays[i].number == number)
+    {
+      freeDisplay(&list->displays[i]);
+      memmove(&list->displays[i], &list->displays[i + 1],
+	      (list->count - i - 1) * sizeof(display_t));
+      list->count--;
+      updateMasks(list);
+      return 1;
+    }
+  return 0;
+}
+
+void displayDeleteAll(display_list_t *list)
+{
+  for (uint64_t i = 0; i < list->count; i++)
+    freeDisplay(&list->displays[i]);
+  list->count = 0;
+  updateMasks(list);
+}
+
+int displayPrintList(FILE *file, display_list_t *list)
+{
+  int chars = 0;
+
+  for (uint64_t i = 0; i < list->count; i++)
+    chars += fprintf(file, "    # %lu: %s\n", list->displays[i].number,
+		     list->displays[i].text);
+  return chars;
+}
+
+/* Returns 1 if a page of the display was written, according to the
+   tracker. */
+static int displayWritten(const display_t *display,
+			  const dirty_tracker_t *written)
+{
+  if (!display->length)
+    return 0;
+  for (uint64_t page = display->address / DIRTY_PAGE_SIZE;
+       page <= (display->address + display->length - 1) / DIRTY_PAGE_SIZE;
+       page++)
+    if (written->bits[page >> 6] & (1ULL << (page & 63)))
+      return 1;
+  return 0;
+}
+
+/* Prints what changed in the displays since the last render, and
+   nothing if nothing did. written tracks the pages written since the
+   last render, and is reset here; memory displays on other pages are
+   not compared. Returns the number of characters printed. */
+int displayRender(FILE *file, display_list_t *list, machine_state_t *state,
+		  dirty_tracker_t *written)
+{
+  int chars = 0;
+
+  if (list->registerMask &&
+      memcmp(list->registers, state->registerFile, sizeof(list->registers)))
+    for (int r = R_RAX; r < R_NONE; r++)
+      if ((list->registerMask & (1 << r)) &&
+	  list->registers[r] != state->registerFile[r])
+	chars += printRegisterChange(file, r, list->registers[r],
+				     state->registerFile[r]);
+  memcpy(list->registers, state->registerFile, sizeof(list->registers));
+
+  if (list->showCC && list->conditionCodes != state->conditionCodes)
+    chars += printConditionCodesChange(file, list->conditionCodes,
+				       state->conditionCodes);
+  list->conditionCodes = state->conditionCodes;
+
+  if (list->stale || written->count)
+    for (uint64_t i = 0; i < list->count; i++)
+    {
+      display_t *display = &list->displays[i];
+
+      if (display->kind != DISPLAY_MEMORY)
+	continue;
+      if (list->stale)
+      {
+	// Only the part that was and still is inside memory compares.
+	uint64_t length = display->length;
+	uint8_t *shown = display->shown;
+
+	display->shown = NULL;
+	if (!captureMemory(display, state))
+	{
+	  display->shown = shown;
+	  display->length = 0;
+	  continue;
+	}
+	if (length > display->length)
+	  length = display->length;
+	memcpy(display->shown, shown, length);
+	free(shown);
+	chars += showMemory(file, display, state, 1);
+      }
+      else if (displayWritten(display, written))
+	chars += showMemory(file, display, state, 1);
+    }
+
+  list->stale = 0;
+  dirtyReset(written);
+  return chars;
+}
@@ -0,0 +1,68 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in display.c
+*/
+
+#ifndef _DISPLAY_H_
+#define _DISPLAY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "dirty.h"
+
+typedef enum display_kind {
+  DISPLAY_REGISTER  = 0x0,  // one register
+  DISPLAY_REGISTERS = 0x1,  // every register
+  DISPLAY_CC        = 0x2,  // the condition codes
+  DISPLAY_MEMORY    = 0x3   // quad-words of memory
+} display_kind_t;
+
+/* An expression shown whenever it changes. Memory displays keep the
+   contents they last showed, the part of them inside memory. */
+typedef struct display {
+
+  uint64_t        number;
+  char           *text;
+  display_kind_t  kind;
+  y86_register_t  reg;
+  uint64_t        address;
+  uint64_t        size;     // bytes asked for
+  uint64_t        length;   // bytes inside memory
+  uint8_t        *shown;
+} display_t;
+
+/* The displays, with the registers and condition codes as last shown.
+   Registers and condition codes are compared as a whole first, and
+   memory displays only when a page of theirs was written since the
+   last render. A stop where no page at all was written costs the same
+   however many displays there are; after a write, each memory display
+   checks its own pages against those written. */
+typedef struct display_list {
+
+  display_t *displays;
+  uint64_t   count;
+  uint64_t   capacity;
+  uint64_t   nextNumber;
+
+  uint16_t   registerMask;  // registers displayed, one bit each
+  int        showCC;
+  uint64_t   registers[R_NONE];
+  uint8_t    conditionCodes;
+  int        stale;         // memory replaced, every display compared
+} display_list_t;
+
+void displayInit(display_list_t *list);
+void displayFree(display_list_t *list);
+
+int displayAdd(FILE *file, display_list_t *list, machine_state_t *state,
+	       const char *text, display_kind_t kind, y86_register_t reg,
+	       uint64_t address, uint64_t count);
+int displayDelete(display_list_t *list, uint64_t number);
+void displayDeleteAll(display_list_t *list);
+int displayPrintList(FILE *file, display_list_t *list);
+
+int displayRender(FILE *file, display_list_t *list, machine_state_t *state,
+		  dirty_tracker_t *written);
+
+#endif /* DISPLAY */
@@ -0,0 +1,1008 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "explore.h"
+#include "decode.h"
+
+/* A page of guest memory owned by one or more states, with a bit per
+   byte telling whether the byte is free. Pages no state wrote are read
+   from the image instead. */
+typedef struct explore_page {
+
+  uint64_t refs;
+  uint64_t hash;
+  int      hashed;
+  uint8_t  data[EXPLORE_PAGE_SIZE];
+  uint64_t free[EXPLORE_PAGE_SIZE / 64];
+} explore_page_t;
+
+/* A page a state wrote, by its index in memory. */
+typedef struct explore_mapping {
+
+  uint64_t        index;
+  explore_page_t *page;
+} explore_mapping_t;
+
+/* Decisions are shared by the paths going through them, each node
+   pointing back at the decision before it. */
+typedef struct explore_path {
+
+  struct explore_path *parent;
+  uint64_t refs;
+  uint64_t length;
+  explore_decision_t decision;
+} explore_path_t;
+
+typedef struct explore_state {
+
+  uint64_t programCounter;
+  uint64_t registerFile[16];
+  uint16_t freeRegisters;
+  uint8_t  conditionCodes;
+  uint8_t  freeConditionCodes; // values they may have, see narrowValues
+  uint64_t steps;
+
+  // the pages written, sorted by index, so that copying, releasing
+  // and hashing a state take time in those only
+  explore_path_t    *path;
+  explore_mapping_t *pages;
+  uint64_t           pageCount;
+  uint64_t           pageCapacity;
+} explore_state_t;
+
+/* States waiting to be explored by a thread. The thread takes the last
+   state it added, and threads without work take the first one, the
+   closest to the start and so the most likely to fork again. */
+typedef struct explore_worker {
+
+  struct explorer *explorer;
+  pthread_t        thread;
+  pthread_mutex_t  lock;
+  explore_state_t **states;
+  uint64_t         first;
+  uint64_t         count;
+  uint64_t         capacity;
+  int              index;
+} explore_worker_t;
+
+typedef struct explorer {
+
+  const uint8_t   *image;
+  uint64_t         size;
+  explore_limits_t limits;
+
+  explore_worker_t *workers;
+  int               threads;
+
+  // states queued or being explored; none once the exploration is over
+  uint64_t pending;
+  int      failed;
+
+  // hashes of the states seen, 0 standing for an empty slot
+  uint64_t *seen;
+  uint64_t  seenMask;
+
+  pthread_mutex_t   outcomesLock;
+  explore_result_t *result;
+} explorer_t;
+
+void exploreFreeInit(explore_free_t *freeState)
+{
+  memset(freeState, 0, sizeof(*freeState));
+  rangeSetInit(&freeState->memory);
+}
+
+void exploreFreeClear(explore_free_t *freeState)
+{
+  rangeSetFree(&freeState->memory);
+  exploreFreeInit(freeState);
+}
+
+static void releasePage(explore_page_t *page)
+{
+  if (page && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(page);
+}
+
+static void releasePath(explore_path_t *path)
+{
+  while (path && __atomic_sub_fetch(&path->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    explore_path_t *parent = path->parent;
+    free(path);
+    path = parent;
+  }
+}
+
+static void releaseState(explorer_t *explorer, explore_state_t *state)
+{
+  for (uint64_t i = 0; i < state->pageCount; i++)
+    releasePage(state->pages[i].page);
+  free(state->pages);
+  releasePath(state->path);
+  free(state);
+}
+
+/* Returns a state sharing the pages and the path of the original, or
+   NULL if memory could not be allocated. */
+static explore_state_t *copyState(explorer_t *explorer,
+				  const explore_state_t *original)
+{
+  explore_state_t *state = malloc(sizeof(*state));
+
+  if (!state)
+    return NULL;
+  *state = *original;
+  state->pageCapacity = original->pageCount;
+  state->pages = NULL;
+  if (state->pageCount &&
+      !(state->pages = malloc(state->pageCount * sizeof(explore_mapping_t))))
+  {
+    free(state);
+    return NULL;
+  }
+  if (state->pageCount)
+    memcpy(state->pages, original->pages,
+	   state->pageCount * sizeof(explore_mapping_t));
+  for (uint64_t i = 0; i < state->pageCount; i++)
+    __atomic_add_fetch(&state->pages[i].page->refs, 1, __ATOMIC_RELAXED);
+  if (state->path)
+    __atomic_add_fetch(&state->path->refs, 1, __ATOMIC_RELAXED);
+  return state;
+}
+
+/* Returns the position of the page with the index among those the
+   state wrote, or where it would be inserted. */
+static inline uint64_t findPage(const explore_state_t *state, uint64_t index)
+{
+  uint64_t low = 0, high = state->pageCount;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (state->pages[middle].index < index)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+/* Returns the page the state wrote holding the address, or NULL if it
+   wrote none there. */
+static inline explore_page_t *statePage(const explore_state_t *state,
+					uint64_t address)
+{
+  uint64_t index = address >> EXPLORE_PAGE_SHIFT;
+  uint64_t position = findPage(state, index);
+
+  if (position < state->pageCount && state->pages[position].index == index)
+    return state->pages[position].page;
+  return NULL;
+}
+
+/* Returns the page holding the address, copied if other states share
+   it, or NULL if memory could not be allocated. */
+static explore_page_t *writablePage(explorer_t *explorer,
+				    explore_state_t *state, uint64_t address)
+{
+  uint64_t index = address >> EXPLORE_PAGE_SHIFT;
+  uint64_t position = findPage(state, index);
+  explore_page_t *page = NULL;
+
+  if (position < state->pageCount && state->pages[position].index == index)
+    page = state->pages[position].page;
+
+  if (page && __atomic_load_n(&page->refs, __ATOMIC_ACQUIRE) == 1)
+  {
+    page->hashed = 0;
+    return page;
+  }
+
+  if (!page && state->pageCount == state->pageCapacity)
+  {
+    uint64_t capacity = state->pageCapacity ? 2 * state->pageCapacity : 4;
+    explore_mapping_t *pages = realloc(state->pages,
+				       capacity * sizeof(explore_mapping_t));
+    if (!pages)
+      return NULL;
+    state->pages = pages;
+    state->pageCapacity = capacity;
+  }
+
+  explore_page_t *copy = malloc(sizeof(*copy));
+  if (!copy)
+    return NULL;
+  copy->refs = 1;
+  copy->hashed = 0;
+  if (page)
+  {
+    memcpy(copy->data, page->data, sizeof(copy->data));
+    memcpy(copy->free, page->free, sizeof(copy->free));
+  }
+  else
+  {
+    uint64_t start = index << EXPLORE_PAGE_SHIFT;
+    uint64_t length = explorer->size - start < EXPLORE_PAGE_SIZE ?
+      explorer->size - start : EXPLORE_PAGE_SIZE;
+
+    memset(copy->data, 0, sizeof(copy->data));
+    memcpy(copy->data, explorer->image + start, length);
+    memset(copy->free, 0, sizeof(copy->free));
+  }
+  if (page)
+    releasePage(page);
+  else
+  {
+    memmove(state->pages + position + 1, state->pages + position,
+	    (state->pageCount - position) * sizeof(explore_mapping_t));
+    state->pages[position].index = index;
+    state->pageCount++;
+  }
+  state->pages[position].page = copy;
+  return copy;
+}
+
+static inline uint8_t readByte(const explorer_t *explorer,
+			       const explore_state_t *state, uint64_t address,
+			       int *isFree)
+{
+  const explore_page_t *page = statePage(state, address);
+  uint64_t offset = address & (EXPLORE_PAGE_SIZE - 1);
+
+  if (!page)
+  {
+    *isFree = 0;
+    return explorer->image[address];
+  }
+  *isFree = (page->free[offset >> 6] >> (offset & 63)) & 1;
+  return page->data[offset];
+}
+
+/* Stores a byte, and whether it is free. Returns 1 in case of success,
+   or 0 if memory could not be allocated. */
+static int writeByte(explorer_t *explorer, explore_state_t *state,
+		     uint64_t address, uint8_t value, int isFree)
+{
+  explore_page_t *page = writablePage(explorer, state, address);
+  uint64_t offset = address & (EXPLORE_PAGE_SIZE - 1);
+
+  if (!page)
+    return 0;
+  page->data[offset] = value;
+  if (isFree)
+    page->free[offset >> 6] |= 1ULL << (offset & 63);
+  else
+    page->free[offset >> 6] &= ~(1ULL << (offset & 63));
+  return 1;
+}
+
+/* Fetches the instruction at the PC of the state as fetchInstruction
+   does, with the constant read by memReadQuadLE from a copy of the
+   instruction bytes. Instructions going past the end of memory are
+   too short. */
+static void fetch(const explorer_t *explorer, const explore_state_t *state,
+		  y86_instruction_t *instr)
+{
+  uint64_t pc = state->programCounter;
+  uint8_t bytes[10];
+  int isFree;
+
+  memset(instr, 0, sizeof(*instr));
+  instr->location = pc;
+  instr->rA = R_NONE;
+  instr->rB = R_NONE;
+  if (pc >= explorer->size)
+  {
+    instr->icode = I_TOO_SHORT;
+    return;
+  }
+
+  bytes[0] = readByte(explorer, state, pc, &isFree);
+  const decode_entry_t *entry = &decodeTable[bytes[0]];
+  instr->icode = bytes[0] >> 4;
+  instr->ifun = bytes[0] & 0xf;
+  if (!entry->valid)
+  {
+    instr->icode = I_INVALID;
+    instr->ifun = 0;
+    return;
+  }
+  if (pc + entry->length > explorer->size)
+  {
+    instr->icode = I_TOO_SHORT;
+    return;
+  }
+  for (int i = 1; i < entry->length; i++)
+    bytes[i] = readByte(explorer, state, pc + i, &isFree);
+
+  if (entry->hasRegisters)
+  {
+    if (!registerByteValid[instr->icode][bytes[1]])
+    {
+      instr->icode = I_INVALID;
+      instr->ifun = 0;
+      return;
+    }
+    instr->rA = bytes[1] >> 4;
+    instr->rB = bytes[1] & 0xf;
+  }
+
+  if (entry->hasValC)
+  {
+    machine_state_t view;
+    uint64_t valC;
+
+    memset(&view, 0, sizeof(view));
+    view.programMap = bytes;
+    view.programSize = sizeof(bytes) - 1;
+    memReadQuadLE(&view, 1 + entry->hasRegisters, &valC);
+    if ((entry->checkTarget && valC > explorer->size) ||
+	(entry->checkDisplacement && valC + instr->rB > explorer->size))
+    {
+      instr->icode = I_INVALID;
+      return;
+    }
+    instr->valC = valC;
+  }
+  instr->valP = pc + entry->advance;
+}
+
+/* Free condition codes are kept as the set of values they may still
+   have, a bit for each value of ZF and SF (the only flags conditions
+   look at), narrowed by each decision made on them; 0 once only one
+   is left, and they are known. */
+#define CC_ANY_VALUE     0xf
+#define CC_SETCC_VALUES  0x7 // none, ZF or SF: what setCC produces
+
+static inline uint8_t narrowValues(uint8_t values)
+{
+  return values & (values - 1) ? values : 0;
+}
+
+/* Returns the values among those given for which the condition of a
+   jXX or cmovXX holds. */
+static uint8_t valuesHolding(uint8_t ifun, uint8_t values)
+{
+  uint8_t holding = 0;
+
+  for (int value = 0; value < 4; value++)
+    if ((values >> value) & 1 && conditionHolds(ifun, value))
+      holding |= 1 << value;
+  return holding;
+}
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t hashMix(uint64_t hash, uint64_t value)
+{
+  hash = (hash ^ value) * HASH_MULTIPLIER;
+  return hash ^ (hash >> 29);
+}
+
+/* Hashes everything the rest of a path depends on: the PC, registers,
+   condition codes, what is free, and the pages written. */
+static uint64_t hashState(explorer_t *explorer, explore_state_t *state)
+{
+  uint64_t hash = hashMix(0, state->programCounter);
+
+  for (int reg = 0; reg < 16; reg++)
+    hash = hashMix(hash, state->registerFile[reg]);
+  hash = hashMix(hash, state->freeRegisters |
+		 (uint64_t)state->conditionCodes << 16 |
+		 (uint64_t)state->freeConditionCodes << 24);
+
+  for (uint64_t i = 0; i < state->pageCount; i++)
+  {
+    explore_page_t *page = state->pages[i].page;
+    // Pages no longer written by any state keep their hash.
+    if (!__atomic_load_n(&page->hashed, __ATOMIC_ACQUIRE))
+    {
+      uint64_t pageHash = 0;
+      for (int j = 0; j < EXPLORE_PAGE_SIZE / 8; j++)
+      {
+	uint64_t word;
+	memcpy(&word, page->data + 8 * j, 8);
+	pageHash = hashMix(pageHash, word);
+      }
+      for (int j = 0; j < EXPLORE_PAGE_SIZE / 64; j++)
+	pageHash = hashMix(pageHash, page->free[j]);
+      page->hash = pageHash;
+      __atomic_store_n(&page->hashed, 1, __ATOMIC_RELEASE);
+    }
+    hash = hashMix(hashMix(hash, state->pages[i].index), page->hash);
+  }
+  return hash ? hash : 1;
+}
+
+/* Adds the hash of the state to those seen. Returns 1 if it was not
+   seen before, 0 otherwise. */
+static int firstSeen(explorer_t *explorer, explore_state_t *state)
+{
+  uint64_t hash = hashState(explorer, state);
+
+  for (uint64_t slot = hash & explorer->seenMask; ;
+       slot = (slot + 1) & explorer->seenMask)
+  {
+    uint64_t expected = 0;
+    if (__atomic_compare_exchange_n(&explorer->seen[slot], &expected, hash, 0,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+    if (expected == hash)
+      return 0;
+  }
+}
+
+static void pushState(explore_worker_t *worker, explore_state_t *state)
+{
+  pthread_mutex_lock(&worker->lock);
+  if (worker->first > 0 && worker->count == worker->capacity)
+  {
+    memmove(worker->states, worker->states + worker->first,
+	    (worker->count - worker->first) * sizeof(explore_state_t *));
+    worker->count -= worker->first;
+    worker->first = 0;
+  }
+  if (worker->count == worker->capacity)
+  {
+    uint64_t capacity = worker->capacity ? 2 * worker->capacity : 64;
+    explore_state_t **states = realloc(worker->states,
+				       capacity * sizeof(explore_state_t *));
+    if (!states)
+    {
+      pthread_mutex_unlock(&worker->lock);
+      __atomic_store_n(&worker->explorer->failed, 1, __ATOMIC_RELAXED);
+      __atomic_sub_fetch(&worker->explorer->pending, 1, __ATOMIC_RELEASE);
+      releaseState(worker->explorer, state);
+      return;
+    }
+    worker->states = states;
+    worker->capacity = capacity;
+  }
+  worker->states[worker->count++] = state;
+  pthread_mutex_unlock(&worker->lock);
+}
+
+/* Takes the last state of the worker, or if it has none the first
+   state of another worker. Returns NULL if no worker has any. */
+static explore_state_t *takeState(explore_worker_t *worker)
+{
+  explorer_t *explorer = worker->explorer;
+  explore_state_t *state = NULL;
+
+  pthread_mutex_lock(&worker->lock);
+  if (worker->count > worker->first)
+    state = worker->states[--worker->count];
+  if (worker->count == worker->first)
+    worker->count = worker->first = 0;
+  pthread_mutex_unlock(&worker->lock);
+
+  for (int i = 1; i < explorer->threads && !state; i++)
+  {
+    explore_worker_t *victim =
+      &explorer->workers[(worker->index + i) % explorer->threads];
+
+    pthread_mutex_lock(&victim->lock);
+    if (victim->count > victim->first)
+      state = victim->states[victim->first++];
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return state;
+}
+
+/* Counts a state stopping at the location, keeping its path if it is
+   the shortest found to there. */
+static void recordOutcome(explorer_t *explorer, explore_state_t *state,
+			  explore_outcome_kind_t kind, uint64_t location)
+{
+  explore_result_t *result = explorer->result;
+  explore_outcome_t *outcome = NULL;
+  uint64_t length = state->path ? state->path->length : 0;
+
+  pthread_mutex_lock(&explorer->outcomesLock);
+  for (uint64_t i = 0; i < result->count && !outcome; i++)
+    if (result->outcomes[i].kind == kind &&
+	result->outcomes[i].location == location)
+      outcome = &result->outcomes[i];
+
+  if (!outcome)
+  {
+    explore_outcome_t *outcomes = realloc(result->outcomes, (result->count + 1)
+					  * sizeof(explore_outcome_t));
+    if (!outcomes)
+    {
+      __atomic_store_n(&explorer->failed, 1, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&explorer->outcomesLock);
+      return;
+    }
+    result->outcomes = outcomes;
+    outcome = &result->outcomes[result->count++];
+    memset(outcome, 0, sizeof(*outcome));
+    outcome->kind = kind;
+    outcome->location = location;
+    outcome->pathLength = UINT64_MAX;
+  }
+
+  outcome->states++;
+  if (length < outcome->pathLength)
+  {
+    explore_decision_t *path = malloc((length + 1) * sizeof(*path));
+    if (path)
+    {
+      uint64_t i = length;
+      for (explore_path_t *node = state->path; node; node = node->parent)
+	path[--i] = node->decision;
+      free(outcome->path);
+      outcome->path = path;
+      outcome->pathLength = length;
+    }
+  }
+  pthread_mutex_unlock(&explorer->outcomesLock);
+}
+
+/* Adds a decision to the path of the state. Returns 1 in case of
+   success, or 0 if memory could not be allocated. */
+static int decide(explore_state_t *state, uint64_t location, int taken)
+{
+  explore_path_t *node = malloc(sizeof(*node));
+
+  if (!node)
+    return 0;
+  node->parent = state->path;
+  node->refs = 1;
+  node->length = state->path ? state->path->length + 1 : 1;
+  node->decision.location = location;
+  node->decision.taken = taken;
+  state->path = node;
+  return 1;
+}
+
+#define FREE_BIT(reg) ((uint16_t)(1 << (reg)))
+#define IS_FREE(state, reg) (((state)->freeRegisters >> (reg)) & 1)
+#define SET_FREE(state, reg, isFree)					\
+  ((state)->freeRegisters = ((state)->freeRegisters & ~FREE_BIT(reg)) |	\
+   ((isFree) ? FREE_BIT(reg) : 0))
+
+/* Handles a jXX or cmovXX whose condition codes are free. If the
+   values they may have do not all decide it the same way, the state
+   keeps those going its way and, unless a limit was reached, a copy is
+   made going the other way, with the other values, and queued past the
+   instruction. States are only compared with those
+   seen here, at forks, so a copy is checked when it forks in turn.
+   Returns 0 if the state was seen before, or memory could not be
+   allocated, and it should be dropped; 1 otherwise. */
+static int forkState(explore_worker_t *worker, explore_state_t *state,
+		     const y86_instruction_t *instr)
+{
+  explorer_t *explorer = worker->explorer;
+  int holds = conditionHolds(instr->ifun, state->conditionCodes);
+  uint64_t depth = state->path ? state->path->length : 0;
+  uint8_t holding = valuesHolding(instr->ifun, state->freeConditionCodes);
+  uint8_t otherValues = holds ? state->freeConditionCodes & ~holding : holding;
+  explore_state_t *other;
+  int value;
+
+  if (!otherValues)
+    return 1;
+  state->freeConditionCodes = narrowValues(state->freeConditionCodes &
+					   ~otherValues);
+
+  if (depth >= explorer->limits.depth)
+  {
+    __atomic_add_fetch(&explorer->result->depthLimited, 1, __ATOMIC_RELAXED);
+    return 1;
+  }
+  if (__atomic_add_fetch(&explorer->result->states, 1, __ATOMIC_RELAXED) >
+      explorer->limits.states)
+  {
+    __atomic_sub_fetch(&explorer->result->states, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&explorer->result->stateLimited, 1, __ATOMIC_RELAXED);
+    return 1;
+  }
+
+  // The state may have been reached along another path.
+  if (!firstSeen(explorer, state))
+  {
+    __atomic_add_fetch(&explorer->result->duplicates, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  other = copyState(explorer, state);
+  if (!other || !decide(other, instr->location, !holds) ||
+      !decide(state, instr->location, holds))
+  {
+    if (other)
+      releaseState(explorer, other);
+    __atomic_store_n(&explorer->failed, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  // The copy is taken past the instruction, which would fork it again.
+  for (value = 0; !((otherValues >> value) & 1); value++)
+    ;
+  other->conditionCodes = value;
+  other->freeConditionCodes = narrowValues(otherValues);
+  other->programCounter = instr->valP;
+  other->steps++;
+  if (instr->icode == I_JXX && !holds)
+    other->programCounter = instr->valC;
+  else if (instr->icode == I_RRMVXX && !holds)
+  {
+    other->registerFile[instr->rB] = other->registerFile[instr->rA];
+    SET_FREE(other, instr->rB, IS_FREE(other, instr->rA));
+  }
+
+  __atomic_add_fetch(&explorer->pending, 1, __ATOMIC_RELAXED);
+  pushState(worker, other);
+  return 1;
+}
+
+/* Executes the state until it stops, with the semantics of
+   executeInstruction, following which values are free. Branches on
+   free condition codes fork the state. */
+static void exploreState(explore_worker_t *worker, explore_state_t *state)
+{
+  explorer_t *explorer = worker->explorer;
+  uint64_t *reg = state->registerFile;
+  uint64_t executed = 0;
+  y86_instruction_t instr;
+
+  for (;; state->steps++, executed++)
+  {
+    uint64_t address, value;
+    int isFree, ok = 1;
+
+    if (state->steps >= explorer->limits.steps)
+    {
+      __atomic_add_fetch(&explorer->result->stepLimited, 1, __ATOMIC_RELAXED);
+      break;
+    }
+
+    fetch(explorer, state, &instr);
+    if (instr.icode == I_HALT || instr.icode == I_INVALID ||
+	instr.icode == I_TOO_SHORT)
+    {
+      recordOutcome(explorer, state, instr.icode == I_HALT ? EXPLORE_HALT :
+		    instr.icode == I_INVALID ? EXPLORE_INVALID :
+		    EXPLORE_TOO_SHORT, instr.location);
+      break;
+    }
+
+    switch (instr.icode)
+    {
+    case I_RRMVXX:
+      if (instr.ifun != C_NC && state->freeConditionCodes &&
+	  !forkState(worker, state, &instr))
+	goto drop;
+      if (conditionHolds(instr.ifun, state->conditionCodes))
+      {
+	reg[instr.rB] = reg[instr.rA];
+	SET_FREE(state, instr.rB, IS_FREE(state, instr.rA));
+      }
+      break;
+    case I_IRMOVQ:
+      reg[instr.rB] = instr.valC;
+      SET_FREE(state, instr.rB, 0);
+      break;
+    case I_RMMOVQ:
+      address = instr.valC + reg[instr.rB];
+      ok = address < explorer->size &&
+	writeByte(explorer, state, address, reg[instr.rA],
+		  IS_FREE(state, instr.rA));
+      break;
+    case I_MRMOVQ:
+      address = instr.valC + reg[instr.rB];
+      if ((ok = address < explorer->size))
+      {
+	reg[instr.rA] = readByte(explorer, state, address, &isFree);
+	SET_FREE(state, instr.rA, isFree || IS_FREE(state, instr.rB));
+      }
+      break;
+    case I_OPQ:
+      value = reg[instr.rB];
+      isFree = IS_FREE(state, instr.rA) || IS_FREE(state, instr.rB);
+      switch (instr.ifun)
+      {
+      case A_ADDQ:
+	value += reg[instr.rA];
+	break;
+      case A_SUBQ:
+	value -= reg[instr.rA];
+	isFree = isFree && instr.rA != instr.rB;
+	break;
+      case A_ANDQ:
+	value &= reg[instr.rA];
+	break;
+      case A_XORQ:
+	value ^= reg[instr.rA];
+	isFree = isFree && instr.rA != instr.rB;
+	break;
+      case A_MULQ:
+	value *= reg[instr.rA];
+	break;
+      case A_DIVQ:
+      case A_MODQ:
+	if (!(ok = reg[instr.rA] != 0))
+	  break;
+	value = instr.ifun == A_DIVQ ? value / reg[instr.rA] :
+	  value % reg[instr.rA];
+	break;
+      }
+      if (!ok)
+	break;
+      reg[instr.rB] = value;
+      SET_FREE(state, instr.rB, isFree);
+      state->conditionCodes = setCC(value);
+      state->freeConditionCodes = isFree ? CC_SETCC_VALUES : 0;
+      break;
+    case I_JXX:
+      if (instr.ifun != C_NC && state->freeConditionCodes &&
+	  !forkState(worker, state, &instr))
+	goto drop;
+      if (conditionHolds(instr.ifun, state->conditionCodes))
+	instr.valP = instr.valC;
+      break;
+    case I_CALL:
+      address = reg[R_RSP] - 8;
+      ok = address < explorer->size &&
+	writeByte(explorer, state, address, instr.valP, 0);
+      reg[R_RSP] -= 8;
+      instr.valP = instr.valC;
+      break;
+    case I_RET:
+      address = reg[R_RSP];
+      if ((ok = address < explorer->size))
+	instr.valP = readByte(explorer, state, address, &isFree);
+      reg[R_RSP] += 8;
+      break;
+    case I_PUSHQ:
+      address = reg[R_RSP] - 8;
+      ok = address < explorer->size &&
+	writeByte(explorer, state, address, reg[instr.rA],
+		  IS_FREE(state, instr.rA));
+      reg[R_RSP] -= 8;
+      break;
+    case I_POPQ:
+      address = reg[R_RSP];
+      if ((ok = address < explorer->size))
+      {
+	reg[instr.rA] = readByte(explorer, state, address, &isFree);
+	SET_FREE(state, instr.rA, isFree);
+	reg[R_RSP] += 8;
+      }
+      break;
+    default:
+      // executeInstruction fails on the rest, nop among them.
+      ok = 0;
+      break;
+    }
+
+    if (!ok)
+    {
+      recordOutcome(explorer, state, EXPLORE_ERROR, instr.location);
+      break;
+    }
+    state->programCounter = instr.valP;
+  }
+
+drop:
+  __atomic_add_fetch(&explorer->result->instructions, executed,
+		     __ATOMIC_RELAXED);
+  releaseState(explorer, state);
+}
+
+static void *exploreThread(void *argument)
+{
+  explore_worker_t *worker = argument;
+  explorer_t *explorer = worker->explorer;
+
+  for (;;)
+  {
+    explore_state_t *state = takeState(worker);
+
+    if (state)
+    {
+      exploreState(worker, state);
+      __atomic_sub_fetch(&explorer->pending, 1, __ATOMIC_RELEASE);
+    }
+    else if (__atomic_load_n(&explorer->pending, __ATOMIC_ACQUIRE) == 0)
+      break;
+    else
+      sched_yield();
+  }
+  return NULL;
+}
+
+/* Builds the starting state from the machine: everything is copied,
+   and the free parts are marked as such. Returns NULL if memory could
+   not be allocated. */
+static explore_state_t *startState(explorer_t *explorer,
+				   const machine_state_t *start,
+				   const explore_free_t *freeState)
+{
+  explore_state_t *state = calloc(1, sizeof(*state));
+
+  if (!state)
+    return NULL;
+  state->programCounter = start->programCounter;
+  memcpy(state->registerFile, start->registerFile,
+	 sizeof(state->registerFile));
+  state->conditionCodes = start->conditionCodes;
+  state->freeRegisters = freeState->registers;
+  state->freeConditionCodes = freeState->conditionCodes ? CC_ANY_VALUE : 0;
+
+  for (uint64_t i = 0; i < freeState->memory.count; i++)
+    for (uint64_t address = freeState->memory.ranges[i].start;
+	 address < freeState->memory.ranges[i].end && address < explorer->size;
+	 address++)
+    {
+      int isFree;
+      if (!writeByte(explorer, state, address,
+		     readByte(explorer, state, address, &isFree), 1))
+      {
+	releaseState(explorer, state);
+	return NULL;
+      }
+    }
+  return state;
+}
+
+/* Explores every path from the state of the machine, forking at each
+   conditional jump and conditional move depending on the free parts of
+   it, within the limits. The machine is not modified. Returns 1 in
+   case of success, or 0 if memory or threads could not be allocated,
+   with errno set; the outcomes found are kept in either case. */
+int exploreRun(machine_state_t *start, const explore_free_t *freeState,
+	       const explore_limits_t *limits, explore_result_t *result)
+{
+  explorer_t explorer;
+  explore_state_t *state;
+  uint64_t slots = 1;
+  int started = 0;
+
+  memset(result, 0, sizeof(*result));
+  memset(&explorer, 0, sizeof(explorer));
+  explorer.image = start->programMap;
+  explorer.size = start->programSize;
+  explorer.limits = *limits;
+  explorer.result = result;
+  explorer.threads = limits->threads > 0 ? limits->threads :
+    (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (explorer.threads < 1)
+    explorer.threads = 1;
+  result->threads = explorer.threads;
+
+  // At most one hash is added per fork, so the table never fills.
+  while (slots < 2 * limits->states + 2)
+    slots <<= 1;
+  explorer.seenMask = slots - 1;
+  explorer.seen = calloc(slots, sizeof(uint64_t));
+  explorer.workers = calloc(explorer.threads, sizeof(explore_worker_t));
+  if (!explorer.seen || !explorer.workers ||
+      !(state = startState(&explorer, start, freeState)))
+  {
+    free(explorer.seen);
+    free(explorer.workers);
+    errno = ENOMEM;
+    return 0;
+  }
+  pthread_mutex_init(&explorer.outcomesLock, NULL);
+  for (int i = 0; i < explorer.threads; i++)
+  {
+    explorer.workers[i].explorer = &explorer;
+    explorer.workers[i].index = i;
+    pthread_mutex_init(&explorer.workers[i].lock, NULL);
+  }
+
+  result->states = 1;
+  explorer.pending = 1;
+  pushState(&explorer.workers[0], state);
+
+  // The calling thread works as the first worker.
+  for (started = 1; started < explorer.threads; started++)
+    if (pthread_create(&explorer.workers[started].thread, NULL, exploreThread,
+		       &explorer.workers[started]) != 0)
+      break;
+  exploreThread(&explorer.workers[0]);
+  for (int i = 1; i < started; i++)
+    pthread_join(explorer.workers[i].thread, NULL);
+  result->threads = started;
+
+  for (int i = 0; i < explorer.threads; i++)
+  {
+    free(explorer.workers[i].states);
+    pthread_mutex_destroy(&explorer.workers[i].lock);
+  }
+  pthread_mutex_destroy(&explorer.outcomesLock);
+  free(explorer.workers);
+  free(explorer.seen);
+
+  if (explorer.failed)
+  {
+    errno = ENOMEM;
+    return 0;
+  }
+  return 1;
+}
+
+void exploreResultFree(explore_result_t *result)
+{
+  for (uint64_t i = 0; i < result->count; i++)
+    free(result->outcomes[i].path);
+  free(result->outcomes);
+  memset(result, 0, sizeof(*result));
+}
+
+static int printLocation(FILE *file, const symbol_table_t *symbols,
+			 uint64_t address)
+{
+  const symbol_t *symbol;
+  uint64_t offset;
+
+  if (!symbols || !(symbol = symbolLookupAddress(symbols, address, &offset)))
+    return fprintf(file, "0x%lx", address);
+  if (offset)
+    return fprintf(file, "0x%lx <%s+0x%lx>", address, symbol->name, offset);
+  return fprintf(file, "0x%lx <%s>", address, symbol->name);
+}
+
+static int compareOutcomes(const void *a, const void *b)
+{
+  const explore_outcome_t *first = a, *second = b;
+
+  if (first->kind != second->kind)
+    return first->kind < second->kind ? -1 : 1;
+  if (first->location != second->location)
+    return first->location < second->location ? -1 : 1;
+  return 0;
+}
+
+/* Lists where states stopped, by kind and then by location, each with
+   the shortest path found reaching it. */
+int exploreReport(FILE *file, const explore_result_t *result,
+		  const symbol_table_t *symbols)
+{
+  static const char *kinds[] = {
+    [EXPLORE_HALT]      = "Halt",
+    [EXPLORE_INVALID]   = "Invalid instruction",
+    [EXPLORE_TOO_SHORT] = "Incomplete instruction",
+    [EXPLORE_ERROR]     = "Execution error"
+  };
+
+  qsort(result->outcomes, result->count, sizeof(explore_outcome_t),
+	compareOutcomes);
+
+  fprintf(file, "    # Explored %lu states (%lu duplicates dropped), %lu "
+	  "instructions, %d threads\n", result->states, result->duplicates,
+	  result->instructions, result->threads);
+  if (result->depthLimited || result->stateLimited || result->stepLimited)
+    fprintf(file, "    # Limits reached: %lu forks past the depth limit, %lu "
+	    "past the state limit, %lu states past the step limit\n",
+	    result->depthLimited, result->stateLimited, result->stepLimited);
+
+  for (uint64_t i = 0; i < result->count; i++)
+  {
+    const explore_outcome_t *outcome = &result->outcomes[i];
+
+    fprintf(file, "    # %s at ", kinds[outcome->kind]);
+    printLocation(file, symbols, outcome->location);
+    fprintf(file, ", %lu state%s\n", outcome->states,
+	    outcome->states == 1 ? "" : "s");
+    if (!outcome->path)
+      continue;
+    fprintf(file, "    #   path:%s", outcome->pathLength ? "" : " none\n");
+    for (uint64_t j = 0; j < outcome->pathLength; j++)
+    {
+      fprintf(file, " ");
+      printLocation(file, symbols, outcome->path[j].location);
+      fprintf(file, " %s%s", outcome->path[j].taken ? "taken" : "not taken",
+	      j + 1 < outcome->pathLength ? "," : "\n");
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,94 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in explore.c
+*/
+
+#ifndef _EXPLORE_H_
+#define _EXPLORE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "ranges.h"
+#include "symbols.h"
+
+#define EXPLORE_PAGE_SHIFT 12 // 4K pages, copied on the first write
+#define EXPLORE_PAGE_SIZE  (1 << EXPLORE_PAGE_SHIFT)
+
+#define EXPLORE_DEFAULT_DEPTH  64
+#define EXPLORE_DEFAULT_STATES 100000
+#define EXPLORE_DEFAULT_STEPS  1000000
+
+/* The parts of the starting state whose values are not known: a mask
+   of registers, the condition codes, and ranges of memory. Values
+   computed from them are free as well. */
+typedef struct explore_free {
+
+  uint16_t    registers;
+  int         conditionCodes;
+  range_set_t memory;
+} explore_free_t;
+
+/* Bounds on an exploration: forks along one path, states created,
+   instructions executed along one path, and worker threads (0 for one
+   per processor). Forks beyond the first two limits are not made, the
+   state going on with the values it has; states reaching the step
+   limit are dropped. */
+typedef struct explore_limits {
+
+  uint64_t depth;
+  uint64_t states;
+  uint64_t steps;
+  int      threads;
+} explore_limits_t;
+
+typedef enum explore_outcome_kind {
+  EXPLORE_HALT      = 0x0,
+  EXPLORE_INVALID   = 0x1,
+  EXPLORE_TOO_SHORT = 0x2,
+  EXPLORE_ERROR     = 0x3
+} explore_outcome_kind_t;
+
+/* A decision made at a fork: the jXX or cmovXX at location went one
+   way or the other. */
+typedef struct explore_decision {
+
+  uint64_t location;
+  int      taken;
+} explore_decision_t;
+
+/* Where states stopped, the number of states stopping there, and the
+   shortest path of decisions found reaching it. */
+typedef struct explore_outcome {
+
+  explore_outcome_kind_t kind;
+  uint64_t            location;
+  uint64_t            states;
+  explore_decision_t *path;
+  uint64_t            pathLength;
+} explore_outcome_t;
+
+typedef struct explore_result {
+
+  explore_outcome_t *outcomes;
+  uint64_t           count;
+
+  uint64_t states;
+  uint64_t duplicates;
+  uint64_t instructions;
+  uint64_t depthLimited;
+  uint64_t stateLimited;
+  uint64_t stepLimited;
+  int      threads;
+} explore_result_t;
+
+void exploreFreeInit(explore_free_t *freeState);
+void exploreFreeClear(explore_free_t *freeState);
+
+int exploreRun(machine_state_t *start, const explore_free_t *freeState,
+	       const explore_limits_t *limits, explore_result_t *result);
+void exploreResultFree(explore_result_t *result);
+int exploreReport(FILE *file, const explore_result_t *result,
+		  const symbol_table_t *symbols);
+
+#endif /* EXPLORE */
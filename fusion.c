@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fusion.h"
+#include "heatmap.h"
+
+#define FUSION_CACHE_MASK (FUSION_CACHE_SIZE - 1)
+
+// bytes a fused sequence can span before its last instruction
+#define FUSION_MAX_SPAN 20
+
+static const char *kindNames[FUSION_KINDS] = {
+  [FUSION_NONE]               = "unfused",
+  [FUSION_ADD_IMMEDIATE]      = "irmovq+addq",
+  [FUSION_ADD_IMMEDIATE_JUMP] = "irmovq+addq+jXX",
+  [FUSION_OP_JUMP]            = "subq/andq+jXX",
+  [FUSION_LOAD_ADD]           = "mrmovq+addq"
+};
+
+/* Allocates an empty cache for a memory of the given size. Returns 1
+   in case of success, or 0 if memory could not be allocated. */
+int fusionInit(fusion_cache_t *cache, uint64_t memorySize)
+{
+  memset(cache, 0, sizeof(*cache));
+  cache->memorySize = memorySize;
+  cache->entries = malloc(FUSION_CACHE_SIZE * sizeof(fusion_entry_t));
+  cache->codeLines = calloc((memorySize >> FUSION_LINE_SHIFT) / 64 + 1,
+			    sizeof(uint64_t));
+  cache->targetMask = 255;
+  cache->targets = malloc((cache->targetMask + 1) * sizeof(uint64_t));
+  if (!cache->entries || !cache->codeLines || !cache->targets)
+  {
+    fusionFree(cache);
+    return 0;
+  }
+  fusionReset(cache);
+  return 1;
+}
+
+void fusionFree(fusion_cache_t *cache)
+{
+  free(cache->entries);
+  free(cache->codeLines);
+  free(cache->targets);
+  memset(cache, 0, sizeof(*cache));
+}
+
+/* Drops every decoded instruction and known jump target, as when
+   memory or the places execution must stop at changed. */
+void fusionReset(fusion_cache_t *cache)
+{
+  for (int i = 0; i < FUSION_CACHE_SIZE; i++)
+    cache->entries[i].address = FUSION_EMPTY;
+  memset(cache->codeLines, 0,
+	 ((cache->memorySize >> FUSION_LINE_SHIFT) / 64 + 1) * sizeof(uint64_t));
+  for (uint64_t i = 0; i <= cache->targetMask; i++)
+    cache->targets[i] = FUSION_EMPTY;
+  cache->targetCount = 0;
+}
+
+void fusionResetStats(fusion_cache_t *cache)
+{
+  cache->instructions = 0;
+  cache->fusedInstructions = 0;
+  memset(cache->groups, 0, sizeof(cache->groups));
+  cache->invalidations = 0;
+}
+
+static int isTarget(const fusion_cache_t *cache, uint64_t address)
+{
+  for (uint64_t slot = (address * 0x9E3779B97F4A7C15ULL) >> 40 &
+	 cache->targetMask; cache->targets[slot] != FUSION_EMPTY;
+       slot = (slot + 1) & cache->targetMask)
+    if (cache->targets[slot] == address)
+      return 1;
+  return 0;
+}
+
+static void insertTarget(fusion_cache_t *cache, uint64_t address)
+{
+  uint64_t slot = (address * 0x9E3779B97F4A7C15ULL) >> 40 & cache->targetMask;
+
+  while (cache->targets[slot] != FUSION_EMPTY)
+    slot = (slot + 1) & cache->targetMask;
+  cache->targets[slot] = address;
+  cache->targetCount++;
+}
+
+/* Adds an address execution may jump to, and drops the sequences fused
+   across it. If the set cannot grow, fusion stops being worth trying
+   and everything decoded is dropped instead. */
+static void addTarget(fusion_cache_t *cache, uint64_t address)
+{
+  if (address == FUSION_EMPTY || isTarget(cache, address))
+    return;
+
+  if (2 * (cache->targetCount + 1) > cache->targetMask + 1)
+  {
+    uint64_t *old = cache->targets, oldMask = cache->targetMask;
+    uint64_t *targets = malloc(2 * (oldMask + 1) * sizeof(uint64_t));
+
+    if (!targets)
+    {
+      fusionReset(cache);
+      return;
+    }
+    cache->targets = targets;
+    cache->targetMask = 2 * oldMask + 1;
+    cache->targetCount = 0;
+    for (uint64_t i = 0; i <= cache->targetMask; i++)
+      targets[i] = FUSION_EMPTY;
+    for (uint64_t i = 0; i <= oldMask; i++)
+      if (old[i] != FUSION_EMPTY)
+	insertTarget(cache, old[i]);
+    free(old);
+  }
+  insertTarget(cache, address);
+
+  for (uint64_t start = address > FUSION_MAX_SPAN ?
+	 address - FUSION_MAX_SPAN : 0; start < address; start++)
+  {
+    fusion_entry_t *entry = &cache->entries[start & FUSION_CACHE_MASK];
+    if (entry->address != start)
+      continue;
+    for (int i = 1; i < entry->count; i++)
+      if (entry->instr[i].location == address)
+	entry->address = FUSION_EMPTY;
+  }
+}
+
+/* Marks the lines holding the bytes from start to end (excluded). */
+static void markCode(fusion_cache_t *cache, uint64_t start, uint64_t end)
+{
+  if (end > cache->memorySize)
+    end = cache->memorySize;
+  for (uint64_t line = start >> FUSION_LINE_SHIFT;
+       line <= (end - 1) >> FUSION_LINE_SHIFT && start < end; line++)
+    cache->codeLines[line >> 6] |= 1ULL << (line & 63);
+}
+
+/* Decodes the instruction at the address into *instr, adding the
+   addresses it may jump to. Returns the end of its bytes. */
+static uint64_t decode(fusion_cache_t *cache, machine_state_t *state,
+		       uint64_t address, y86_instruction_t *instr)
+{
+  uint64_t pc = state->programCounter;
+  int length;
+
+  state->programCounter = address;
+  fetchInstruction(state, instr);
+  state->programCounter = pc;
+
+  if (instr->icode == I_JXX || instr->icode == I_CALL)
+    addTarget(cache, instr->valC);
+  if (instr->icode == I_CALL)
+    addTarget(cache, instr->valP);
+
+  // Invalid instructions were decoded from up to the longest length.
+  length = instructionLength(instr->icode);
+  return address + (length ? length : 10);
+}
+
+/* Whether the instruction can follow the ones before it in a fused
+   sequence: it must be where execution goes next, and not where it
+   may jump or has to stop. */
+static int canFollow(fusion_cache_t *cache, uint64_t address,
+		     fusion_stop_t stop, void *context)
+{
+  return address < cache->memorySize && !isTarget(cache, address) &&
+    !(stop && stop(context, address));
+}
+
+/* Returns the kind of sequence the instructions decoded so far form,
+   FUSION_NONE if they form none. */
+static fusion_kind_t sequenceKind(const y86_instruction_t *instr, int count)
+{
+  const y86_instruction_t *first = &instr[0], *second = &instr[1];
+
+  if (count < 2)
+    return FUSION_NONE;
+  if (count == 3)
+    return sequenceKind(instr, 2) == FUSION_ADD_IMMEDIATE &&
+      instr[2].icode == I_JXX ? FUSION_ADD_IMMEDIATE_JUMP : FUSION_NONE;
+  if (first->icode == I_IRMOVQ && second->icode == I_OPQ &&
+      second->ifun == A_ADDQ && second->rA == first->rB)
+    return FUSION_ADD_IMMEDIATE;
+  if (first->icode == I_OPQ &&
+      (first->ifun == A_SUBQ || first->ifun == A_ANDQ) &&
+      second->icode == I_JXX)
+    return FUSION_OP_JUMP;
+  if (first->icode == I_MRMOVQ && second->icode == I_OPQ &&
+      second->ifun == A_ADDQ && second->rA == first->rA)
+    return FUSION_LOAD_ADD;
+  return FUSION_NONE;
+}
+
+/* Returns the instructions decoded at the PC, fused with the ones
+   after them if they form one of the sequences executed as one.
+   Instructions are decoded on the first lookup, then kept until
+   memory where they were decoded from is written. No sequence is
+   fused across an address stop returns 1 for, or a jump target. */
+const fusion_entry_t *fusionLookup(fusion_cache_t *cache,
+				   machine_state_t *state, fusion_stop_t stop,
+				   void *context)
+{
+  uint64_t address = state->programCounter;
+  fusion_entry_t *entry = &cache->entries[address & FUSION_CACHE_MASK];
+  fusion_kind_t kind = FUSION_NONE;
+  uint64_t end, firstEnd;
+
+  if (entry->address == address)
+    return entry;
+
+  entry->address = FUSION_EMPTY;
+  entry->count = 1;
+  entry->kind = FUSION_NONE;
+  entry->end = firstEnd = decode(cache, state, address, &entry->instr[0]);
+
+  // Decode more while the instructions can still start a sequence.
+  for (int count = 1; count < FUSION_MAX_LENGTH; count++)
+  {
+    y86_instruction_t *last = &entry->instr[count - 1];
+    fusion_kind_t longer;
+
+    if (last->icode >= I_INVALID || last->icode == I_HALT ||
+	last->icode == I_JXX || !canFollow(cache, last->valP, stop, context))
+      break;
+    end = decode(cache, state, last->valP, &entry->instr[count]);
+    longer = sequenceKind(entry->instr, count + 1);
+    if (longer == FUSION_NONE)
+      break;
+    kind = longer;
+    entry->count = count + 1;
+    entry->end = end;
+  }
+  entry->kind = kind;
+  if (kind == FUSION_NONE)
+    entry->count = 1;
+
+  // Decoding added targets, which may fall inside this sequence.
+  for (int i = 1; i < entry->count; i++)
+    if (isTarget(cache, entry->instr[i].location))
+    {
+      entry->count = 1;
+      entry->kind = FUSION_NONE;
+      entry->end = firstEnd;
+    }
+
+  markCode(cache, address, entry->end);
+  entry->address = address;
+  return entry;
+}
+
+/* Executes a fused sequence, with the effects executeInstruction
+   would have on the machine executing its instructions in turn. */
+void fusionExecute(fusion_cache_t *cache, machine_state_t *state,
+		   const fusion_entry_t *entry)
+{
+  const y86_instruction_t *instr = entry->instr;
+  const y86_instruction_t *last = &instr[entry->count - 1];
+  uint64_t *registerFile = state->registerFile;
+  uint64_t address;
+  uint8_t cc = state->conditionCodes;
+
+  switch (entry->kind)
+  {
+  case FUSION_ADD_IMMEDIATE:
+  case FUSION_ADD_IMMEDIATE_JUMP:
+    registerFile[instr[0].rB] = instr[0].valC;
+    registerFile[instr[1].rB] += registerFile[instr[1].rA];
+    cc = setCC(registerFile[instr[1].rB]);
+    break;
+  case FUSION_OP_JUMP:
+    if (instr[0].ifun == A_SUBQ)
+      registerFile[instr[0].rB] -= registerFile[instr[0].rA];
+    else
+      registerFile[instr[0].rB] &= registerFile[instr[0].rA];
+    cc = setCC(registerFile[instr[0].rB]);
+    break;
+  case FUSION_LOAD_ADD:
+    address = instr[0].valC + registerFile[instr[0].rB];
+    if (state->heatmap)
+      heatmapRecordRead(state->heatmap, address);
+    registerFile[instr[0].rA] = state->programMap[address];
+    registerFile[instr[1].rB] += registerFile[instr[1].rA];
+    cc = setCC(registerFile[instr[1].rB]);
+    break;
+  default:
+    return;
+  }
+
+  state->programCounter = last->icode == I_JXX &&
+    conditionHolds(last->ifun, cc) ? last->valC : last->valP;
+  state->conditionCodes = cc;
+  state->instructionCount += entry->count;
+
+  cache->instructions += entry->count;
+  cache->fusedInstructions += entry->count;
+  cache->groups[entry->kind]++;
+}
+
+/* Drops every decoded instruction with bytes on the line. */
+void fusionInvalidateLine(fusion_cache_t *cache, uint64_t line)
+{
+  uint64_t start = line << FUSION_LINE_SHIFT;
+  uint64_t end = start + (1 << FUSION_LINE_SHIFT);
+
+  for (int i = 0; i < FUSION_CACHE_SIZE; i++)
+  {
+    fusion_entry_t *entry = &cache->entries[i];
+    if (entry->address != FUSION_EMPTY && entry->address < end &&
+	entry->end > start)
+      entry->address = FUSION_EMPTY;
+  }
+  cache->codeLines[line >> 6] &= ~(1ULL << (line & 63));
+  cache->invalidations++;
+}
+
+/* Lists how many instructions were executed as part of a fused
+   sequence, and how often each sequence was. */
+int fusionReport(FILE *file, const fusion_cache_t *cache)
+{
+  fprintf(file, "    # %lu instructions run, %lu of them fused (%.1f%%)\n",
+	  cache->instructions, cache->fusedInstructions,
+	  cache->instructions ?
+	  100.0 * cache->fusedInstructions / cache->instructions : 0.0);
+  for (int kind = FUSION_NONE + 1; kind < FUSION_KINDS; kind++)
+    fprintf(file, "    #   %-16s %lu\n", kindNames[kind], cache->groups[kind]);
+  fprintf(file, "    # %lu lines of decoded code dropped after stores\n",
+	  cache->invalidations);
+  return 1;
+}
@@ -0,0 +1,88 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in fusion.c
+*/
+
+#ifndef _FUSION_H_
+#define _FUSION_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define FUSION_CACHE_SHIFT 12 // 4096 entries, direct-mapped by address
+#define FUSION_CACHE_SIZE  (1 << FUSION_CACHE_SHIFT)
+#define FUSION_LINE_SHIFT  6  // stores invalidate 64-byte lines
+#define FUSION_MAX_LENGTH  3
+#define FUSION_EMPTY       UINT64_MAX
+
+/* Sequences of instructions executed as one. */
+typedef enum fusion_kind {
+  FUSION_NONE               = 0x0, // a single instruction
+  FUSION_ADD_IMMEDIATE      = 0x1, // irmovq $k, rX; addq rX, rY
+  FUSION_ADD_IMMEDIATE_JUMP = 0x2, // the same, then jXX
+  FUSION_OP_JUMP            = 0x3, // subq or andq, then jXX
+  FUSION_LOAD_ADD           = 0x4, // mrmovq D(rB), rX; addq rX, rY
+  FUSION_KINDS              = 0x5
+} fusion_kind_t;
+
+/* The instructions decoded at an address, fused if they form one of
+   the sequences above, and the end of their bytes. */
+typedef struct fusion_entry {
+
+  uint64_t          address;
+  uint64_t          end;
+  uint8_t           count;
+  fusion_kind_t     kind;
+  y86_instruction_t instr[FUSION_MAX_LENGTH];
+} fusion_entry_t;
+
+/* Tells whether execution must be able to stop at the address, so no
+   sequence is fused across it. */
+typedef int (*fusion_stop_t)(void *context, uint64_t address);
+
+/* Decoded instructions, the lines of memory they were decoded from,
+   and the addresses known to be jumped to: the targets of the jXX and
+   call decoded, and the addresses after each call. Sequences are not
+   fused across those either. */
+typedef struct fusion_cache {
+
+  uint64_t        memorySize;
+  fusion_entry_t *entries;
+  uint64_t       *codeLines;
+
+  uint64_t *targets;
+  uint64_t  targetCount;
+  uint64_t  targetMask;
+
+  uint64_t instructions;
+  uint64_t fusedInstructions;
+  uint64_t groups[FUSION_KINDS];
+  uint64_t invalidations;
+} fusion_cache_t;
+
+int fusionInit(fusion_cache_t *cache, uint64_t memorySize);
+void fusionFree(fusion_cache_t *cache);
+void fusionReset(fusion_cache_t *cache);
+void fusionResetStats(fusion_cache_t *cache);
+
+const fusion_entry_t *fusionLookup(fusion_cache_t *cache,
+				   machine_state_t *state, fusion_stop_t stop,
+				   void *context);
+void fusionExecute(fusion_cache_t *cache, machine_state_t *state,
+		   const fusion_entry_t *entry);
+void fusionInvalidateLine(fusion_cache_t *cache, uint64_t line);
+int fusionReport(FILE *file, const fusion_cache_t *cache);
+
+/* Drops the decoded instructions read from the line of the address, if
+   any. Called before every guest store while the cache is attached. */
+static inline void fusionRecordStore(fusion_cache_t *cache, uint64_t address)
+{
+  uint64_t line = address >> FUSION_LINE_SHIFT;
+
+  if (address < cache->memorySize &&
+      (cache->codeLines[line >> 6] & (1ULL << (line & 63))))
+    fusionInvalidateLine(cache, line);
+}
+
+#endif /* FUSION */
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "heatmap.h"
+
+/* Lines listed by heatmapReport, the most accessed first. */
+#define HEATMAP_HOTTEST 10
+
+/* Allocates zeroed counters for a memory of the given size, sampling
+   the working set every interval instructions from the current
+   instruction count. Returns 1 in case of success, or 0 if memory
+   could not be allocated. */
+int heatmapInit(heatmap_t *heatmap, uint64_t memorySize, uint64_t interval,
+		uint64_t instructionCount)
+{
+  memset(heatmap, 0, sizeof(*heatmap));
+  heatmap->memorySize = memorySize;
+  heatmap->lineCount = (memorySize >> HEATMAP_LINE_SHIFT) + 1;
+  heatmap->pageCount = (memorySize >> HEATMAP_PAGE_SHIFT) + 1;
+  heatmap->interval = interval;
+  heatmap->nextSample = instructionCount + interval;
+
+  heatmap->lineReads = calloc(3 * heatmap->lineCount, sizeof(uint32_t));
+  heatmap->pageReads = calloc(2 * heatmap->pageCount, sizeof(uint64_t));
+  heatmap->touchedBits = calloc((heatmap->pageCount + 63) / 64 +
+				heatmap->pageCount, sizeof(uint64_t));
+  if (!heatmap->lineReads || !heatmap->pageReads || !heatmap->touchedBits)
+  {
+    heatmapFree(heatmap);
+    return 0;
+  }
+  heatmap->lineWrites = heatmap->lineReads + heatmap->lineCount;
+  heatmap->lineSeen = heatmap->lineWrites + heatmap->lineCount;
+  heatmap->pageWrites = heatmap->pageReads + heatmap->pageCount;
+  heatmap->touched = heatmap->touchedBits + (heatmap->pageCount + 63) / 64;
+  return 1;
+}
+
+void heatmapFree(heatmap_t *heatmap)
+{
+  free(heatmap->lineReads);
+  free(heatmap->pageReads);
+  free(heatmap->touchedBits);
+  free(heatmap->samples);
+  memset(heatmap, 0, sizeof(*heatmap));
+}
+
+/* Clears the counters and the samples, and starts sampling again from
+   the current instruction count. */
+void heatmapReset(heatmap_t *heatmap, uint64_t instructionCount)
+{
+  memset(heatmap->lineReads, 0, 3 * heatmap->lineCount * sizeof(uint32_t));
+  memset(heatmap->pageReads, 0, 2 * heatmap->pageCount * sizeof(uint64_t));
+  memset(heatmap->touchedBits, 0,
+	 (heatmap->pageCount + 63) / 64 * sizeof(uint64_t));
+  heatmap->touchedCount = 0;
+  heatmap->footprint = 0;
+  heatmap->sampleCount = 0;
+  heatmap->nextSample = instructionCount + heatmap->interval;
+}
+
+/* Records the working set since the last sample. Only the pages
+   listed as accessed since are visited, and the lines of those
+   compared, so a sample costs one comparison per line of the pages
+   accessed, whatever the size of memory. */
+void heatmapSample(heatmap_t *heatmap, uint64_t instructionCount)
+{
+  heatmap_sample_t sample = {instructionCount, 0, 0, 0};
+  uint64_t linesPerPage = 1 << (HEATMAP_PAGE_SHIFT - HEATMAP_LINE_SHIFT);
+
+  heatmap->nextSample = instructionCount + heatmap->interval;
+
+  for (uint64_t i = 0; i < heatmap->touchedCount; i++)
+  {
+    uint64_t page = heatmap->touched[i];
+
+    heatmap->touchedBits[page >> 6] &= ~(1ULL << (page & 63));
+    sample.pages++;
+
+    uint64_t first = page * linesPerPage;
+    uint64_t last = first + linesPerPage < heatmap->lineCount ?
+      first + linesPerPage : heatmap->lineCount;
+    for (uint64_t line = first; line < last; line++)
+    {
+      uint32_t lineCount = heatmap->lineReads[line] + heatmap->lineWrites[line];
+      if (lineCount == heatmap->lineSeen[line])
+	continue;
+      if (!heatmap->lineSeen[line])
+	heatmap->footprint++;
+      heatmap->lineSeen[line] = lineCount;
+      sample.lines++;
+    }
+  }
+  heatmap->touchedCount = 0;
+  sample.footprint = heatmap->footprint;
+
+  if (heatmap->sampleCount == heatmap->sampleCapacity)
+  {
+    uint64_t capacity = heatmap->sampleCapacity ?
+      2 * heatmap->sampleCapacity : 256;
+    heatmap_sample_t *samples = realloc(heatmap->samples,
+					capacity * sizeof(*samples));
+    if (!samples)
+      return;
+    heatmap->samples = samples;
+    heatmap->sampleCapacity = capacity;
+  }
+  heatmap->samples[heatmap->sampleCount++] = sample;
+}
+
+/* Opens prefix followed by suffix for writing. */
+static FILE *openOutput(const char *prefix, const char *suffix)
+{
+  char filename[strlen(prefix) + strlen(suffix) + 1];
+
+  strcpy(filename, prefix);
+  strcat(filename, suffix);
+  return fopen(filename, "w");
+}
+
+/* Writes the counters as CSV files: prefix.lines.csv and
+   prefix.pages.csv with the reads and writes of every line and page
+   accessed, and prefix.wss.csv with the working set samples. Returns
+   1 in case of success, or 0 (with errno set) in case of failure. */
+int heatmapSave(heatmap_t *heatmap, const char *prefix)
+{
+  FILE *lines = openOutput(prefix, ".lines.csv");
+  FILE *pages = openOutput(prefix, ".pages.csv");
+  FILE *wss = openOutput(prefix, ".wss.csv");
+  int saved = lines && pages && wss;
+
+  if (saved)
+  {
+    fprintf(lines, "address,reads,writes\n");
+    for (uint64_t line = 0; line < heatmap->lineCount; line++)
+      if (heatmap->lineReads[line] || heatmap->lineWrites[line])
+	fprintf(lines, "0x%lx,%u,%u\n", line << HEATMAP_LINE_SHIFT,
+		heatmap->lineReads[line], heatmap->lineWrites[line]);
+
+    fprintf(pages, "address,reads,writes\n");
+    for (uint64_t page = 0; page < heatmap->pageCount; page++)
+      if (heatmap->pageReads[page] || heatmap->pageWrites[page])
+	fprintf(pages, "0x%lx,%lu,%lu\n", page << HEATMAP_PAGE_SHIFT,
+		heatmap->pageReads[page], heatmap->pageWrites[page]);
+
+    fprintf(wss, "instructions,lines,pages,footprint\n");
+    for (uint64_t i = 0; i < heatmap->sampleCount; i++)
+      fprintf(wss, "%lu,%lu,%lu,%lu\n", heatmap->samples[i].instructionCount,
+	      heatmap->samples[i].lines, heatmap->samples[i].pages,
+	      heatmap->samples[i].footprint);
+
+    saved = !ferror(lines) && !ferror(pages) && !ferror(wss);
+  }
+
+  int error = errno;
+  if (lines && fclose(lines) != 0)
+    saved = 0;
+  if (pages && fclose(pages) != 0)
+    saved = 0;
+  if (wss && fclose(wss) != 0)
+    saved = 0;
+  if (!saved && error)
+    errno = error;
+  return saved;
+}
+
+/* Prints the totals, the number of lines and pages accessed, and the
+   most accessed lines. Returns the number of characters printed. */
+int heatmapReport(FILE *file, heatmap_t *heatmap)
+{
+  uint64_t reads = 0, writes = 0, lines = 0, pages = 0;
+  uint64_t hottest[HEATMAP_HOTTEST];
+  int hotCount = 0, chars;
+
+  for (uint64_t page = 0; page < heatmap->pageCount; page++)
+  {
+    reads += heatmap->pageReads[page];
+    writes += heatmap->pageWrites[page];
+    pages += heatmap->pageReads[page] || heatmap->pageWrites[page];
+  }
+
+  // Keep the hottest lines in decreasing order of accesses.
+  for (uint64_t line = 0; line < heatmap->lineCount; line++)
+  {
+    uint64_t count = (uint64_t)heatmap->lineReads[line] +
+      heatmap->lineWrites[line];
+    int i;
+
+    if (!count)
+      continue;
+    lines++;
+    for (i = hotCount; i > 0; i--)
+    {
+      uint64_t other = hottest[i - 1];
+      if ((uint64_t)heatmap->lineReads[other] + heatmap->lineWrites[other] >=
+	  count)
+	break;
+      if (i < HEATMAP_HOTTEST)
+	hottest[i] = other;
+    }
+    if (i < HEATMAP_HOTTEST)
+    {
+      hottest[i] = line;
+      if (hotCount < HEATMAP_HOTTEST)
+	hotCount++;
+    }
+  }
+
+  chars = fprintf(file, "    # %lu reads, %lu writes, %lu lines and %lu pages "
+		  "accessed, %lu samples every %lu instructions\n", reads,
+		  writes, lines, pages, heatmap->sampleCount, heatmap->interval);
+  for (int i = 0; i < hotCount; i++)
+    chars += fprintf(file, "    # Line 0x%lx: %u reads, %u writes\n",
+		     hottest[i] << HEATMAP_LINE_SHIFT,
+		     heatmap->lineReads[hottest[i]],
+		     heatmap->lineWrites[hottest[i]]);
+  return chars;
+}
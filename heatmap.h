@@ -0,0 +1,104 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in heatmap.c
+*/
+
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define HEATMAP_LINE_SHIFT 6  // 64-byte lines
+#define HEATMAP_PAGE_SHIFT 12 // 4K pages
+
+#define HEATMAP_DEFAULT_INTERVAL 10000
+
+/* Working set over one sampling interval: the lines and pages
+   accessed during it, and the lines accessed since recording began. */
+typedef struct heatmap_sample {
+
+  uint64_t instructionCount;
+  uint64_t lines;
+  uint64_t pages;
+  uint64_t footprint;
+} heatmap_sample_t;
+
+/* Guest memory reads and writes counted per line and per page. The
+   seen array holds the counts at the last sample, so the lines
+   accessed since can be found by comparing; the pages accessed since
+   are listed, with a bitmap to list each once, so a sample does not
+   visit the others. */
+typedef struct heatmap {
+
+  uint64_t  memorySize;
+  uint64_t  lineCount;
+  uint64_t  pageCount;
+
+  uint32_t *lineReads;
+  uint32_t *lineWrites;
+  uint32_t *lineSeen;
+  uint64_t *pageReads;
+  uint64_t *pageWrites;
+  uint64_t *touchedBits;
+  uint64_t *touched;
+  uint64_t  touchedCount;
+
+  uint64_t  interval;
+  uint64_t  nextSample;
+  uint64_t  footprint;
+
+  heatmap_sample_t *samples;
+  uint64_t  sampleCount;
+  uint64_t  sampleCapacity;
+} heatmap_t;
+
+int heatmapInit(heatmap_t *heatmap, uint64_t memorySize, uint64_t interval,
+		uint64_t instructionCount);
+void heatmapFree(heatmap_t *heatmap);
+void heatmapReset(heatmap_t *heatmap, uint64_t instructionCount);
+void heatmapSample(heatmap_t *heatmap, uint64_t instructionCount);
+int heatmapSave(heatmap_t *heatmap, const char *prefix);
+int heatmapReport(FILE *file, heatmap_t *heatmap);
+
+/* Lists the page as accessed since the last sample, if it is not yet. */
+static inline void heatmapTouchPage(heatmap_t *heatmap, uint64_t page)
+{
+  if (!(heatmap->touchedBits[page >> 6] & (1ULL << (page & 63))))
+  {
+    heatmap->touchedBits[page >> 6] |= 1ULL << (page & 63);
+    heatmap->touched[heatmap->touchedCount++] = page;
+  }
+}
+
+/* Counts a guest read of the address. Called on every guest load. */
+static inline void heatmapRecordRead(heatmap_t *heatmap, uint64_t address)
+{
+  if (address < heatmap->memorySize)
+  {
+    heatmap->lineReads[address >> HEATMAP_LINE_SHIFT]++;
+    heatmap->pageReads[address >> HEATMAP_PAGE_SHIFT]++;
+    heatmapTouchPage(heatmap, address >> HEATMAP_PAGE_SHIFT);
+  }
+}
+
+/* Counts a guest write of the address. Called on every guest store. */
+static inline void heatmapRecordWrite(heatmap_t *heatmap, uint64_t address)
+{
+  if (address < heatmap->memorySize)
+  {
+    heatmap->lineWrites[address >> HEATMAP_LINE_SHIFT]++;
+    heatmap->pageWrites[address >> HEATMAP_PAGE_SHIFT]++;
+    heatmapTouchPage(heatmap, address >> HEATMAP_PAGE_SHIFT);
+  }
+}
+
+/* Samples the working set if the interval has elapsed. Called after
+   every executed instruction. */
+static inline void heatmapRecordInstruction(heatmap_t *heatmap,
+					    uint64_t instructionCount)
+{
+  if (instructionCount >= heatmap->nextSample)
+    heatmapSample(heatmap, instructionCount);
+}
+
+#endif /* HEATMAP */
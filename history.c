@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "history.h"
+#include "dirty.h"
+
+/* Makes sure an array has room for one more element, doubling its
+   capacity as needed. Returns 1 in case of success, or 0 if memory
+   could not be allocated. */
+static int reserve(void **array, uint64_t *capacity, uint64_t count,
+		   size_t elementSize)
+{
+  if (count < *capacity)
+    return 1;
+
+  uint64_t larger = *capacity ? 2 * *capacity : 64;
+  void *resized = realloc(*array, larger * elementSize);
+  if (!resized)
+    return 0;
+  *array = resized;
+  *capacity = larger;
+  return 1;
+}
+
+/* Starts recording the execution history of the machine, with a first
+   checkpoint at its current state. Returns 1 in case of success, or 0
+   if memory could not be allocated. */
+int historyInit(history_t *history, machine_state_t *state, uint64_t interval)
+{
+  uint64_t blocks = (state->programSize + HISTORY_BLOCK_SIZE - 1) /
+    HISTORY_BLOCK_SIZE;
+
+  memset(history, 0, sizeof(*history));
+  history->interval = interval;
+  history->memorySize = state->programSize;
+  history->savedBits = calloc((blocks + 63) / 64 + 1, sizeof(uint64_t));
+  if (!history->savedBits)
+    return 0;
+
+  return historyCheckpoint(history, state);
+}
+
+void historyFree(history_t *history)
+{
+  free(history->checkpoints);
+  free(history->blockAddress);
+  free(history->blockData);
+  free(history->savedBits);
+  memset(history, 0, sizeof(*history));
+}
+
+/* Records the current machine state as a new checkpoint. A checkpoint
+   at the same instruction count as the last one replaces it. Returns
+   1 in case of success, or 0 if memory could not be allocated. */
+int historyCheckpoint(history_t *history, machine_state_t *state)
+{
+  checkpoint_t *checkpoint;
+
+  if (history->checkpointCount > 0 &&
+      history->checkpoints[history->checkpointCount - 1].instructionCount ==
+      state->instructionCount)
+    checkpoint = &history->checkpoints[history->checkpointCount - 1];
+  else
+  {
+    if (!reserve((void **)&history->checkpoints, &history->checkpointCapacity,
+		 history->checkpointCount, sizeof(checkpoint_t)))
+    {
+      history->incomplete = 1;
+      return 0;
+    }
+    checkpoint = &history->checkpoints[history->checkpointCount++];
+    checkpoint->firstBlock = history->blockCount;
+
+    // Blocks saved for the previous checkpoint are no longer marked,
+    // so they get saved again for this one.
+    if (history->checkpointCount > 1)
+      for (uint64_t i = checkpoint[-1].firstBlock; i < history->blockCount; i++)
+      {
+	uint64_t block = history->blockAddress[i] / HISTORY_BLOCK_SIZE;
+	history->savedBits[block >> 6] &= ~(1ULL << (block & 63));
+      }
+  }
+
+  checkpoint->instructionCount = state->instructionCount;
+  checkpoint->programCounter = state->programCounter;
+  memcpy(checkpoint->registerFile, state->registerFile,
+	 sizeof(checkpoint->registerFile));
+  checkpoint->conditionCodes = state->conditionCodes;
+  return 1;
+}
+
+/* Saves the contents of the block containing the address, before it
+   is first written after the last checkpoint. Returns 1 in case of
+   success, or 0 if memory could not be allocated, in which case the
+   history can no longer be rewound. */
+int historySaveBlock(history_t *history, machine_state_t *state,
+		     uint64_t address)
+{
+  uint64_t block = address / HISTORY_BLOCK_SIZE;
+  uint64_t start = block * HISTORY_BLOCK_SIZE;
+  uint64_t size = history->memorySize - start < HISTORY_BLOCK_SIZE ?
+    history->memorySize - start : HISTORY_BLOCK_SIZE;
+  uint64_t capacity = history->blockCapacity;
+
+  if (!reserve((void **)&history->blockAddress, &history->blockCapacity,
+	       history->blockCount, sizeof(uint64_t)))
+  {
+    history->incomplete = 1;
+    return 0;
+  }
+  if (capacity != history->blockCapacity)
+  {
+    uint8_t *data = realloc(history->blockData,
+			    history->blockCapacity * HISTORY_BLOCK_SIZE);
+    if (!data)
+    {
+      history->blockCapacity = capacity;
+      history->incomplete = 1;
+      return 0;
+    }
+    history->blockData = data;
+  }
+
+  history->blockAddress[history->blockCount] = start;
+  memcpy(history->blockData + history->blockCount * HISTORY_BLOCK_SIZE,
+	 state->programMap + start, size);
+  history->blockCount++;
+  history->savedBits[block >> 6] |= 1ULL << (block & 63);
+  return 1;
+}
+
+/* Brings the machine back to the last checkpoint taken at or before
+   the target instruction count, restoring its registers and memory.
+   Checkpoints after it are discarded, as the execution from there on
+   may differ. The caller then executes the remaining instructions
+   (fewer than the interval) to reach the target. Returns 1 in case of
+   success, or 0 if the history is incomplete. */
+int historyRewind(history_t *history, machine_state_t *state, uint64_t target)
+{
+  uint64_t low = 0, high = history->checkpointCount;
+
+  if (history->incomplete)
+    return 0;
+
+  // Find the first checkpoint after the target.
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (history->checkpoints[middle].instructionCount <= target)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low == 0)
+    return 0;
+
+  checkpoint_t *checkpoint = &history->checkpoints[low - 1];
+
+  // Undo the writes, most recent first, so the contents saved for the
+  // oldest interval are the ones left in memory.
+  while (history->blockCount > checkpoint->firstBlock)
+  {
+    uint64_t i = --history->blockCount;
+    uint64_t start = history->blockAddress[i];
+    uint64_t block = start / HISTORY_BLOCK_SIZE;
+    uint64_t size = history->memorySize - start < HISTORY_BLOCK_SIZE ?
+      history->memorySize - start : HISTORY_BLOCK_SIZE;
+
+    dirtyRecordRange(state, start, size);
+    memcpy(state->programMap + start,
+	   history->blockData + i * HISTORY_BLOCK_SIZE, size);
+    history->savedBits[block >> 6] &= ~(1ULL << (block & 63));
+  }
+  history->checkpointCount = low;
+
+  state->instructionCount = checkpoint->instructionCount;
+  state->programCounter = checkpoint->programCounter;
+  memcpy(state->registerFile, checkpoint->registerFile,
+	 sizeof(state->registerFile));
+  state->conditionCodes = checkpoint->conditionCodes;
+  return 1;
+}
+
+/* Returns the number of bytes used to store the history. */
+uint64_t historyMemoryUsed(history_t *history)
+{
+  return history->checkpointCapacity * sizeof(checkpoint_t) +
+    history->blockCapacity * (sizeof(uint64_t) + HISTORY_BLOCK_SIZE);
+}
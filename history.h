@@ -0,0 +1,82 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in history.c
+*/
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define HISTORY_DEFAULT_INTERVAL 100000
+
+/* Memory is saved in blocks of this many bytes, the first time a
+   block is written after a checkpoint. */
+#define HISTORY_BLOCK_SIZE 256
+
+/* Machine state at a given instruction count. Memory is not copied:
+   the blocks saved from firstBlock onwards hold the contents memory
+   had at this checkpoint, for every block written since. */
+typedef struct checkpoint {
+
+  uint64_t instructionCount;
+  uint64_t programCounter;
+  uint64_t registerFile[16];
+  uint64_t firstBlock;
+  uint8_t  conditionCodes;
+} checkpoint_t;
+
+/* Execution history, as checkpoints taken every interval
+   instructions (and whenever the program counter is changed by the
+   user), ordered by instruction count. */
+typedef struct history {
+
+  uint64_t      interval;
+  uint64_t      memorySize;
+
+  checkpoint_t *checkpoints;
+  uint64_t      checkpointCount;
+  uint64_t      checkpointCapacity;
+
+  uint64_t     *blockAddress;
+  uint8_t      *blockData;
+  uint64_t      blockCount;
+  uint64_t      blockCapacity;
+
+  uint64_t     *savedBits;
+
+  int           incomplete;
+} history_t;
+
+int historyInit(history_t *history, machine_state_t *state, uint64_t interval);
+void historyFree(history_t *history);
+int historyCheckpoint(history_t *history, machine_state_t *state);
+int historyRewind(history_t *history, machine_state_t *state, uint64_t target);
+uint64_t historyMemoryUsed(history_t *history);
+
+int historySaveBlock(history_t *history, machine_state_t *state,
+		     uint64_t address);
+
+/* Saves the block containing the address if this is the first write
+   to it since the last checkpoint. Called before every guest store. */
+static inline void historyRecordWrite(history_t *history,
+				      machine_state_t *state, uint64_t address)
+{
+  uint64_t block = address / HISTORY_BLOCK_SIZE;
+  if (address < history->memorySize &&
+      !(history->savedBits[block >> 6] & (1ULL << (block & 63))))
+    historySaveBlock(history, state, address);
+}
+
+/* Takes a checkpoint if interval instructions were executed since the
+   last one. Called after every executed instruction. */
+static inline void historyRecordInstruction(history_t *history,
+					    machine_state_t *state)
+{
+  checkpoint_t *last = &history->checkpoints[history->checkpointCount - 1];
+  if (state->instructionCount - last->instructionCount >= history->interval)
+    historyCheckpoint(history, state);
+}
+
+#endif /* HISTORY */
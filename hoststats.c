@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "hoststats.h"
+
+/* Readings taken back to back when measuring the cost of a reading. */
+#define CALIBRATION_READINGS 1000
+
+static const char *icodeName[HOSTSTATS_ICODES] = {
+  [I_HALT]      = "halt",
+  [I_NOP]       = "nop",
+  [I_RRMVXX]    = "rrmovq/cmovXX",
+  [I_IRMOVQ]    = "irmovq",
+  [I_RMMOVQ]    = "rmmovq",
+  [I_MRMOVQ]    = "mrmovq",
+  [I_OPQ]       = "OPq",
+  [I_JXX]       = "jXX",
+  [I_CALL]      = "call",
+  [I_RET]       = "ret",
+  [I_PUSHQ]     = "pushq",
+  [I_POPQ]      = "popq",
+  [I_INVALID]   = "invalid",
+  [I_TOO_SHORT] = "incomplete"
+};
+
+static const char *phaseName[PHASE_COUNT] = {
+  [PHASE_DECODE]  = "decode",
+  [PHASE_EXECUTE] = "execute",
+  [PHASE_OUTPUT]  = "output"
+};
+
+static const char *counterName[HOSTSTATS_COUNTERS] = {
+  "cycles", "br-miss", "cache-miss"
+};
+
+/* Opens one hardware counter of this thread, in user mode only, as
+   part of the group led by group (or as its leader if group is -1).
+   Returns the file descriptor, or -1 (with errno set) on failure. */
+static int openCounter(uint64_t config, int group)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static uint64_t readTimestamp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Reads every counter of the group with a single system call, or the
+   time stamp counter if perf_event is not used. Returns 1 in case of
+   success, or 0 if the counters could not be read in full. */
+static int readCounters(hoststats_t *stats, uint64_t *values)
+{
+  struct {
+    uint64_t count;
+    uint64_t values[HOSTSTATS_COUNTERS];
+  } group;
+
+  if (!stats->counterCount)
+  {
+    values[0] = readTimestamp();
+    return 1;
+  }
+
+  if (read(stats->fds[0], &group, sizeof(group)) <
+      (ssize_t)((stats->counterCount + 1) * sizeof(uint64_t)) ||
+      group.count < (uint64_t)stats->counterCount)
+    return 0;
+  memcpy(values, group.values, stats->counterCount * sizeof(uint64_t));
+  return 1;
+}
+
+/* Opens the host counters, or falls back to rdtsc if the kernel or
+   the machine does not provide them, and measures the cost of taking
+   a reading so it can be left out of every phase. Returns 1 if
+   perf_event is used, or 0 if rdtsc is, with errno telling why. */
+int hoststatsInit(hoststats_t *stats)
+{
+  static const uint64_t configs[HOSTSTATS_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES
+  };
+  uint64_t before[HOSTSTATS_COUNTERS], after[HOSTSTATS_COUNTERS];
+  int error = 0;
+
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < HOSTSTATS_COUNTERS; i++)
+    stats->fds[i] = -1;
+
+  // Counters after the cycles are optional; the group stops at the
+  // first one that cannot be opened.
+  for (int i = 0; i < HOSTSTATS_COUNTERS; i++)
+  {
+    stats->fds[i] = openCounter(configs[i], i ? stats->fds[0] : -1);
+    if (stats->fds[i] < 0)
+      break;
+    stats->counterCount++;
+  }
+  if (stats->counterCount)
+    ioctl(stats->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  else
+    error = errno;
+
+  for (int i = 0; i < HOSTSTATS_COUNTERS; i++)
+    stats->overhead[i] = UINT64_MAX;
+  for (int n = 0; n < CALIBRATION_READINGS; n++)
+  {
+    if (!readCounters(stats, before) || !readCounters(stats, after))
+      continue;
+    for (int i = 0; i < (stats->counterCount ? stats->counterCount : 1); i++)
+      if (after[i] - before[i] < stats->overhead[i])
+	stats->overhead[i] = after[i] - before[i];
+  }
+  for (int i = 0; i < HOSTSTATS_COUNTERS; i++)
+    if (stats->overhead[i] == UINT64_MAX)
+      stats->overhead[i] = 0;
+
+  errno = error;
+  return stats->counterCount > 0;
+}
+
+void hoststatsFree(hoststats_t *stats)
+{
+  for (int i = 0; i < HOSTSTATS_COUNTERS; i++)
+    if (stats->fds[i] >= 0)
+      close(stats->fds[i]);
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < HOSTSTATS_COUNTERS; i++)
+    stats->fds[i] = -1;
+}
+
+void hoststatsReset(hoststats_t *stats)
+{
+  memset(stats->samples, 0, sizeof(stats->samples));
+  memset(stats->totals, 0, sizeof(stats->totals));
+  stats->running = 0;
+}
+
+/* Ends a phase of the given instruction, adding what the counters
+   moved since the previous call (less the cost of a reading) to it,
+   and starts the next phase. The first call after a pause only starts
+   a phase. */
+void hoststatsCharge(hoststats_t *stats, hoststats_phase_t phase,
+		     y86_icode_t icode)
+{
+  uint64_t now[HOSTSTATS_COUNTERS];
+  int counters = stats->counterCount ? stats->counterCount : 1;
+
+  // A failed reading leaves the phase uncharged; the next one starts
+  // a new phase.
+  if (!readCounters(stats, now))
+  {
+    stats->running = 0;
+    return;
+  }
+  if (stats->running && icode < HOSTSTATS_ICODES)
+  {
+    stats->samples[icode][phase]++;
+    for (int i = 0; i < counters; i++)
+    {
+      uint64_t delta = now[i] - stats->last[i];
+      stats->totals[icode][phase][i] += delta > stats->overhead[i] ?
+	delta - stats->overhead[i] : 0;
+    }
+  }
+  memcpy(stats->last, now, sizeof(now));
+  stats->running = 1;
+}
+
+/* Ends the output phase of the instruction last printed, when the
+   debugger goes back to the prompt, so the time spent waiting for a
+   command is not counted. */
+void hoststatsPause(hoststats_t *stats, y86_icode_t icode)
+{
+  if (stats->running)
+    hoststatsCharge(stats, PHASE_OUTPUT, icode);
+  stats->running = 0;
+}
+
+/* Prints the average of each counter per instruction, for each icode
+   and phase, then for each phase over all icodes. Returns the number
+   of characters printed. */
+int hoststatsReport(FILE *file, hoststats_t *stats)
+{
+  int counters = stats->counterCount ? stats->counterCount : 1;
+  uint64_t samples[PHASE_COUNT] = {0};
+  uint64_t totals[PHASE_COUNT][HOSTSTATS_COUNTERS] = {{0}};
+  int chars;
+
+  if (stats->counterCount)
+    chars = fprintf(file, "    # Host counters from perf_event, per "
+		    "instruction\n");
+  else
+    chars = fprintf(file, "    # Host time stamp counter ticks (rdtsc), "
+		    "per instruction\n");
+
+  chars += fprintf(file, "    # %-14s %-8s %12s", "icode", "phase", "count");
+  for (int i = 0; i < counters; i++)
+    chars += fprintf(file, " %12s", stats->counterCount ? counterName[i] :
+		     "ticks");
+  chars += fprintf(file, "\n");
+
+  for (int icode = 0; icode < HOSTSTATS_ICODES; icode++)
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+      uint64_t count = stats->samples[icode][phase];
+
+      if (!count || !icodeName[icode])
+	continue;
+      samples[phase] += count;
+      chars += fprintf(file, "    # %-14s %-8s %12lu", icodeName[icode],
+		       phaseName[phase], count);
+      for (int i = 0; i < counters; i++)
+      {
+	totals[phase][i] += stats->totals[icode][phase][i];
+	chars += fprintf(file, " %12.2f",
+			 (double)stats->totals[icode][phase][i] / count);
+      }
+      chars += fprintf(file, "\n");
+    }
+
+  for (int phase = 0; phase < PHASE_COUNT; phase++)
+  {
+    if (!samples[phase])
+      continue;
+    chars += fprintf(file, "    # %-14s %-8s %12lu", "all", phaseName[phase],
+		     samples[phase]);
+    for (int i = 0; i < counters; i++)
+      chars += fprintf(file, " %12.2f",
+		       (double)totals[phase][i] / samples[phase]);
+    chars += fprintf(file, "\n");
+  }
+  return chars;
+}
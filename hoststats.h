@@ -0,0 +1,54 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in hoststats.c
+*/
+
+#ifndef _HOSTSTATS_H_
+#define _HOSTSTATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+/* Host counters read at each phase boundary: cycles, branch misses and
+   cache misses with perf_event, or only the time stamp counter when
+   perf_event_open is not available. */
+#define HOSTSTATS_COUNTERS 3
+
+/* Every guest icode, including I_INVALID and I_TOO_SHORT. */
+#define HOSTSTATS_ICODES (I_TOO_SHORT + 1)
+
+/* Phases the host time of a guest instruction is split into. */
+typedef enum hoststats_phase {
+  PHASE_DECODE  = 0x0, // fetchInstruction
+  PHASE_EXECUTE = 0x1, // executeInstruction
+  PHASE_OUTPUT  = 0x2, // printing it and the rest of the debugger loop
+  PHASE_COUNT   = 0x3
+} hoststats_phase_t;
+
+/* Host counter totals for each icode and phase, accumulated from the
+   differences between readings taken at each phase boundary. */
+typedef struct hoststats {
+
+  int      fds[HOSTSTATS_COUNTERS];
+  int      counterCount;   // counters opened with perf_event, 0 for rdtsc
+  uint64_t overhead[HOSTSTATS_COUNTERS];
+
+  int      running;        // whether last holds the start of a phase
+  uint64_t last[HOSTSTATS_COUNTERS];
+
+  uint64_t samples[HOSTSTATS_ICODES][PHASE_COUNT];
+  uint64_t totals[HOSTSTATS_ICODES][PHASE_COUNT][HOSTSTATS_COUNTERS];
+} hoststats_t;
+
+int hoststatsInit(hoststats_t *stats);
+void hoststatsFree(hoststats_t *stats);
+void hoststatsReset(hoststats_t *stats);
+
+void hoststatsCharge(hoststats_t *stats, hoststats_phase_t phase,
+		     y86_icode_t icode);
+void hoststatsPause(hoststats_t *stats, y86_icode_t icode);
+
+int hoststatsReport(FILE *file, hoststats_t *stats);
+
+#endif /* HOSTSTATS */
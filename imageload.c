@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "imageload.h"
+
+/* Returns the offset of the first non-zero byte in [start, end), or end
+   if there is none. Whole words are checked at a time, four in a row
+   while they are zero. */
+static uint64_t findNonZero(const uint8_t *map, uint64_t start, uint64_t end)
+{
+  uint64_t i = start;
+
+  for (; i < end && (i & 7); i++)
+    if (map[i])
+      return i;
+
+  for (; i + 32 <= end; i += 32)
+  {
+    const uint64_t *words = (const uint64_t *)(map + i);
+    if (words[0] | words[1] | words[2] | words[3])
+      break;
+  }
+  for (; i + 8 <= end; i += 8)
+    if (*(const uint64_t *)(map + i))
+      break;
+
+  for (; i < end; i++)
+    if (map[i])
+      return i;
+  return end;
+}
+
+/* Finds the extent of data at or after position in the file: returns
+   its start, with its end in *hole, or size if the rest of the file is
+   a hole. Files (or file systems) without holes are one extent. */
+static uint64_t nextExtent(int fd, uint64_t position, uint64_t size,
+			   uint64_t *hole)
+{
+  off_t data = fd >= 0 ? lseek(fd, position, SEEK_DATA) : -1;
+  off_t end;
+
+  *hole = size;
+  if (data < 0)
+    return fd >= 0 && errno == ENXIO ? size : position;
+  if ((uint64_t)data >= size)
+    return size;
+
+  end = lseek(fd, data, SEEK_HOLE);
+  if (end >= 0 && (uint64_t)end < size)
+    *hole = end;
+  return data;
+}
+
+/* Returns the offset of the first non-zero byte at or after start in an
+   image just mapped from the file fd (or -1 if there is no file), or
+   size if there is none. Holes in the file are skipped without reading
+   them, so only the pages holding data before that byte are faulted
+   in. */
+uint64_t imageFirstData(int fd, const uint8_t *map, uint64_t size,
+			uint64_t start)
+{
+  uint64_t position = start, hole, found;
+
+  while (position < size)
+  {
+    position = nextExtent(fd, position, size, &hole);
+    if (position >= size)
+      break;
+    found = findNonZero(map, position, hole);
+    if (found < hole)
+      return found;
+    position = hole;
+  }
+  return size;
+}
+
+/* Tells the kernel how the image is used: the guest reads and writes
+   its data anywhere, so pages are not read ahead, except for the code
+   following the starting PC, which is read ahead now. Large images ask
+   for huge pages. Advice is only a hint, so failures are ignored. */
+void imageAdvise(uint8_t *map, uint64_t size, uint64_t start)
+{
+  uint64_t codeStart = start & ~(uint64_t)(IMAGE_PAGE_SIZE - 1);
+  uint64_t codeEnd;
+
+  madvise(map, size, MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+  if (size >= IMAGE_HUGE_THRESHOLD)
+    madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+  if (codeStart >= size)
+    return;
+  codeEnd = size - codeStart < IMAGE_CODE_WINDOW ? size :
+    codeStart + IMAGE_CODE_WINDOW;
+  madvise(map + codeStart, codeEnd - codeStart, MADV_SEQUENTIAL);
+  madvise(map + codeStart, codeEnd - codeStart, MADV_WILLNEED);
+}
+
+/* Faults in the pages of [start, start + length), start being on a
+   page boundary. */
+static void touchPages(image_prefault_t *prefault, uint64_t start,
+		       uint64_t length)
+{
+#ifdef MADV_POPULATE_READ
+  if (madvise(prefault->map + start, length, MADV_POPULATE_READ) == 0)
+  {
+    prefault->pages += (length + IMAGE_PAGE_SIZE - 1) / IMAGE_PAGE_SIZE;
+    return;
+  }
+#endif
+  for (uint64_t page = start; page < start + length; page += IMAGE_PAGE_SIZE)
+  {
+    (void)*(volatile uint8_t *)(prefault->map + page);
+    prefault->pages++;
+  }
+}
+
+/* Walks the extents of data in the file, a chunk at a time, until the
+   end or until asked to stop. */
+static void *prefaultPages(void *argument)
+{
+  image_prefault_t *prefault = argument;
+  uint64_t position = 0, hole;
+
+  while (position < prefault->size)
+  {
+    position = nextExtent(prefault->fd, position, prefault->size, &hole);
+    position &= ~(uint64_t)(IMAGE_PAGE_SIZE - 1);
+    for (; position < hole; position += IMAGE_PREFAULT_CHUNK)
+    {
+      if (__atomic_load_n(&prefault->stop, __ATOMIC_RELAXED))
+	return NULL;
+      touchPages(prefault, position, hole - position < IMAGE_PREFAULT_CHUNK ?
+		 hole - position : IMAGE_PREFAULT_CHUNK);
+    }
+    position = hole;
+  }
+  return NULL;
+}
+
+/* Starts faulting in the pages of the image mapped from fd in the
+   background. The file must stay open, and the image mapped, until
+   imagePrefaultStop is called. Returns 1 in case of success, or 0 with
+   errno set. */
+int imagePrefaultStart(image_prefault_t *prefault, int fd, uint8_t *map,
+		       uint64_t size)
+{
+  int error;
+
+  memset(prefault, 0, sizeof(*prefault));
+  prefault->fd = fd;
+  prefault->map = map;
+  prefault->size = size;
+
+  error = pthread_create(&prefault->thread, NULL, prefaultPages, prefault);
+  if (error)
+  {
+    errno = error;
+    return 0;
+  }
+  prefault->running = 1;
+  return 1;
+}
+
+/* Stops the thread, if it is running, and returns the number of pages
+   it faulted in. */
+uint64_t imagePrefaultStop(image_prefault_t *prefault)
+{
+  if (!prefault->running)
+    return 0;
+
+  __atomic_store_n(&prefault->stop, 1, __ATOMIC_RELAXED);
+  pthread_join(prefault->thread, NULL);
+  prefault->running = 0;
+  return prefault->pages;
+}
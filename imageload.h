@@ -0,0 +1,38 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in imageload.c
+*/
+
+#ifndef _IMAGELOAD_H_
+#define _IMAGELOAD_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define IMAGE_PAGE_SIZE      4096
+#define IMAGE_CODE_WINDOW    (2 << 20) // read ahead from the starting PC
+#define IMAGE_HUGE_THRESHOLD (64 << 20) // huge pages for larger images
+#define IMAGE_PREFAULT_CHUNK (2 << 20)
+
+/* A thread faulting in the pages of an image holding data, in the
+   background, so the guest does not wait on them later. */
+typedef struct image_prefault {
+
+  pthread_t thread;
+  int       running;
+  int       stop;
+
+  int       fd;
+  uint8_t  *map;
+  uint64_t  size;
+  uint64_t  pages;
+} image_prefault_t;
+
+uint64_t imageFirstData(int fd, const uint8_t *map, uint64_t size,
+			uint64_t start);
+void imageAdvise(uint8_t *map, uint64_t size, uint64_t start);
+
+int imagePrefaultStart(image_prefault_t *prefault, int fd, uint8_t *map,
+		       uint64_t size);
+uint64_t imagePrefaultStop(image_prefault_t *prefault);
+
+#endif /* IMAGELOAD */
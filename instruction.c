@@ -6,6 +6,12 @@
 
 #include "instruction.h"
 #include "printRoutines.h"
+#include "history.h"
+#include "decode.h"
+#include "dirty.h"
+#include "heatmap.h"
+#include "ranges.h"
+#include "fusion.h"
 
 int isValidAddress(uint64_t address, uint64_t max)
 {
@@ -81,11 +87,28 @@ int memWriteQuadLE(machine_state_t *state, uint64_t address, uint64_t value)
   return 0;
 }
 
+/* Returns the number of bytes taken by an instruction with the
+   specified icode (opcode byte, register byte and valC), or 0 if the
+   icode is not a valid instruction. */
+int instructionLength(y86_icode_t icode)
+{
+  return icode < 16 ? decodeTable[icode << 4].length : 0;
+}
+
+/* Marks the instruction as invalid. Always returns 0. */
+static int invalidInstruction(y86_instruction_t *instr)
+{
+  instr->icode = I_INVALID;
+  instr->ifun = 0x0;
+  return 0;
+}
+
 /* Fetches one instruction from memory, at the address specified by
    the program counter. Does not modify the machine's state. The
    resulting instruction is stored in *instr. Returns 1 if the
    instruction is a valid non-halt instruction, or 0 (zero)
-   otherwise. */
+   otherwise. Decoding is driven by the tables in decode.h, indexed
+   by the first byte of the instruction. */
 int fetchInstruction(machine_state_t *state, y86_instruction_t *instr)
 {
   uint64_t pc = state->programCounter;
@@ -96,129 +119,90 @@ int fetchInstruction(machine_state_t *state, y86_instruction_t *instr)
     return 0;
   }
 
-  // parse the first byte to iCode and iFun
-  uint8_t iCode = firstByte & 0xf0;
-  iCode = iCode >> 4;
-
-  uint8_t iFun = firstByte & 0xf;
+  const decode_entry_t *entry = &decodeTable[firstByte];
 
-  // set instruction's icode and ifun
-  instr->icode = iCode;
-  instr->ifun = iFun;
+  // parse the first byte to iCode and iFun
+  instr->icode = firstByte >> 4;
+  instr->ifun = firstByte & 0xf;
 
   instr->rA = R_NONE;
   instr->rB = R_NONE;
 
   instr->location = pc;
-  if (iCode >= I_HALT && iCode <= I_POPQ) // checks if icode is valid
+  if (!entry->valid)
+    return invalidInstruction(instr);
+
+  //Set registers
+  if (entry->hasRegisters)
   {
-    if (iCode == I_IRMOVQ || iCode == I_OPQ || iCode == I_JXX) // ifun error handling
+    uint8_t secondByte;
+    instr->valP = pc + 1;
+    if (!(memReadByte(state, pc + 1, &secondByte)))
     {
-      if (!(iFun >= C_NC && iFun <= C_G)) // checking for conditional ifun cases
-      {
-        instr->icode = I_INVALID;
-        instr->ifun = 0x0;
-        return 0;
-      }
-    }
-    else if (iFun != C_NC) // otherwise
-    {
-      instr->icode = I_INVALID;
-      instr->ifun = 0x0;
+      instr->icode = I_TOO_SHORT;
       return 0;
     }
+    if (!registerByteValid[instr->icode][secondByte])
+      return invalidInstruction(instr);
+
+    instr->rA = secondByte >> 4;
+    instr->rB = secondByte & 0xf;
+  }
 
-    if (iCode != I_HALT) // increments valp only if not halt
+  //Set ValC
+  if (entry->hasValC)
+  {
+    uint64_t valC;
+    instr->valP = pc + 1 + entry->hasRegisters;
+
+    // checking memory out of bounds error
+    if (!(memReadQuadLE(state, instr->valP, &valC)))
     {
-      instr->valP = pc + 1;
+      instr->icode = I_TOO_SHORT;
+      return 0;
     }
-
-    //Set registers
-    if ((iCode >= I_RRMVXX && iCode <= I_OPQ) || iCode >= I_PUSHQ)
+    if ((entry->checkTarget && !isValidAddress(valC, state->programSize)) ||
+        (entry->checkDisplacement &&
+         !isValidAddress(valC + instr->rB, state->programSize)))
     {
-
-      uint8_t secondByte;
-      if (!(memReadByte(state, instr->valP, &secondByte)))
-      {
-        instr->icode = I_TOO_SHORT;
-        return 0;
-      }
-
-      uint8_t rA = secondByte & 0xf0;
-      rA = rA >> 4;
-      uint8_t rB = secondByte & 0xf;
-
-      // register value error handling
-      if (iCode >= I_RRMVXX && iCode <= I_OPQ) // all icodes that need rB
-      {
-        if (rB == 0xf) // checks for invalid values in rB
-        {
-          instr->icode = I_INVALID;
-          instr->ifun = 0x0;
-          return 0;
-        }
-        if (iCode == I_IRMOVQ) // checks for R_NONE in rA for irmovq
-        {
-          if (rA != 0xf)
-          {
-            instr->icode = I_INVALID;
-            instr->ifun = 0x0;
-            return 0;
-          }
-        }
-        else if (rA == 0xf) // checks invalid values in rA for all other instructions
-        {
-          instr->icode = I_INVALID;
-          instr->ifun = 0x0;
-          return 0;
-        }
-      }
-
-      instr->rA = rA;
-      instr->rB = rB;
-      (instr->valP)++;
+      instr->icode = I_INVALID;
+      return 0;
     }
 
-    //Set ValC
-    if ((iCode >= I_IRMOVQ && iCode <= I_MRMOVQ) || iCode == I_JXX || iCode == I_CALL) // get all icodes that have valc
-    {
-      uint64_t valC;
+    // set instruction's valC
+    instr->valC = valC;
+  }
 
-      // checking memory out of bounds error
-      if (!(memReadQuadLE(state, instr->valP, &valC)))
-      {
-        instr->icode = I_TOO_SHORT;
-        return 0;
-      }
-      if (iCode >= I_JXX)
-      {
-        if (!isValidAddress(valC, state->programSize))
-        {
-          instr->icode = I_INVALID;
-          return 0;
-        }
-      }
-      if (iCode >= I_RMMOVQ)
-      {
-        if (!isValidAddress(valC + instr->rB, state->programSize))
-        {
-          instr->icode = I_INVALID;
-          return 0;
-        }
-      }
+  // set instruction's valP; halt does not advance
+  instr->valP = pc + entry->advance;
+  return 1;
+}
 
-      // set instruction's valC
-      instr->valC = valC;
-      // set instruction's valP
-      (instr->valP) += 8;
-    }
-    return 1;
-  }
+/* Stores one byte of guest memory on behalf of an instruction, letting
+   the execution history and the dirty page trackers save the previous
+   contents first. */
+static inline void storeByte(machine_state_t *state, uint64_t address,
+			     uint8_t value)
+{
+  if (state->history)
+    historyRecordWrite(state->history, state, address);
+  if (state->trackers)
+    dirtyRecordWrite(state, address);
+  if (state->heatmap)
+    heatmapRecordWrite(state->heatmap, address);
+  if (state->watches)
+    rangeRecordWrite(state->watches, address);
+  if (state->fusion)
+    fusionRecordStore(state->fusion, address);
+  state->programMap[address] = value;
+}
 
-  // if icode is invalid
-  instr->icode = I_INVALID;
-  instr->ifun = 0x0;
-  return 0;
+/* Loads one byte of guest memory on behalf of an instruction. */
+static inline uint8_t loadByte(machine_state_t *state, uint64_t address)
+{
+  if (state->heatmap)
+    heatmapRecordRead(state->heatmap, address);
+  return state->programMap[address];
 }
 
 /* Sets the condition codes based on dest (valE). */
@@ -232,6 +216,75 @@ uint8_t setCC(uint64_t dest)
   return cc;
 }
 
+/* Returns the memory address an instruction accesses, if it does,
+   with store set if it writes there. */
+int memoryAccess(const y86_instruction_t *instr,
+		 const machine_state_t *state, uint64_t *address, int *store)
+{
+  const uint64_t *registers = state->registerFile;
+
+  switch (instr->icode)
+  {
+  case I_RMMOVQ:
+  case I_MRMOVQ:
+    *address = instr->valC + registers[instr->rB];
+    *store = instr->icode == I_RMMOVQ;
+    return 1;
+  case I_CALL:
+  case I_PUSHQ:
+    *address = registers[R_RSP] - 8;
+    *store = 1;
+    return 1;
+  case I_RET:
+  case I_POPQ:
+    *address = registers[R_RSP];
+    *store = 0;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Returns 1 if executing the instruction would reach memory at or
+   past limit, or divide by zero, either of which would fault on the
+   host rather than in the guest. */
+int instructionFaults(const y86_instruction_t *instr,
+		      const machine_state_t *state, uint64_t limit)
+{
+  uint64_t address;
+  int store;
+
+  return (memoryAccess(instr, state, &address, &store) && address >= limit) ||
+    (instr->icode == I_OPQ &&
+     (instr->ifun == A_DIVQ || instr->ifun == A_MODQ) &&
+     state->registerFile[instr->rA] == 0);
+}
+
+/* Returns 1 if the condition of a jXX or cmovXX (its ifun) holds for
+   the condition codes, as executeInstruction tests it, 0 otherwise. */
+int conditionHolds(uint8_t ifun, uint8_t cc)
+{
+  switch (ifun)
+  {
+  case C_NC:
+    return 1;
+  case C_LE:
+    return (cc & 0x3) != 0;
+  case C_L:
+    return (cc & 0x2) == 2;
+  case C_E:
+    return (cc & 0x1) == 1;
+  case C_NE:
+    return (cc & 0x1) == 0;
+  case C_GE:
+    return (cc & 0x2) == 0;
+  case C_G:
+    return (cc & 0x3) == 0;
+  default:
+    return 0;
+  }
+}
+
 /* Executes the instruction specified by *instr, modifying the
    machine's state (memory, registers, condition codes, program
    counter) in the process. Returns 1 if the instruction was executed
@@ -246,7 +299,6 @@ int executeInstruction(machine_state_t *state, y86_instruction_t *instr)
   uint64_t valC = instr->valC;
   uint64_t valP = instr->valP;
 
-  uint8_t *mem = state->programMap;
   uint8_t cc = state->conditionCodes;
 
   state->programCounter = instr->valP;
@@ -288,10 +340,10 @@ int executeInstruction(machine_state_t *state, y86_instruction_t *instr)
     state->registerFile[rB] = valC;
     break;
   case I_RMMOVQ:
-    mem[valC + state->registerFile[rB]] = state->registerFile[rA];
+    storeByte(state, valC + state->registerFile[rB], state->registerFile[rA]);
     break;
   case I_MRMOVQ:
-    state->registerFile[rA] = mem[valC + state->registerFile[rB]];
+    state->registerFile[rA] = loadByte(state, valC + state->registerFile[rB]);
     break;
   case I_OPQ:
     switch (iFun)
@@ -353,20 +405,20 @@ int executeInstruction(machine_state_t *state, y86_instruction_t *instr)
     }
     break;
   case I_CALL:
-    mem[state->registerFile[R_RSP] - 8] = valP;
+    storeByte(state, state->registerFile[R_RSP] - 8, valP);
     state->registerFile[R_RSP] -= 8;
     valP = valC;
     break;
   case I_RET:
-    valP = mem[state->registerFile[R_RSP]];
+    valP = loadByte(state, state->registerFile[R_RSP]);
     state->registerFile[R_RSP] += 8;
     break;
   case I_PUSHQ:
-    mem[state->registerFile[R_RSP] - 8] = state->registerFile[rA];
+    storeByte(state, state->registerFile[R_RSP] - 8, state->registerFile[rA]);
     state->registerFile[R_RSP] -= 8;
     break;
   case I_POPQ:
-    state->registerFile[rA] = mem[state->registerFile[R_RSP]];
+    state->registerFile[rA] = loadByte(state, state->registerFile[R_RSP]);
     state->registerFile[R_RSP] += 8;
     break;
   case I_INVALID:
@@ -380,5 +432,6 @@ int executeInstruction(machine_state_t *state, y86_instruction_t *instr)
   // UPDATE MACHINE STATE
   state->programCounter = valP;
   state->conditionCodes = cc;
+  state->instructionCount++;
   return 1;
 }
@@ -81,6 +81,12 @@ typedef struct instruction {
 #define CC_CARRY_MASK    0x4
 #define CC_OVERFLOW_MASK 0x8
 
+struct history;
+struct dirty_tracker;
+struct heatmap;
+struct range_set;
+struct fusion_cache;
+
 typedef struct machine_state {
   
   uint8_t *programMap;
@@ -91,11 +97,35 @@ typedef struct machine_state {
   uint64_t registerFile[16];
 
   uint8_t conditionCodes;
+
+  uint64_t instructionCount;
+
+  // write journal used to rewind execution, if enabled
+  struct history *history;
+
+  // trackers of the memory pages written, if any
+  struct dirty_tracker *trackers;
+
+  // counters of the guest memory accesses, if enabled
+  struct heatmap *heatmap;
+
+  // ranges whose writes stop execution, if any
+  struct range_set *watches;
+
+  // decoded and fused instructions dropped when written, if attached
+  struct fusion_cache *fusion;
   
 } machine_state_t;
 
+int instructionLength(y86_icode_t icode);
 int fetchInstruction(machine_state_t *state, y86_instruction_t *instr);
 int executeInstruction(machine_state_t *state, y86_instruction_t *instr);
+uint8_t setCC(uint64_t dest);
+int conditionHolds(uint8_t ifun, uint8_t cc);
+int memoryAccess(const y86_instruction_t *instr,
+		 const machine_state_t *state, uint64_t *address, int *store);
+int instructionFaults(const y86_instruction_t *instr,
+		      const machine_state_t *state, uint64_t limit);
 
 int memReadByte(machine_state_t *state,	uint64_t address, uint8_t *value);
 int memReadQuadLE(machine_state_t *state, uint64_t address, uint64_t *value);
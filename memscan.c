@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "memscan.h"
+
+/* On x86-64, SSE2 is always available; AVX2 is used when the host
+   supports it, checked at run time. Other hosts use the scalar loops. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MEMSCAN_X86 1
+#endif
+
+/* Bytes formatted at a time by memFormatDump, a multiple of the line
+   size, small enough for the encoded copies to stay in cache. */
+#define MEMSCAN_CHUNK 4096
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static void hexEncodeScalar(char *out, const uint8_t *in, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    out[2 * i] = hexDigits[in[i] >> 4];
+    out[2 * i + 1] = hexDigits[in[i] & 0xf];
+  }
+}
+
+static void asciiEncodeScalar(char *out, const uint8_t *in, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+    out[i] = in[i] >= 0x20 && in[i] < 0x7f ? in[i] : '.';
+}
+
+/* Returns the offset of the first match at or after start, or length
+   if there is none. */
+static size_t findScalar(const uint8_t *data, size_t length,
+			 const uint8_t *pattern, size_t patternLength,
+			 size_t start)
+{
+  for (size_t i = start; i + patternLength <= length; i++)
+    if (data[i] == pattern[0] &&
+	memcmp(data + i, pattern, patternLength) == 0)
+      return i;
+  return length;
+}
+
+#ifdef MEMSCAN_X86
+
+/* Turns bytes holding 0 to 15 into the matching hex digits. */
+static inline __m128i hexDigitsSSE2(__m128i nibbles)
+{
+  __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+				  _mm_set1_epi8('a' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/* Each vector encodes 16 bytes; returns the number of bytes encoded. */
+static size_t hexEncodeSSE2(char *out, const uint8_t *in, size_t length)
+{
+  const __m128i mask = _mm_set1_epi8(0xf);
+  size_t i;
+
+  for (i = 0; i + 16 <= length; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    __m128i low = _mm_and_si128(bytes, mask);
+
+    _mm_storeu_si128((__m128i *)(out + 2 * i),
+		     hexDigitsSSE2(_mm_unpacklo_epi8(high, low)));
+    _mm_storeu_si128((__m128i *)(out + 2 * i + 16),
+		     hexDigitsSSE2(_mm_unpackhi_epi8(high, low)));
+  }
+  return i;
+}
+
+static size_t asciiEncodeSSE2(char *out, const uint8_t *in, size_t length)
+{
+  size_t i;
+
+  for (i = 0; i + 16 <= length; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(in + i));
+    // Bytes from 0x80 up are negative, so they fail the first test.
+    __m128i printable =
+      _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+		    _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+
+    _mm_storeu_si128((__m128i *)(out + i),
+		     _mm_or_si128(_mm_and_si128(printable, bytes),
+				  _mm_andnot_si128(printable,
+						   _mm_set1_epi8('.'))));
+  }
+  return i;
+}
+
+/* Compares the first and last byte of the pattern at 16 positions at
+   once, and only checks the whole pattern where both match. */
+static size_t findSSE2(const uint8_t *data, size_t length,
+		       const uint8_t *pattern, size_t patternLength)
+{
+  const __m128i first = _mm_set1_epi8(pattern[0]);
+  const __m128i last = _mm_set1_epi8(pattern[patternLength - 1]);
+  size_t i;
+
+  for (i = 0; i + patternLength - 1 + 16 <= length; i += 16)
+  {
+    __m128i head = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i tail = _mm_loadu_si128((const __m128i *)
+				   (data + i + patternLength - 1));
+    unsigned matches = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+
+    for (; matches; matches &= matches - 1)
+    {
+      size_t candidate = i + __builtin_ctz(matches);
+      if (memcmp(data + candidate + 1, pattern + 1, patternLength - 2) == 0)
+	return candidate;
+    }
+  }
+  return findScalar(data, length, pattern, patternLength, i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hexDigitsAVX2(__m256i nibbles)
+{
+  __m256i letters =
+    _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)),
+		     _mm256_set1_epi8('a' - '0' - 10));
+  return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')),
+			 letters);
+}
+
+/* Each vector encodes 32 bytes. The unpacks work within each 128-bit
+   lane, so the lanes are put back in order before storing. */
+__attribute__((target("avx2")))
+static size_t hexEncodeAVX2(char *out, const uint8_t *in, size_t length)
+{
+  const __m256i mask = _mm256_set1_epi8(0xf);
+  size_t i;
+
+  for (i = 0; i + 32 <= length; i += 32)
+  {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask);
+    __m256i low = _mm256_and_si256(bytes, mask);
+    __m256i first = hexDigitsAVX2(_mm256_unpacklo_epi8(high, low));
+    __m256i second = hexDigitsAVX2(_mm256_unpackhi_epi8(high, low));
+
+    _mm256_storeu_si256((__m256i *)(out + 2 * i),
+			_mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 2 * i + 32),
+			_mm256_permute2x128_si256(first, second, 0x31));
+  }
+  return i + hexEncodeSSE2(out + 2 * i, in + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t asciiEncodeAVX2(char *out, const uint8_t *in, size_t length)
+{
+  size_t i;
+
+  for (i = 0; i + 32 <= length; i += 32)
+  {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i printable =
+      _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x1f)),
+		       _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), bytes));
+
+    _mm256_storeu_si256((__m256i *)(out + i),
+			_mm256_blendv_epi8(_mm256_set1_epi8('.'), bytes,
+					   printable));
+  }
+  return i + asciiEncodeSSE2(out + i, in + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t findAVX2(const uint8_t *data, size_t length,
+		       const uint8_t *pattern, size_t patternLength)
+{
+  const __m256i first = _mm256_set1_epi8(pattern[0]);
+  const __m256i last = _mm256_set1_epi8(pattern[patternLength - 1]);
+  size_t i;
+
+  for (i = 0; i + patternLength - 1 + 32 <= length; i += 32)
+  {
+    __m256i head = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i tail = _mm256_loadu_si256((const __m256i *)
+				      (data + i + patternLength - 1));
+    unsigned matches = _mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(head, first),
+		       _mm256_cmpeq_epi8(tail, last)));
+
+    for (; matches; matches &= matches - 1)
+    {
+      size_t candidate = i + __builtin_ctz(matches);
+      if (memcmp(data + candidate + 1, pattern + 1, patternLength - 2) == 0)
+	return candidate;
+    }
+  }
+  return findScalar(data, length, pattern, patternLength, i);
+}
+
+static int haveAVX2(void)
+{
+  static int supported = -1;
+
+  if (supported < 0)
+    supported = __builtin_cpu_supports("avx2") != 0;
+  return supported;
+}
+
+#endif
+
+static void hexEncode(char *out, const uint8_t *in, size_t length)
+{
+  size_t done = 0;
+
+#ifdef MEMSCAN_X86
+  done = haveAVX2() ? hexEncodeAVX2(out, in, length) :
+    hexEncodeSSE2(out, in, length);
+#endif
+  hexEncodeScalar(out + 2 * done, in + done, length - done);
+}
+
+static void asciiEncode(char *out, const uint8_t *in, size_t length)
+{
+  size_t done = 0;
+
+#ifdef MEMSCAN_X86
+  done = haveAVX2() ? asciiEncodeAVX2(out, in, length) :
+    asciiEncodeSSE2(out, in, length);
+#endif
+  asciiEncodeScalar(out + done, in + done, length - done);
+}
+
+/* Returns the offset of the first occurrence of the pattern in the
+   data, or length if it does not occur. */
+size_t memFind(const uint8_t *data, size_t length,
+	       const uint8_t *pattern, size_t patternLength)
+{
+  const uint8_t *found;
+
+  if (patternLength == 0 || patternLength > length)
+    return length;
+
+  if (patternLength == 1)
+  {
+    found = memchr(data, pattern[0], length);
+    return found ? (size_t)(found - data) : length;
+  }
+
+#ifdef MEMSCAN_X86
+  if (haveAVX2())
+    return findAVX2(data, length, pattern, patternLength);
+  return findSSE2(data, length, pattern, patternLength);
+#else
+  return findScalar(data, length, pattern, patternLength, 0);
+#endif
+}
+
+/* Formats the data as a dump, MEMSCAN_LINE_BYTES per line, the first
+   byte being at the given guest address. The output buffer must hold
+   MEMSCAN_LINE_LENGTH characters per line; it is not null-terminated.
+   Returns the number of characters written. */
+size_t memFormatDump(char *out, const uint8_t *data, size_t length,
+		     uint64_t address)
+{
+  char hex[2 * MEMSCAN_CHUNK], ascii[MEMSCAN_CHUNK];
+  char *next = out;
+
+  for (size_t chunk = 0; chunk < length; chunk += MEMSCAN_CHUNK)
+  {
+    size_t size = length - chunk < MEMSCAN_CHUNK ? length - chunk :
+      MEMSCAN_CHUNK;
+
+    hexEncode(hex, data + chunk, size);
+    asciiEncode(ascii, data + chunk, size);
+
+    for (size_t line = 0; line < size; line += MEMSCAN_LINE_BYTES)
+    {
+      size_t count = size - line < MEMSCAN_LINE_BYTES ? size - line :
+	MEMSCAN_LINE_BYTES;
+      uint64_t lineAddress = address + chunk + line;
+
+      memcpy(next, "    # 0x", 8);
+      next += 8;
+      for (int shift = 60; shift >= 0; shift -= 4)
+	*next++ = hexDigits[(lineAddress >> shift) & 0xf];
+      *next++ = ' ';
+      *next++ = ' ';
+
+      for (size_t i = 0; i < MEMSCAN_LINE_BYTES; i++)
+      {
+	if (i < count)
+	  memcpy(next, hex + 2 * (line + i), 2);
+	else
+	  memcpy(next, "  ", 2);
+	next[2] = ' ';
+	next += 3;
+	if (i == MEMSCAN_LINE_BYTES / 2 - 1)
+	  *next++ = ' ';
+      }
+
+      *next++ = '|';
+      memcpy(next, ascii + line, count);
+      next += count;
+      *next++ = '|';
+      *next++ = '\n';
+    }
+  }
+  return next - out;
+}
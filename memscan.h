@@ -0,0 +1,23 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in memscan.c
+*/
+
+#ifndef _MEMSCAN_H_
+#define _MEMSCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes shown on each line of a dump, and the length of a full line:
+   "    # 0x" and the address, then each byte in hex (with an extra
+   space in the middle), then the bytes as ASCII between bars. */
+#define MEMSCAN_LINE_BYTES  16
+#define MEMSCAN_LINE_LENGTH (6 + 18 + 2 + 3 * MEMSCAN_LINE_BYTES + 1 + \
+			     MEMSCAN_LINE_BYTES + 3)
+
+size_t memFind(const uint8_t *data, size_t length,
+	       const uint8_t *pattern, size_t patternLength);
+size_t memFormatDump(char *out, const uint8_t *data, size_t length,
+		     uint64_t address);
+
+#endif /* MEMSCAN */
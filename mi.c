@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mi.h"
+#include "printRoutines.h"
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static uint64_t monotonicTime(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Writes the text as a JSON string. */
+static void writeString(FILE *out, const char *text, size_t length)
+{
+  putc('"', out);
+  for (size_t i = 0; i < length; i++)
+  {
+    unsigned char c = text[i];
+
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c == '\n')
+      fputs("\\n", out);
+    else if (c == '\t')
+      fputs("\\t", out);
+    else if (c < 0x20 || c >= 0x7f)
+      fprintf(out, "\\u%04x", c);
+    else
+      putc(c, out);
+  }
+  putc('"', out);
+}
+
+/* Writes the instruction as printInstruction shows it, without the
+   comment and the indentation. */
+static void writeInstruction(FILE *out, y86_instruction_t *instr)
+{
+  char text[256] = "";
+  FILE *file = fmemopen(text, sizeof(text) - 1, "w");
+  char *start = text, *end;
+
+  if (file)
+  {
+    printInstruction(file, instr);
+    fclose(file);
+  }
+  end = strchr(text, '#');
+  if (!end)
+    end = text + strlen(text);
+  while (isspace((unsigned char)*start) && start < end)
+    start++;
+  while (end > start && isspace((unsigned char)end[-1]))
+    end--;
+  writeString(out, start, end - start);
+}
+
+static void writeConditionCodes(FILE *out, uint8_t cc)
+{
+  fprintf(out, "{\"zf\":%d,\"sf\":%d,\"of\":%d}", (cc & CC_ZERO_MASK) != 0,
+	  (cc & CC_SIGN_MASK) != 0, (cc & CC_OVERFLOW_MASK) != 0);
+}
+
+static void writeRegister(FILE *out, y86_register_t reg, uint64_t value)
+{
+  putc('"', out);
+  printRegisterName(out, reg);
+  fprintf(out, "\":\"0x%lx\"", value);
+}
+
+/* Sends standard output to the real one as records from now on, and
+   captures everything else written to it. Returns 1 in case of
+   success, or 0 with errno set. */
+int miInit(mi_channel_t *mi)
+{
+  memset(mi, 0, sizeof(*mi));
+  mi->console = -1;
+
+  fflush(stdout);
+  mi->savedStdout = dup(STDOUT_FILENO);
+  if (mi->savedStdout < 0)
+    return 0;
+  mi->out = fdopen(mi->savedStdout, "w");
+  mi->console = memfd_create("mi-console", 0);
+  if (!mi->out || mi->console < 0 || dup2(mi->console, STDOUT_FILENO) < 0)
+  {
+    if (mi->out)
+      fclose(mi->out);
+    else
+      close(mi->savedStdout);
+    if (mi->console >= 0)
+      close(mi->console);
+    mi->out = NULL;
+    return 0;
+  }
+  setvbuf(mi->out, NULL, _IOFBF, MI_BUFFER_SIZE);
+  return 1;
+}
+
+/* Sends what is left of the console, and gives standard output back. */
+void miFree(mi_channel_t *mi)
+{
+  if (!mi->out)
+    return;
+
+  miFlushConsole(mi);
+  if (mi->pendingLength)
+  {
+    fputs("{\"type\":\"console\",\"text\":", mi->out);
+    writeString(mi->out, mi->pending, mi->pendingLength);
+    fputs("}\n", mi->out);
+  }
+  fflush(mi->out);
+  dup2(mi->savedStdout, STDOUT_FILENO);
+  fclose(mi->out);
+  close(mi->console);
+  free(mi->pending);
+  memset(mi, 0, sizeof(*mi));
+}
+
+/* Sends each complete line written to standard output since the last
+   call as a console record. A line not complete yet waits for the
+   rest of it. */
+void miFlushConsole(mi_channel_t *mi)
+{
+  off_t size;
+  char *text, *line, *end;
+
+  fflush(stdout);
+  size = lseek(mi->console, 0, SEEK_CUR);
+  if (size <= 0)
+    return;
+
+  text = realloc(mi->pending, mi->pendingLength + size);
+  if (!text)
+    return;
+  mi->pending = text;
+  if (pread(mi->console, text + mi->pendingLength, size, 0) != size)
+    return;
+  mi->pendingLength += size;
+  if (ftruncate(mi->console, 0) < 0 || lseek(mi->console, 0, SEEK_SET) < 0)
+    return;
+
+  for (line = text; (end = memchr(line, '\n', text + mi->pendingLength - line));
+       line = end + 1)
+  {
+    fputs("{\"type\":\"console\",\"text\":", mi->out);
+    writeString(mi->out, line, end - line);
+    fputs("}\n", mi->out);
+  }
+  mi->pendingLength -= line - text;
+  memmove(text, line, mi->pendingLength);
+}
+
+/* Reads a JSON string at *text into out (at most size bytes with the
+   terminator), moving *text past it. Only the escapes of ASCII
+   characters are accepted. Returns 1 in case of success, 0 otherwise. */
+static int parseString(char **text, char *out, size_t size)
+{
+  char *p = *text;
+  size_t length = 0;
+
+  if (*p++ != '"')
+    return 0;
+  for (; *p && *p != '"'; p++)
+  {
+    char c = *p;
+
+    if (c == '\\')
+    {
+      switch (*++p)
+      {
+      case 'n':  c = '\n'; break;
+      case 't':  c = '\t'; break;
+      case 'r':  c = '\r'; break;
+      case '"':  c = '"'; break;
+      case '\\': c = '\\'; break;
+      case '/':  c = '/'; break;
+      case 'u':
+	{
+	  char digits[5] = "";
+	  char *end;
+	  unsigned long code;
+
+	  strncpy(digits, p + 1, 4);
+	  code = strtoul(digits, &end, 16);
+	  if (end != digits + 4 || code >= 0x80)
+	    return 0;
+	  c = code;
+	  p += 4;
+	  break;
+	}
+      default:
+	return 0;
+      }
+    }
+    if (length + 1 >= size)
+      return 0;
+    out[length++] = c;
+  }
+  if (*p != '"')
+    return 0;
+  out[length] = '\0';
+  *text = p + 1;
+  return 1;
+}
+
+static char *skipSpaces(char *text)
+{
+  while (isspace((unsigned char)*text))
+    text++;
+  return text;
+}
+
+static char *skipDigits(char *text)
+{
+  while (isdigit((unsigned char)*text))
+    text++;
+  return text;
+}
+
+/* Moves *text past a JSON number. Returns 1 in case of success, 0 if
+   there is none there. */
+static int parseNumber(char **text)
+{
+  char *p = *text;
+
+  if (*p == '-')
+    p++;
+  if (*p == '0')
+    p++;
+  else if (isdigit((unsigned char)*p))
+    p = skipDigits(p);
+  else
+    return 0;
+
+  if (*p == '.')
+  {
+    if (!isdigit((unsigned char)p[1]))
+      return 0;
+    p = skipDigits(p + 1);
+  }
+  if (*p == 'e' || *p == 'E')
+  {
+    p++;
+    if (*p == '+' || *p == '-')
+      p++;
+    if (!isdigit((unsigned char)*p))
+      return 0;
+    p = skipDigits(p);
+  }
+  *text = p;
+  return 1;
+}
+
+/* Reads a command sent as a JSON object, such as
+   {"id": 7, "command": "break", "args": "main"}, replacing the line of
+   size bytes with the command as typed ("break main"). The id, a
+   number or a string, is kept as it was written, to be sent back with
+   the result. Returns 1 if the line was such an object, 0 if it was
+   not JSON (and is left as it is), or -1 if it is not valid. */
+int miParseCommand(char *line, size_t size, char *id, size_t idSize)
+{
+  char command[size], args[size], key[32];
+  char *p = skipSpaces(line);
+
+  id[0] = command[0] = args[0] = '\0';
+  if (*p != '{')
+    return 0;
+
+  for (p = skipSpaces(p + 1); *p != '}'; )
+  {
+    if (!parseString(&p, key, sizeof(key)))
+      return -1;
+    p = skipSpaces(p);
+    if (*p++ != ':')
+      return -1;
+    p = skipSpaces(p);
+
+    if (strcmp(key, "command") == 0 || strcmp(key, "args") == 0)
+    {
+      if (!parseString(&p, key[0] == 'c' ? command : args, size))
+	return -1;
+    }
+    else if (strcmp(key, "id") == 0)
+    {
+      char *start = p;
+
+      if (*p == '"')
+      {
+	char value[idSize];
+	if (!parseString(&p, value, idSize))
+	  return -1;
+      }
+      else if (!parseNumber(&p))
+	return -1;
+      if ((size_t)(p - start) >= idSize)
+	return -1;
+      memcpy(id, start, p - start);
+      id[p - start] = '\0';
+    }
+    else
+      return -1;
+
+    p = skipSpaces(p);
+    if (*p == ',')
+      p = skipSpaces(p + 1);
+    else if (*p != '}')
+      return -1;
+  }
+  if (*skipSpaces(p + 1) || !command[0] || strchr(command, '\n') ||
+      strchr(args, '\n') || strlen(command) + strlen(args) + 3 > size)
+    return -1;
+
+  snprintf(line, size, "%s%s%s\n", command, args[0] ? " " : "", args);
+  return 1;
+}
+
+/* Tells that a command is done, with its id if it had one, and sends
+   the records batched while it ran. */
+void miResult(mi_channel_t *mi, const char *id, const char *command,
+	      const char *status, const char *message)
+{
+  miFlushConsole(mi);
+  fputs("{\"type\":\"result\"", mi->out);
+  if (id && id[0])
+    fprintf(mi->out, ",\"id\":%s", id);
+  if (command)
+  {
+    fputs(",\"command\":", mi->out);
+    writeString(mi->out, command, strlen(command));
+  }
+  fputs(",\"status\":", mi->out);
+  writeString(mi->out, status, strlen(status));
+  if (message)
+  {
+    fputs(",\"message\":", mi->out);
+    writeString(mi->out, message, strlen(message));
+  }
+  fputs("}\n", mi->out);
+  fflush(mi->out);
+}
+
+/* Tells where execution stopped and why, with the next instruction,
+   the condition codes, and the registers that changed since the last
+   stop event. */
+void miStop(mi_channel_t *mi, const char *reason, machine_state_t *state,
+	    y86_instruction_t *instr)
+{
+  const char *separator = "";
+
+  miFlushConsole(mi);
+  fputs("{\"type\":\"stop\",\"reason\":", mi->out);
+  writeString(mi->out, reason, strlen(reason));
+  fprintf(mi->out, ",\"pc\":\"0x%lx\",\"instructions\":%lu,\"instruction\":",
+	  state->programCounter, state->instructionCount);
+  writeInstruction(mi->out, instr);
+  fputs(",\"cc\":", mi->out);
+  writeConditionCodes(mi->out, state->conditionCodes);
+  fputs(",\"changed\":{", mi->out);
+  for (int reg = R_RAX; reg < R_NONE; reg++)
+    if (state->registerFile[reg] != mi->registerFile[reg])
+    {
+      fputs(separator, mi->out);
+      writeRegister(mi->out, reg, state->registerFile[reg]);
+      separator = ",";
+    }
+  fputs("}}\n", mi->out);
+
+  memcpy(mi->registerFile, state->registerFile, sizeof(mi->registerFile));
+  mi->conditionCodes = state->conditionCodes;
+}
+
+/* Sends every register, the condition codes and the PC. */
+void miRegisters(mi_channel_t *mi, machine_state_t *state)
+{
+  miFlushConsole(mi);
+  fprintf(mi->out, "{\"type\":\"registers\",\"pc\":\"0x%lx\","
+	  "\"instructions\":%lu,\"registers\":{", state->programCounter,
+	  state->instructionCount);
+  for (int reg = R_RAX; reg < R_NONE; reg++)
+  {
+    if (reg != R_RAX)
+      putc(',', mi->out);
+    writeRegister(mi->out, reg, state->registerFile[reg]);
+  }
+  fputs("},\"cc\":", mi->out);
+  writeConditionCodes(mi->out, state->conditionCodes);
+  fputs("}\n", mi->out);
+}
+
+/* Sends length bytes of memory from the address, in hex, cut short at
+   the end of memory. */
+void miMemory(mi_channel_t *mi, machine_state_t *state, uint64_t address,
+	      uint64_t length)
+{
+  uint64_t available = address >= state->programSize ? 0 :
+    state->programSize - address < length ? state->programSize - address :
+    length;
+
+  miFlushConsole(mi);
+  fprintf(mi->out, "{\"type\":\"memory\",\"address\":\"0x%lx\",\"length\":%lu,"
+	  "\"bytes\":\"", address, available);
+  for (uint64_t i = 0; i < available; i++)
+  {
+    uint8_t byte = state->programMap[address + i];
+    putc(hexDigits[byte >> 4], mi->out);
+    putc(hexDigits[byte & 0xf], mi->out);
+  }
+  fputs("\"}\n", mi->out);
+}
+
+/* Sends how far a run got, if the last progress event was long
+   enough ago, along with the records batched since. */
+void miProgress(mi_channel_t *mi, machine_state_t *state)
+{
+  uint64_t now = monotonicTime();
+
+  if (now - mi->lastProgress < MI_PROGRESS_INTERVAL)
+    return;
+  mi->lastProgress = now;
+
+  miFlushConsole(mi);
+  fprintf(mi->out, "{\"type\":\"progress\",\"pc\":\"0x%lx\","
+	  "\"instructions\":%lu}\n", state->programCounter,
+	  state->instructionCount);
+  fflush(mi->out);
+}
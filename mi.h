@@ -0,0 +1,59 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in mi.c
+*/
+
+#ifndef _MI_H_
+#define _MI_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define MI_BUFFER_SIZE       (64 * 1024)
+#define MI_PROGRESS_INTERVAL 100000000 // at most 10 progress events a second
+#define MI_TICK_INTERVAL     4096      // instructions between clock checks
+
+/* The machine interface: records written one JSON object per line to
+   the real standard output, buffered and flushed once per command and
+   per progress event. Everything else written to stdout while it is
+   active is captured and sent as console records. */
+typedef struct mi_channel {
+
+  FILE    *out;
+  int      savedStdout;
+  int      console;
+  char    *pending;      // console text not ending with a newline yet
+  size_t   pendingLength;
+
+  uint64_t ticks;
+  uint64_t lastProgress;
+
+  uint64_t registerFile[16]; // as of the last stop event
+  uint8_t  conditionCodes;
+} mi_channel_t;
+
+int miInit(mi_channel_t *mi);
+void miFree(mi_channel_t *mi);
+
+int miParseCommand(char *line, size_t size, char *id, size_t idSize);
+void miFlushConsole(mi_channel_t *mi);
+void miResult(mi_channel_t *mi, const char *id, const char *command,
+	      const char *status, const char *message);
+void miStop(mi_channel_t *mi, const char *reason, machine_state_t *state,
+	    y86_instruction_t *instr);
+void miRegisters(mi_channel_t *mi, machine_state_t *state);
+void miMemory(mi_channel_t *mi, machine_state_t *state, uint64_t address,
+	      uint64_t length);
+void miProgress(mi_channel_t *mi, machine_state_t *state);
+
+/* Counts an instruction executed during a run, sending a progress
+   event when one is due; the clock is only read every
+   MI_TICK_INTERVAL instructions. */
+static inline void miTick(mi_channel_t *mi, machine_state_t *state)
+{
+  if (++mi->ticks % MI_TICK_INTERVAL == 0)
+    miProgress(mi, state);
+}
+
+#endif /* MI */
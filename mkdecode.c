@@ -0,0 +1,87 @@
+/* Generates decodeTable.c, the tables used by fetchInstruction to
+   decode an instruction from its first byte. The tables are derived
+   from the enums in instruction.h, so they follow any change there.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+/* Returns 1 if the function code is valid for the instruction. */
+static int validFunction(int icode, int ifun)
+{
+  switch (icode)
+  {
+  case I_RRMVXX:
+  case I_JXX:
+    return ifun >= C_NC && ifun <= C_G;
+  case I_OPQ:
+    return ifun >= A_ADDQ && ifun <= A_MODQ;
+  default:
+    return icode >= I_HALT && icode <= I_POPQ && ifun == 0;
+  }
+}
+
+static int hasRegisters(int icode)
+{
+  return (icode >= I_RRMVXX && icode <= I_OPQ) ||
+    icode == I_PUSHQ || icode == I_POPQ;
+}
+
+static int hasValC(int icode)
+{
+  return (icode >= I_IRMOVQ && icode <= I_MRMOVQ) ||
+    icode == I_JXX || icode == I_CALL;
+}
+
+/* Returns 1 if the register byte is valid for the instruction: every
+   instruction using rB needs a register there, irmovq has no rA and
+   the others using rB need an rA. */
+static int validRegisters(int icode, int registers)
+{
+  int rA = registers >> 4, rB = registers & 0xf;
+
+  if (icode < I_RRMVXX || icode > I_OPQ)
+    return 1;
+  if (rB == R_NONE)
+    return 0;
+  if (icode == I_IRMOVQ)
+    return rA == R_NONE;
+  return rA != R_NONE;
+}
+
+int main(void)
+{
+
+  printf("/* Generated by mkdecode from instruction.h, do not edit. */\n\n");
+  printf("#include \"decode.h\"\n\n");
+
+  printf("const decode_entry_t decodeTable[256] = {\n");
+  for (int byte = 0; byte < 256; byte++)
+  {
+    int icode = byte >> 4, ifun = byte & 0xf;
+    int valid = validFunction(icode, ifun);
+    int length = valid ? 1 + hasRegisters(icode) + 8 * hasValC(icode) : 0;
+
+    printf("  [0x%02x] = { %d, %2d, %2d, %d, %d, %d, %d },\n", byte,
+	   valid, length, icode == I_HALT ? 0 : length,
+	   valid && hasRegisters(icode), valid && hasValC(icode),
+	   valid && (icode == I_JXX || icode == I_CALL),
+	   valid && hasValC(icode) && icode >= I_RMMOVQ);
+  }
+  printf("};\n\n");
+
+  printf("const uint8_t registerByteValid[16][256] = {\n");
+  for (int icode = 0; icode < 16; icode++)
+  {
+    printf("  [0x%x] = {", icode);
+    for (int registers = 0; registers < 256; registers++)
+      printf("%s%d,", registers % 32 ? " " : "\n    ",
+	     validRegisters(icode, registers));
+    printf("\n  },\n");
+  }
+  printf("};\n");
+
+  return 0;
+}
@@ -2,8 +2,10 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <string.h>
 
 #include "printRoutines.h"
+#include "memscan.h"
 
 static const char *instrName[256][256] = {
   [I_HALT]   = {"halt"},
@@ -60,6 +62,45 @@ static const char *regName[R_NONE] = {
   [R_R14] = "%r14"
 };
 
+/* Bytes of memory formatted at a time when dumping. */
+#define DUMP_CHUNK 4096
+
+/* Symbols used to annotate jump and call targets, if any. */
+static const symbol_table_t *symbols;
+
+void printSetSymbols(const symbol_table_t *table) {
+
+  symbols = table;
+}
+
+/* Finds the icode and ifun of the instruction with the given mnemonic
+   (not necessarily null-terminated). Returns 1 if found, 0 otherwise. */
+int parseInstructionName(const char *name, size_t length,
+			 y86_icode_t *icode, uint8_t *ifun) {
+
+  for (int i = I_HALT; i <= I_POPQ; i++)
+    for (int f = 0; f < 16; f++)
+      if (instrName[i][f] && strncmp(instrName[i][f], name, length) == 0 &&
+	  !instrName[i][f][length]) {
+	*icode = i;
+	*ifun = f;
+	return 1;
+      }
+  return 0;
+}
+
+/* Finds the register with the given name, such as %rax (not
+   necessarily null-terminated). Returns 1 if found, 0 otherwise. */
+int parseRegisterName(const char *name, size_t length, y86_register_t *reg) {
+
+  for (int r = R_RAX; r < R_NONE; r++)
+    if (strncmp(regName[r], name, length) == 0 && !regName[r][length]) {
+      *reg = r;
+      return 1;
+    }
+  return 0;
+}
+
 static inline int printRegister(FILE *file, y86_register_t reg) {
   
   assert(reg < R_NONE);
@@ -71,6 +112,23 @@ static inline int printValC(FILE *file, uint64_t val) {
   return fprintf(file, "0x%lx", val);
 } 
 
+static inline int printSymbol(FILE *file, uint64_t val) {
+
+  const symbol_t *symbol;
+  uint64_t offset;
+
+  if (!symbols || !(symbol = symbolLookupAddress(symbols, val, &offset)))
+    return 0;
+  if (offset)
+    return fprintf(file, " <%s+0x%lx>", symbol->name, offset);
+  return fprintf(file, " <%s>", symbol->name);
+}
+
+int printRegisterName(FILE *file, y86_register_t reg) {
+
+  return printRegister(file, reg);
+}
+
 int printErrorCommandTooLong(FILE *file) {
 
   return fprintf(file, "    # Command is too long, ignored.\n");
@@ -127,6 +185,7 @@ int printInstruction(FILE *file, y86_instruction_t *instr) {
   case I_CALL:
   case I_JXX:
     chars += printValC(file, instr->valC);
+    chars += printSymbol(file, instr->valC);
     break;
   case I_RMMOVQ:
     chars += printRegister(file, instr->rA);
@@ -170,6 +229,40 @@ int printRegisterValue(FILE *file, machine_state_t *state,
 		 state->registerFile[reg]);
 }
 
+int printRegisterChange(FILE *file, y86_register_t reg, uint64_t oldValue,
+			uint64_t newValue) {
+
+  assert(reg < R_NONE);
+  return fprintf(file, "    # R[%-4s] = 0x%lx -> 0x%lx\n", regName[reg],
+		 oldValue, newValue);
+}
+
+int printConditionCodes(FILE *file, uint8_t cc) {
+
+  return fprintf(file, "    # CC = ZF=%d SF=%d OF=%d\n",
+		 (cc & CC_ZERO_MASK) != 0, (cc & CC_SIGN_MASK) != 0,
+		 (cc & CC_OVERFLOW_MASK) != 0);
+}
+
+/* Prints only the flags that differ, as in "CC: ZF 0 -> 1". */
+int printConditionCodesChange(FILE *file, uint8_t oldValue, uint8_t newValue) {
+
+  static const struct { const char *name; uint8_t mask; } flags[] = {
+    {"ZF", CC_ZERO_MASK}, {"SF", CC_SIGN_MASK}, {"OF", CC_OVERFLOW_MASK}
+  };
+  const char *separator = " ";
+  int chars = fprintf(file, "    # CC:");
+
+  for (int i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+    if ((oldValue ^ newValue) & flags[i].mask) {
+      chars += fprintf(file, "%s%s %d -> %d", separator, flags[i].name,
+		       (oldValue & flags[i].mask) != 0,
+		       (newValue & flags[i].mask) != 0);
+      separator = ", ";
+    }
+  return chars + fprintf(file, "\n");
+}
+
 int printMemoryValueByte(FILE *file, machine_state_t *state, uint64_t addr) {
 
   uint8_t value;
@@ -187,3 +280,41 @@ int printMemoryValueQuad(FILE *file, machine_state_t *state, uint64_t addr) {
   else
     return printErrorInvalidMemoryLocation(file, NULL, addr);
 }
+
+int printMemoryChangeQuad(FILE *file, uint64_t addr, uint64_t oldValue,
+			  uint64_t newValue) {
+
+  return fprintf(file, "    # M_8[0x%lx] = 0x%lx -> 0x%lx\n", addr, oldValue,
+		 newValue);
+}
+
+/* Prints count bytes of memory from the address as hex and ASCII, a
+   chunk at a time. If the range goes past the end of memory, the valid
+   part is printed followed by an error. Returns the number of
+   characters printed. */
+uint64_t printMemoryDump(FILE *file, machine_state_t *state, uint64_t addr,
+			 uint64_t count) {
+
+  char buffer[DUMP_CHUNK / MEMSCAN_LINE_BYTES * MEMSCAN_LINE_LENGTH];
+  uint64_t valid = addr < state->programSize ? state->programSize - addr : 0;
+  uint64_t length = count < valid ? count : valid;
+  uint64_t chars = 0;
+
+  for (uint64_t done = 0; done < length; done += DUMP_CHUNK) {
+    size_t size = length - done < DUMP_CHUNK ? length - done : DUMP_CHUNK;
+    size = memFormatDump(buffer, state->programMap + addr + done, size,
+			 addr + done);
+    chars += fwrite(buffer, 1, size, file);
+  }
+
+  if (length < count)
+    chars += printErrorInvalidMemoryLocation(file, NULL, addr + length);
+  return chars;
+}
+
+int printMemoryMatch(FILE *file, uint64_t addr) {
+
+  int chars = fprintf(file, "    # Found at 0x%lx", addr);
+  chars += printSymbol(file, addr);
+  return chars + fprintf(file, "\n");
+}
@@ -8,13 +8,29 @@
 #include <stdio.h>
 
 #include "instruction.h"
+#include "symbols.h"
+
+void printSetSymbols(const symbol_table_t *table);
+int parseInstructionName(const char *name, size_t length,
+			 y86_icode_t *icode, uint8_t *ifun);
+int parseRegisterName(const char *name, size_t length, y86_register_t *reg);
 
 int printInstruction(FILE *file, y86_instruction_t *instr);
+int printRegisterName(FILE *file, y86_register_t reg);
 
 int printRegisterValue(FILE *file, machine_state_t *state,
 		       y86_register_t reg);
+int printRegisterChange(FILE *file, y86_register_t reg, uint64_t oldValue,
+			uint64_t newValue);
+int printConditionCodes(FILE *file, uint8_t cc);
+int printConditionCodesChange(FILE *file, uint8_t oldValue, uint8_t newValue);
 int printMemoryValueByte(FILE *file, machine_state_t *state, uint64_t addr);
 int printMemoryValueQuad(FILE *file, machine_state_t *state, uint64_t addr);
+int printMemoryChangeQuad(FILE *file, uint64_t addr, uint64_t oldValue,
+			  uint64_t newValue);
+uint64_t printMemoryDump(FILE *file, machine_state_t *state, uint64_t addr,
+			 uint64_t count);
+int printMemoryMatch(FILE *file, uint64_t addr);
 
 int printErrorCommandTooLong(FILE *file);
 int printErrorInvalidCommand(FILE *file, char *command, char *parameters);
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ranges.h"
+
+void rangeSetInit(range_set_t *set)
+{
+  memset(set, 0, sizeof(*set));
+}
+
+void rangeSetFree(range_set_t *set)
+{
+  free(set->ranges);
+  free(set->maxEnds);
+  free(set->filter);
+  memset(set, 0, sizeof(*set));
+}
+
+/* Computes the running largest ends and the filter again, after the
+   ranges changed. If the filter cannot be allocated every address
+   below the limit is looked up. */
+static void rebuildIndex(range_set_t *set)
+{
+  uint64_t maxEnd = 0;
+
+  for (uint64_t i = 0; i < set->count; i++)
+  {
+    if (set->ranges[i].end > maxEnd)
+      maxEnd = set->ranges[i].end;
+    set->maxEnds[i] = maxEnd;
+  }
+  set->limit = maxEnd;
+
+  free(set->filter);
+  set->filterBlocks = ((maxEnd < RANGE_FILTER_LIMIT ? maxEnd : RANGE_FILTER_LIMIT)
+		       + (1 << RANGE_FILTER_SHIFT) - 1) >> RANGE_FILTER_SHIFT;
+  set->filter = calloc(set->filterBlocks / 64 + 1, sizeof(uint64_t));
+  if (!set->filter)
+  {
+    set->filterBlocks = 0;
+    return;
+  }
+
+  for (uint64_t i = 0; i < set->count; i++)
+  {
+    uint64_t first = set->ranges[i].start >> RANGE_FILTER_SHIFT;
+    uint64_t last = (set->ranges[i].end - 1) >> RANGE_FILTER_SHIFT;
+
+    for (uint64_t block = first; block <= last && block < set->filterBlocks;
+	 block++)
+      set->filter[block >> 6] |= 1ULL << (block & 63);
+  }
+}
+
+/* Adds the range from start to end (excluded), unless it is already
+   in the set. Returns 1 if it was added, or 0 if it was already there
+   or memory could not be allocated. */
+int rangeAdd(range_set_t *set, uint64_t start, uint64_t end)
+{
+  uint64_t index = rangeUpperBound(set, start);
+
+  for (uint64_t i = index; i > 0 && set->ranges[i - 1].start == start; i--)
+    if (set->ranges[i - 1].end == end)
+      return 0;
+
+  if (set->count == set->capacity)
+  {
+    uint64_t capacity = set->capacity ? 2 * set->capacity : 8;
+    range_t *ranges = realloc(set->ranges, capacity * sizeof(range_t));
+    if (!ranges)
+      return 0;
+    set->ranges = ranges;
+    uint64_t *maxEnds = realloc(set->maxEnds, capacity * sizeof(uint64_t));
+    if (!maxEnds)
+      return 0;
+    set->maxEnds = maxEnds;
+    set->capacity = capacity;
+  }
+
+  memmove(&set->ranges[index + 1], &set->ranges[index],
+	  (set->count - index) * sizeof(range_t));
+  set->ranges[index].start = start;
+  set->ranges[index].end = end;
+  set->count++;
+  rebuildIndex(set);
+  return 1;
+}
+
+/* Deletes the range from start to end. Returns 1 if it was in the
+   set, 0 otherwise. */
+int rangeDelete(range_set_t *set, uint64_t start, uint64_t end)
+{
+  for (uint64_t i = rangeUpperBound(set, start);
+       i > 0 && set->ranges[i - 1].start == start; i--)
+    if (set->ranges[i - 1].end == end)
+    {
+      memmove(&set->ranges[i - 1], &set->ranges[i],
+	      (set->count - i) * sizeof(range_t));
+      set->count--;
+      rebuildIndex(set);
+      return 1;
+    }
+  return 0;
+}
+
+/* Returns a range containing the address, the one starting first, or
+   NULL if there is none. The largest end never decreases along the
+   ranges, so the first range whose largest end is past the address is
+   found by a binary search; that range itself ends past it, and it
+   starts at or before the address if it is before the upper bound. */
+const range_t *rangeSearch(const range_set_t *set, uint64_t address)
+{
+  uint64_t bound = rangeUpperBound(set, address), low = 0, high = bound;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (set->maxEnds[middle] <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low < bound ? &set->ranges[low] : NULL;
+}
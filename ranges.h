@@ -0,0 +1,99 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in ranges.c
+*/
+
+#ifndef _RANGES_H_
+#define _RANGES_H_
+
+#include <stdint.h>
+
+/* Each bit of the filter covers this many bytes of addresses. */
+#define RANGE_FILTER_SHIFT 8
+
+/* Addresses covered by the filter at most; past it, addresses below
+   the end of a range are looked up. */
+#define RANGE_FILTER_LIMIT (1ULL << 32)
+
+/* Addresses from start up to, but not including, end. */
+typedef struct range {
+
+  uint64_t start;
+  uint64_t end;
+} range_t;
+
+/* Ranges kept in an array sorted by start, which may overlap. maxEnds
+   holds the largest end up to each index, so a binary search on the
+   starts tells whether any range contains an address. The filter has
+   a bit set for every block of addresses touched by a range, so most
+   addresses outside every range are rejected with one bit test.
+
+   hit and hitAddress record the first write to a range, for ranges
+   watched through machine_state_t. */
+typedef struct range_set {
+
+  range_t  *ranges;
+  uint64_t *maxEnds;
+  uint64_t  count;
+  uint64_t  capacity;
+
+  uint64_t *filter;
+  uint64_t  filterBlocks;
+  uint64_t  limit;          // end of the last address in a range
+
+  int       hit;
+  uint64_t  hitAddress;
+} range_set_t;
+
+void rangeSetInit(range_set_t *set);
+void rangeSetFree(range_set_t *set);
+
+int rangeAdd(range_set_t *set, uint64_t start, uint64_t end);
+int rangeDelete(range_set_t *set, uint64_t start, uint64_t end);
+const range_t *rangeSearch(const range_set_t *set, uint64_t address);
+
+/* Returns the index of the first range starting after the address. */
+static inline uint64_t rangeUpperBound(const range_set_t *set,
+				       uint64_t address)
+{
+  uint64_t low = 0, high = set->count;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (set->ranges[middle].start <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+/* Returns 1 if a range of the set contains the address, 0 otherwise:
+   if one of the ranges starting at or before it ends past it. Called
+   on every instruction while there are ranges. */
+static inline int rangeContains(const range_set_t *set, uint64_t address)
+{
+  uint64_t block = address >> RANGE_FILTER_SHIFT;
+  uint64_t i;
+
+  if (address >= set->limit)
+    return 0;
+  if (block < set->filterBlocks &&
+      !(set->filter[block >> 6] & (1ULL << (block & 63))))
+    return 0;
+  i = rangeUpperBound(set, address);
+  return i > 0 && set->maxEnds[i - 1] > address;
+}
+
+/* Records the first write to an address inside a range. Called before
+   every guest store while ranges are watched. */
+static inline void rangeRecordWrite(range_set_t *set, uint64_t address)
+{
+  if (!set->hit && rangeContains(set, address))
+  {
+    set->hit = 1;
+    set->hitAddress = address;
+  }
+}
+
+#endif /* RANGES */
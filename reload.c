@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "reload.h"
+
+/* Maps the file again and compares it, page by page, with the image
+   loaded from fd. Pages whose contents did not change in the file keep
+   the contents of the guest memory, so data written by the guest
+   survives; changed pages take the new contents, and are recorded in
+   the trackers attached to the machine before being replaced. If the
+   file was rewritten in place its previous contents are lost (and the
+   pages the guest never wrote may already show the new ones), so the
+   pages the guest wrote are kept and every other page is taken as
+   changed.
+
+   On success, the machine's memory is the new image, fd its file,
+   and 1 is returned; result must then be freed with
+   reloadResultFree. On failure the machine is left untouched, and 0
+   is returned with errno set. */
+int reloadImage(machine_state_t *state, int *fd, const char *filename,
+		const dirty_tracker_t *written, reload_result_t *result)
+{
+  struct stat oldStat, newStat;
+  uint8_t *image, *previous = NULL;
+  uint64_t oldSize = state->programSize;
+  int newFd, error;
+
+  memset(result, 0, sizeof(*result));
+
+  newFd = open(filename, O_RDONLY);
+  if (newFd < 0)
+    return 0;
+  if (fstat(newFd, &newStat) < 0)
+    goto closeFile;
+  if (newStat.st_size == 0)
+  {
+    errno = EINVAL;
+    goto closeFile;
+  }
+
+  image = mmap(NULL, newStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	       newFd, 0);
+  if (image == MAP_FAILED)
+    goto closeFile;
+
+  // A file replaced (as by an assembler writing a new file) still has
+  // its previous contents behind the old descriptor.
+  result->inPlace = fstat(*fd, &oldStat) < 0 ||
+    (oldStat.st_dev == newStat.st_dev && oldStat.st_ino == newStat.st_ino);
+  if (!result->inPlace)
+  {
+    previous = mmap(NULL, oldSize, PROT_READ, MAP_PRIVATE, *fd, 0);
+    if (previous == MAP_FAILED)
+    {
+      previous = NULL;
+      result->inPlace = 1;
+    }
+  }
+
+  result->pageCount = (newStat.st_size + RELOAD_PAGE_SIZE - 1) /
+    RELOAD_PAGE_SIZE;
+  result->changed = calloc(2 * ((result->pageCount + 63) / 64), sizeof(uint64_t));
+  if (!result->changed)
+    goto unmapImage;
+  result->kept = result->changed + (result->pageCount + 63) / 64;
+
+  for (uint64_t page = 0; page < result->pageCount; page++)
+  {
+    uint64_t start = page * RELOAD_PAGE_SIZE;
+    uint64_t size = newStat.st_size - start < RELOAD_PAGE_SIZE ?
+      newStat.st_size - start : RELOAD_PAGE_SIZE;
+    uint64_t oldLength = start >= oldSize ? 0 :
+      oldSize - start < RELOAD_PAGE_SIZE ? oldSize - start : RELOAD_PAGE_SIZE;
+    int wasWritten = start < written->memorySize &&
+      (written->bits[page >> 6] & (1ULL << (page & 63)));
+    int changed;
+
+    if (!previous)
+      changed = !wasWritten || oldLength != size;
+    else
+      changed = oldLength != size ||
+	memcmp(image + start, previous + start, size) != 0;
+
+    if (changed)
+    {
+      result->changed[page >> 6] |= 1ULL << (page & 63);
+      result->changedPages++;
+      result->replacedPages += wasWritten;
+      // The trackers save what the guest saw there; for a file
+      // rewritten in place, that may already be the new contents.
+      if (oldLength)
+	dirtyRecordRange(state, start, oldLength);
+    }
+    else if (wasWritten)
+    {
+      memcpy(image + start, state->programMap + start, size);
+      result->kept[page >> 6] |= 1ULL << (page & 63);
+      result->keptPages++;
+    }
+  }
+
+  if (previous)
+    munmap(previous, oldSize);
+  munmap(state->programMap, oldSize);
+  close(*fd);
+  *fd = newFd;
+  state->programMap = image;
+  state->programSize = newStat.st_size;
+  return 1;
+
+ unmapImage:
+  error = errno;
+  if (previous)
+    munmap(previous, oldSize);
+  munmap(image, newStat.st_size);
+  errno = error;
+ closeFile:
+  error = errno;
+  close(newFd);
+  errno = error;
+  return 0;
+}
+
+void reloadResultFree(reload_result_t *result)
+{
+  free(result->changed);
+  memset(result, 0, sizeof(*result));
+}
+
+/* Starts watching the directory of the file for files written or
+   renamed into it, since assemblers usually replace their output
+   rather than rewrite it. Returns a non-blocking inotify descriptor,
+   or -1 (with errno set) on failure. */
+int reloadWatch(const char *filename)
+{
+  const char *slash = strrchr(filename, '/');
+  char directory[slash ? slash - filename + 2 : 2];
+  int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (watch < 0)
+    return -1;
+
+  if (slash)
+  {
+    memcpy(directory, filename, slash - filename + 1);
+    directory[slash - filename + 1] = 0;
+  }
+  else
+    strcpy(directory, ".");
+
+  if (inotify_add_watch(watch, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+  {
+    int error = errno;
+    close(watch);
+    errno = error;
+    return -1;
+  }
+  return watch;
+}
+
+/* Consumes the events pending on the watch. Returns 1 if the file was
+   written or replaced since the last call, 0 otherwise. */
+int reloadPending(int watch, const char *filename)
+{
+  const char *slash = strrchr(filename, '/');
+  const char *name = slash ? slash + 1 : filename;
+  char buffer[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t length;
+  int pending = 0;
+
+  while ((length = read(watch, buffer, sizeof(buffer))) > 0)
+    for (char *next = buffer; next < buffer + length; )
+    {
+      struct inotify_event *event = (struct inotify_event *)next;
+      if (event->len && !strcmp(event->name, name))
+	pending = 1;
+      next += sizeof(*event) + event->len;
+    }
+  return pending;
+}
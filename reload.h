@@ -0,0 +1,48 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in reload.c
+*/
+
+#ifndef _RELOAD_H_
+#define _RELOAD_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+#include "dirty.h"
+
+#define RELOAD_PAGE_SIZE DIRTY_PAGE_SIZE
+
+/* Pages of the reloaded image, as bitmaps with one bit per page:
+   changed has the pages whose contents differ from the previous
+   image, kept the pages written by the guest whose contents were kept
+   since the image did not change there. */
+typedef struct reload_result {
+
+  uint64_t  pageCount;
+  uint64_t *changed;
+  uint64_t *kept;
+
+  uint64_t  changedPages;
+  uint64_t  keptPages;
+  uint64_t  replacedPages;  // written by the guest, but changed
+  int       inPlace;        // the file was modified, not replaced
+} reload_result_t;
+
+int reloadImage(machine_state_t *state, int *fd, const char *filename,
+		const dirty_tracker_t *written, reload_result_t *result);
+void reloadResultFree(reload_result_t *result);
+
+int reloadWatch(const char *filename);
+int reloadPending(int watch, const char *filename);
+
+/* Returns 1 if the page containing the address is marked in the
+   bitmap, or if the address is past the new image. */
+static inline int reloadPageMarked(const reload_result_t *result,
+				   const uint64_t *bitmap, uint64_t address)
+{
+  uint64_t page = address / RELOAD_PAGE_SIZE;
+  return page >= result->pageCount ||
+    (bitmap[page >> 6] & (1ULL << (page & 63))) != 0;
+}
+
+#endif /* RELOAD */
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "runcache.h"
+
+#define PAGE_SIZE DIRTY_PAGE_SIZE
+
+/* Hashes the bytes into two lanes at once, a quad-word at a time. The
+   lanes mix differently, so together they make a 128-bit hash. */
+static void hashBytes(uint64_t hash[2], const void *bytes, uint64_t size)
+{
+  const uint8_t *data = bytes;
+  uint64_t a = hash[0], b = hash[1], word;
+  uint64_t i;
+
+  for (i = 0; i + 8 <= size; i += 8)
+  {
+    memcpy(&word, data + i, 8);
+    a = (a ^ word) * 0x9E3779B97F4A7C15ULL;
+    a ^= a >> 32;
+    b = (b + word) * 0xC2B2AE3D27D4EB4FULL;
+    b ^= b >> 29;
+  }
+  if (i < size)
+  {
+    word = 0;
+    memcpy(&word, data + i, size - i);
+    a = (a ^ word) * 0x9E3779B97F4A7C15ULL;
+    b = (b + word) * 0xC2B2AE3D27D4EB4FULL;
+  }
+  hash[0] = a ^ size;
+  hash[1] = b + size;
+}
+
+/* The final mix of a lane, from splitmix64. */
+static uint64_t finishHash(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/* Opens a temporary file in the directory, to be renamed into place
+   by closeTemporary once complete, so readers never see part of a
+   file. */
+static FILE *openTemporary(const char *directory, char *path, size_t size)
+{
+  int fd;
+
+  snprintf(path, size, "%s/.tmp.XXXXXX", directory);
+  fd = mkstemp(path);
+  return fd < 0 ? NULL : fdopen(fd, "wb");
+}
+
+static int closeTemporary(FILE *file, const char *temporary, const char *path,
+			  int complete)
+{
+  complete = fclose(file) == 0 && complete;
+  if (!complete || rename(temporary, path) < 0)
+  {
+    unlink(temporary);
+    return 0;
+  }
+  return 1;
+}
+
+/* Attaches a cache kept in the directory, created if needed, to the
+   machine. Memory is hashed now, unless it is still the contents of a
+   file (as given by file, or NULL) whose hash was recorded in the
+   directory. Returns 1 in case of success, or 0 with errno set. */
+int runCacheInit(run_cache_t *cache, const char *directory, int verify,
+		 machine_state_t *state, const struct stat *file)
+{
+  char path[strlen(directory) + 96], temporary[strlen(directory) + 16];
+  FILE *stream = NULL;
+  int found = 0;
+
+  memset(cache, 0, sizeof(*cache));
+  if (mkdir(directory, 0777) < 0 && errno != EEXIST)
+    return 0;
+
+  cache->directory = strdup(directory);
+  cache->verify = verify;
+  // Stores reach the end of the last page, past the image.
+  cache->memorySize = (state->programSize + PAGE_SIZE - 1) / PAGE_SIZE *
+    PAGE_SIZE;
+  if (!cache->directory ||
+      !dirtyInit(&cache->written, NULL, cache->memorySize) ||
+      !dirtyInit(&cache->run, NULL, cache->memorySize))
+  {
+    runCacheFree(cache, state);
+    errno = ENOMEM;
+    return 0;
+  }
+
+  if (file)
+  {
+    snprintf(path, sizeof(path), "%s/image-%lx-%lx-%lx-%lx.%09lx", directory,
+	     (uint64_t)file->st_dev, (uint64_t)file->st_ino,
+	     (uint64_t)file->st_size, (uint64_t)file->st_mtim.tv_sec,
+	     (uint64_t)file->st_mtim.tv_nsec);
+    stream = fopen(path, "rb");
+    found = stream && fread(cache->imageHash, sizeof(uint64_t), 2, stream) == 2;
+    if (stream)
+      fclose(stream);
+  }
+
+  if (!found)
+  {
+    cache->imageHash[0] = 0x243F6A8885A308D3ULL;
+    cache->imageHash[1] = 0x13198A2E03707344ULL;
+    hashBytes(cache->imageHash, state->programMap, cache->memorySize);
+    if (file && (stream = openTemporary(directory, temporary,
+					sizeof(temporary))))
+      closeTemporary(stream, temporary, path,
+		     fwrite(cache->imageHash, sizeof(uint64_t), 2, stream) == 2);
+  }
+
+  dirtyAttach(state, &cache->written);
+  return 1;
+}
+
+void runCacheFree(run_cache_t *cache, machine_state_t *state)
+{
+  dirtyDetach(state, &cache->written);
+  dirtyDetach(state, &cache->run);
+  dirtyFree(&cache->written);
+  dirtyFree(&cache->run);
+  free(cache->directory);
+  memset(cache, 0, sizeof(*cache));
+}
+
+/* Computes the key of a run from the current state: memory (the hash
+   taken when the cache was attached, and the pages written since),
+   the registers, condition codes and PC, and the instruction limit and
+   sorted breakpoints of the run. The instruction count is left out;
+   runs add to it. */
+void runCacheKey(run_cache_t *cache, const machine_state_t *state,
+		 uint64_t limit, const uint64_t *breakpoints,
+		 uint64_t breakpointCount, run_cache_key_t *key)
+{
+  uint64_t hash[2] = { cache->imageHash[0], cache->imageHash[1] };
+  uint64_t pages[2] = { 0, 0 };
+  uint64_t parameters[4] = { state->programCounter, state->conditionCodes,
+			     limit, breakpointCount };
+
+  // Pages are added up, as they are tracked in no particular order.
+  for (uint64_t i = 0; i < cache->written.count; i++)
+  {
+    uint64_t page = cache->written.pages[i];
+    uint64_t pageHash[2] = { page, ~page };
+
+    hashBytes(pageHash, state->programMap + page * PAGE_SIZE, PAGE_SIZE);
+    pages[0] += finishHash(pageHash[0]);
+    pages[1] += finishHash(pageHash[1]);
+  }
+
+  hashBytes(hash, pages, sizeof(pages));
+  hashBytes(hash, state->registerFile, sizeof(state->registerFile));
+  hashBytes(hash, parameters, sizeof(parameters));
+  hashBytes(hash, breakpoints, breakpointCount * sizeof(uint64_t));
+  key->hash[0] = finishHash(hash[0]);
+  key->hash[1] = finishHash(hash[1]);
+}
+
+static void entryPath(const run_cache_t *cache, const run_cache_key_t *key,
+		      char *path, size_t size)
+{
+  snprintf(path, size, "%s/%016lx%016lx.run", cache->directory, key->hash[0],
+	   key->hash[1]);
+}
+
+/* Reads the run with the key from the cache. Returns 1 if it was found,
+   or 0 if it was not or could not be read; the entry must be freed
+   with runCacheEntryFree either way. */
+int runCacheLoad(run_cache_t *cache, const run_cache_key_t *key,
+		 run_cache_entry_t *entry)
+{
+  char path[strlen(cache->directory) + 48], magic[8];
+  uint64_t stored[2], stop;
+  FILE *file;
+  int ok;
+
+  memset(entry, 0, sizeof(*entry));
+  entryPath(cache, key, path, sizeof(path));
+  file = fopen(path, "rb");
+  if (!file)
+  {
+    cache->misses++;
+    return 0;
+  }
+
+  ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+    memcmp(magic, RUN_CACHE_MAGIC, sizeof(magic)) == 0 &&
+    fread(stored, sizeof(uint64_t), 2, file) == 2 &&
+    stored[0] == key->hash[0] && stored[1] == key->hash[1] &&
+    fread(entry->registerFile, sizeof(entry->registerFile), 1, file) == 1 &&
+    fread(&entry->programCounter, sizeof(uint64_t), 1, file) == 1 &&
+    fread(&entry->conditionCodes, 1, 1, file) == 1 &&
+    fread(&stop, sizeof(uint64_t), 1, file) == 1 &&
+    fread(&entry->instructions, sizeof(uint64_t), 1, file) == 1 &&
+    fread(&entry->pageCount, sizeof(uint64_t), 1, file) == 1 &&
+    entry->pageCount <= cache->memorySize / PAGE_SIZE;
+  if (ok)
+  {
+    entry->stop = stop;
+    entry->pages = malloc((entry->pageCount + 1) * sizeof(uint64_t));
+    entry->data = malloc(entry->pageCount * PAGE_SIZE + 1);
+    ok = entry->pages && entry->data &&
+      fread(entry->pages, sizeof(uint64_t), entry->pageCount, file) ==
+      entry->pageCount &&
+      fread(entry->data, PAGE_SIZE, entry->pageCount, file) ==
+      entry->pageCount;
+  }
+  for (uint64_t i = 0; ok && i < entry->pageCount; i++)
+    ok = entry->pages[i] < cache->memorySize / PAGE_SIZE;
+  fclose(file);
+
+  if (!ok)
+  {
+    runCacheEntryFree(entry);
+    cache->misses++;
+    return 0;
+  }
+  cache->hits++;
+  return 1;
+}
+
+/* Brings the machine to the end of a cached run: the pages it wrote,
+   seen by the trackers attached, then the registers, condition codes
+   and PC. Returns 1 in case of success, or 0 (with errno set) if the
+   entry does not fit the machine's memory. */
+int runCacheApply(const run_cache_entry_t *entry, machine_state_t *state)
+{
+  uint64_t memorySize = (state->programSize + PAGE_SIZE - 1) / PAGE_SIZE *
+    PAGE_SIZE;
+
+  for (uint64_t i = 0; i < entry->pageCount; i++)
+    if (entry->pages[i] >= memorySize / PAGE_SIZE)
+    {
+      errno = EINVAL;
+      return 0;
+    }
+
+  for (uint64_t i = 0; i < entry->pageCount; i++)
+  {
+    uint64_t start = entry->pages[i] * PAGE_SIZE;
+
+    if (state->trackers)
+      dirtyRecordRange(state, start, PAGE_SIZE);
+    memcpy(state->programMap + start, entry->data + i * PAGE_SIZE, PAGE_SIZE);
+  }
+  memcpy(state->registerFile, entry->registerFile, sizeof(state->registerFile));
+  state->programCounter = entry->programCounter;
+  state->conditionCodes = entry->conditionCodes;
+  state->instructionCount += entry->instructions;
+  return 1;
+}
+
+/* Starts tracking the pages written by a run. */
+void runCacheBegin(run_cache_t *cache, machine_state_t *state)
+{
+  dirtyReset(&cache->run);
+  dirtyAttach(state, &cache->run);
+}
+
+static int comparePages(const void *a, const void *b)
+{
+  uint64_t left = *(const uint64_t *)a, right = *(const uint64_t *)b;
+  return left < right ? -1 : left > right;
+}
+
+/* Stops tracking the run, and describes how it ended in the entry,
+   to be freed with runCacheEntryFree. Returns 1 in case of success,
+   or 0 if memory could not be allocated. */
+int runCacheCollect(run_cache_t *cache, machine_state_t *state, int stop,
+		    uint64_t instructions, run_cache_entry_t *entry)
+{
+  dirtyDetach(state, &cache->run);
+
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->registerFile, state->registerFile, sizeof(entry->registerFile));
+  entry->programCounter = state->programCounter;
+  entry->conditionCodes = state->conditionCodes;
+  entry->stop = stop;
+  entry->instructions = instructions;
+
+  entry->pageCount = cache->run.count;
+  entry->pages = malloc((entry->pageCount + 1) * sizeof(uint64_t));
+  entry->data = malloc(entry->pageCount * PAGE_SIZE + 1);
+  if (!entry->pages || !entry->data)
+  {
+    runCacheEntryFree(entry);
+    errno = ENOMEM;
+    return 0;
+  }
+
+  memcpy(entry->pages, cache->run.pages, entry->pageCount * sizeof(uint64_t));
+  qsort(entry->pages, entry->pageCount, sizeof(uint64_t), comparePages);
+  for (uint64_t i = 0; i < entry->pageCount; i++)
+    memcpy(entry->data + i * PAGE_SIZE,
+	   state->programMap + entry->pages[i] * PAGE_SIZE, PAGE_SIZE);
+  return 1;
+}
+
+/* Writes the run to the cache, replacing any entry with the key.
+   Returns 1 in case of success, or 0 with errno set. */
+int runCacheStore(run_cache_t *cache, const run_cache_key_t *key,
+		  const run_cache_entry_t *entry)
+{
+  char path[strlen(cache->directory) + 48];
+  char temporary[strlen(cache->directory) + 16];
+  uint64_t stop = entry->stop;
+  FILE *file = openTemporary(cache->directory, temporary, sizeof(temporary));
+  int ok;
+
+  if (!file)
+    return 0;
+
+  ok = fwrite(RUN_CACHE_MAGIC, 1, 8, file) == 8 &&
+    fwrite(key->hash, sizeof(uint64_t), 2, file) == 2 &&
+    fwrite(entry->registerFile, sizeof(entry->registerFile), 1, file) == 1 &&
+    fwrite(&entry->programCounter, sizeof(uint64_t), 1, file) == 1 &&
+    fwrite(&entry->conditionCodes, 1, 1, file) == 1 &&
+    fwrite(&stop, sizeof(uint64_t), 1, file) == 1 &&
+    fwrite(&entry->instructions, sizeof(uint64_t), 1, file) == 1 &&
+    fwrite(&entry->pageCount, sizeof(uint64_t), 1, file) == 1 &&
+    fwrite(entry->pages, sizeof(uint64_t), entry->pageCount, file) ==
+    entry->pageCount &&
+    fwrite(entry->data, PAGE_SIZE, entry->pageCount, file) == entry->pageCount;
+
+  entryPath(cache, key, path, sizeof(path));
+  if (!closeTemporary(file, temporary, path, ok))
+    return 0;
+  cache->stores++;
+  return 1;
+}
+
+/* Returns 1 if both runs ended the same way. */
+int runCacheSame(const run_cache_entry_t *a, const run_cache_entry_t *b)
+{
+  return memcmp(a->registerFile, b->registerFile, sizeof(a->registerFile)) == 0 &&
+    a->programCounter == b->programCounter &&
+    a->conditionCodes == b->conditionCodes && a->stop == b->stop &&
+    a->instructions == b->instructions && a->pageCount == b->pageCount &&
+    memcmp(a->pages, b->pages, a->pageCount * sizeof(uint64_t)) == 0 &&
+    memcmp(a->data, b->data, a->pageCount * PAGE_SIZE) == 0;
+}
+
+void runCacheEntryFree(run_cache_entry_t *entry)
+{
+  free(entry->pages);
+  free(entry->data);
+  memset(entry, 0, sizeof(*entry));
+}
@@ -0,0 +1,78 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in runcache.c
+*/
+
+#ifndef _RUNCACHE_H_
+#define _RUNCACHE_H_
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "instruction.h"
+#include "dirty.h"
+
+#define RUN_CACHE_MAGIC "Y86RUN1\n"
+
+/* Identifies a run: the contents of memory, the registers, condition
+   codes and PC it starts from, and its parameters. */
+typedef struct run_cache_key {
+
+  uint64_t hash[2];
+} run_cache_key_t;
+
+/* The outcome of a run: the machine state it ends in, why it stopped,
+   the instructions it executed, and the contents of the pages it
+   wrote, in page order. */
+typedef struct run_cache_entry {
+
+  uint64_t  registerFile[16];
+  uint64_t  programCounter;
+  uint8_t   conditionCodes;
+  int       stop;
+  uint64_t  instructions;
+
+  uint64_t  pageCount;
+  uint64_t *pages;
+  uint8_t  *data;
+} run_cache_entry_t;
+
+/* Runs kept as files in a directory, one per key. Memory is hashed
+   once, when the cache is attached; the pages written after that are
+   tracked, and only those are hashed again for each run. With verify
+   set, runs found in the cache are executed anyway, and counted as
+   mismatches (and replaced) if they came out differently. */
+typedef struct run_cache {
+
+  char           *directory;
+  int             verify;
+  uint64_t        memorySize;
+  uint64_t        imageHash[2];
+  dirty_tracker_t written;
+  dirty_tracker_t run;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t mismatches;
+} run_cache_t;
+
+int runCacheInit(run_cache_t *cache, const char *directory, int verify,
+		 machine_state_t *state, const struct stat *file);
+void runCacheFree(run_cache_t *cache, machine_state_t *state);
+
+void runCacheKey(run_cache_t *cache, const machine_state_t *state,
+		 uint64_t limit, const uint64_t *breakpoints,
+		 uint64_t breakpointCount, run_cache_key_t *key);
+int runCacheLoad(run_cache_t *cache, const run_cache_key_t *key,
+		 run_cache_entry_t *entry);
+int runCacheApply(const run_cache_entry_t *entry, machine_state_t *state);
+
+void runCacheBegin(run_cache_t *cache, machine_state_t *state);
+int runCacheCollect(run_cache_t *cache, machine_state_t *state, int stop,
+		    uint64_t instructions, run_cache_entry_t *entry);
+int runCacheStore(run_cache_t *cache, const run_cache_key_t *key,
+		  const run_cache_entry_t *entry);
+int runCacheSame(const run_cache_entry_t *a, const run_cache_entry_t *b);
+void runCacheEntryFree(run_cache_entry_t *entry);
+
+#endif /* RUNCACHE */
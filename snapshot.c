@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_ENDIAN_TAG 0x01020304
+
+/* Writes the whole buffer at the given file offset, retrying on short
+   writes. Returns 1 in case of success, or 0 in case of failure (with
+   errno set). */
+static int writeFully(int fd, const void *buffer, uint64_t size, uint64_t offset)
+{
+  const uint8_t *data = buffer;
+  while (size > 0)
+  {
+    ssize_t written = pwrite(fd, data, size, offset);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return 0;
+    }
+    data += written;
+    offset += written;
+    size -= written;
+  }
+  return 1;
+}
+
+/* Reads exactly size bytes at the given file offset. Returns 1 in case
+   of success, or 0 in case of failure (with errno set). */
+static int readFully(int fd, void *buffer, uint64_t size, uint64_t offset)
+{
+  uint8_t *data = buffer;
+  while (size > 0)
+  {
+    ssize_t count = pread(fd, data, size, offset);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return 0;
+    }
+    if (count == 0)
+    {
+      errno = EINVAL;
+      return 0;
+    }
+    data += count;
+    offset += count;
+    size -= count;
+  }
+  return 1;
+}
+
+/* Rounds value up to the next multiple of SNAPSHOT_ALIGNMENT. */
+static uint64_t alignUp(uint64_t value)
+{
+  return (value + SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+/* Saves the machine's registers, condition codes, program counter,
+   the list of breakpoints and the whole memory image into a snapshot
+   file. The memory image is stored page-aligned at the end of the
+   file so it can later be mapped directly. Returns 1 in case of
+   success, or 0 in case of failure (with errno set). */
+int saveSnapshot(const char *filename, machine_state_t *state,
+		 const uint64_t *breakpoints, uint64_t breakpointCount)
+{
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.endianTag = SNAPSHOT_ENDIAN_TAG;
+  header.programCounter = state->programCounter;
+  memcpy(header.registerFile, state->registerFile, sizeof(header.registerFile));
+  header.conditionCodes = state->conditionCodes;
+  header.instructionCount = state->instructionCount;
+  header.breakpointCount = breakpointCount;
+  header.breakpointOffset = sizeof(header);
+  header.memorySize = state->programSize;
+  header.memoryOffset = alignUp(header.breakpointOffset +
+				breakpointCount * sizeof(uint64_t));
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return 0;
+
+  // The gap between the breakpoints and the memory image is left as a
+  // hole, so it takes no space on disk.
+  if (!writeFully(fd, &header, sizeof(header), 0) ||
+      !writeFully(fd, breakpoints, breakpointCount * sizeof(uint64_t),
+		  header.breakpointOffset) ||
+      !writeFully(fd, state->programMap, state->programSize,
+		  header.memoryOffset) ||
+      ftruncate(fd, header.memoryOffset + header.memorySize) < 0)
+  {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return 0;
+  }
+
+  return close(fd) == 0;
+}
+
+/* Loads a snapshot file previously written by saveSnapshot. The
+   memory image is mapped privately from the file rather than read, so
+   loading takes the same time regardless of the image size. On
+   success the registers, condition codes, program counter and memory
+   of *state are replaced, *breakpoints receives a newly allocated
+   array (to be freed by the caller) and 1 is returned. Returns 0 in
+   case of failure (with errno set), leaving *state untouched. */
+int loadSnapshot(const char *filename, machine_state_t *state,
+		 uint64_t **breakpoints, uint64_t *breakpointCount)
+{
+  snapshot_header_t header;
+  struct stat st;
+  uint64_t *list = NULL;
+  uint8_t *map;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  if (fstat(fd, &st) < 0 || !readFully(fd, &header, sizeof(header), 0))
+    goto fail;
+
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+      header.version < 1 || header.version > SNAPSHOT_VERSION ||
+      header.endianTag != SNAPSHOT_ENDIAN_TAG ||
+      header.memorySize == 0 ||
+      header.memoryOffset % sysconf(_SC_PAGESIZE) != 0 ||
+      header.memoryOffset > (uint64_t)st.st_size ||
+      header.memorySize > (uint64_t)st.st_size - header.memoryOffset ||
+      header.breakpointOffset > header.memoryOffset ||
+      header.breakpointCount >
+      (header.memoryOffset - header.breakpointOffset) / sizeof(uint64_t))
+  {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  // Version 1 files have no instruction count; the header fields read
+  // past its end are ignored.
+  if (header.version < 2)
+    header.instructionCount = 0;
+
+  if (header.breakpointCount > 0)
+  {
+    list = malloc(header.breakpointCount * sizeof(uint64_t));
+    if (!list)
+      goto fail;
+    if (!readFully(fd, list, header.breakpointCount * sizeof(uint64_t),
+		   header.breakpointOffset))
+      goto fail;
+  }
+
+  map = mmap(NULL, header.memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	     fd, header.memoryOffset);
+  if (map == MAP_FAILED)
+    goto fail;
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+
+  state->programMap = map;
+  state->programSize = header.memorySize;
+  state->programCounter = header.programCounter;
+  memcpy(state->registerFile, header.registerFile, sizeof(state->registerFile));
+  state->conditionCodes = header.conditionCodes;
+  state->instructionCount = header.instructionCount;
+
+  *breakpoints = list;
+  *breakpointCount = header.breakpointCount;
+  return 1;
+
+fail:
+  {
+    int saved = errno;
+    free(list);
+    close(fd);
+    errno = saved;
+  }
+  return 0;
+}
@@ -0,0 +1,48 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in snapshot.c
+*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define SNAPSHOT_MAGIC   "Y86SNAP"
+#define SNAPSHOT_VERSION 2
+
+/* The memory image is stored at an offset that is a multiple of this
+   value, so it can be mapped directly on any host whose page size
+   divides it (4K, 16K and 64K pages). */
+#define SNAPSHOT_ALIGNMENT 0x10000
+
+/* On-disk header of a snapshot file. All fields are stored in host
+   (little-endian) byte order; endianTag is used to reject files
+   written on a host with a different byte order. */
+typedef struct snapshot_header {
+
+  char     magic[8];
+  uint32_t version;
+  uint32_t endianTag;
+
+  uint64_t programCounter;
+  uint64_t registerFile[16];
+  uint64_t conditionCodes;
+
+  uint64_t breakpointCount;
+  uint64_t breakpointOffset;
+
+  uint64_t memorySize;
+  uint64_t memoryOffset;
+
+  // Added in version 2.
+  uint64_t instructionCount;
+} snapshot_header_t;
+
+int saveSnapshot(const char *filename, machine_state_t *state,
+		 const uint64_t *breakpoints, uint64_t breakpointCount);
+int loadSnapshot(const char *filename, machine_state_t *state,
+		 uint64_t **breakpoints, uint64_t *breakpointCount);
+
+#endif /* SNAPSHOT */
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "y86batch.h"
+#include "y86machine.h"
+#include "printRoutines.h"
+#include "symbols.h"
+
+#define ERROR_RETURN -1
+#define SUCCESS 0
+
+#define DEFAULT_LANES 1024
+
+/* A value set in every lane before running: a register, a quad-word of
+   memory, or count quad-words of pseudo-random values. Lane i gets
+   start + i * step, or random values seeded by i. */
+typedef enum setting_kind {
+  SET_REGISTER = 0x0,
+  SET_MEMORY   = 0x1,
+  SET_RANDOM   = 0x2
+} setting_kind_t;
+
+typedef struct setting {
+
+  setting_kind_t kind;
+  y86_register_t reg;
+  uint64_t       address;
+  uint64_t       start;
+  uint64_t       step;
+  uint64_t       count;
+} setting_t;
+
+static uint64_t monotonicTime(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Reads TARGET=START[:STEP], where the target is a register or an
+   address, or ADDRESS:COUNT for random values. */
+static int parseSetting(const char *text, setting_kind_t kind,
+			const symbol_table_t *symbols, setting_t *setting)
+{
+  char target[strlen(text) + 1];
+  char *value, *end;
+
+  strcpy(target, text);
+  memset(setting, 0, sizeof(*setting));
+  setting->kind = kind;
+
+  value = strchr(target, kind == SET_RANDOM ? ':' : '=');
+  if (!value)
+    return 0;
+  *value++ = '\0';
+
+  if (kind == SET_REGISTER)
+  {
+    char name[strlen(target) + 2];
+    sprintf(name, "%s%s", target[0] == '%' ? "" : "%", target);
+    if (!parseRegisterName(name, strlen(name), &setting->reg))
+      return 0;
+  }
+  else if (!parseAddress(symbols, target, &setting->address))
+    return 0;
+
+  if (kind == SET_RANDOM)
+  {
+    setting->count = strtoull(value, &end, 0);
+    return end != value && !*end && setting->count > 0;
+  }
+
+  setting->start = strtoull(value, &end, 0);
+  if (end == value)
+    return 0;
+  if (*end == ':')
+  {
+    value = end + 1;
+    setting->step = strtoull(value, &end, 0);
+    if (end == value)
+      return 0;
+  }
+  return !*end;
+}
+
+/* The random values of a lane: xorshift64*, seeded by the lane. */
+static uint64_t nextRandom(uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Fills buffer with the value or values of the setting for a lane.
+   Returns the number of bytes, or 0 for a register. */
+static uint64_t settingValue(const setting_t *setting, uint64_t lane,
+			     uint64_t *buffer)
+{
+  uint64_t seed = lane * 0x9E3779B97F4A7C15ULL + 1;
+
+  switch (setting->kind)
+  {
+  case SET_REGISTER:
+    buffer[0] = setting->start + lane * setting->step;
+    return 0;
+  case SET_MEMORY:
+    buffer[0] = setting->start + lane * setting->step;
+    return 8;
+  default:
+    for (uint64_t i = 0; i < setting->count; i++)
+      buffer[i] = nextRandom(&seed);
+    return setting->count * 8;
+  }
+}
+
+/* Runs every lane again on its own machine and checks that the batch
+   came to the same state. Returns the nanoseconds taken to run the
+   machines, leaving out their setup. */
+static uint64_t compareLanes(y86_batch_t *batch, const char *inputFile,
+			     const setting_t *settings, int settingCount,
+			     uint64_t *buffer, uint64_t limit,
+			     uint64_t *mismatches)
+{
+  uint64_t memorySize = y86BatchGetMemorySize(batch);
+  uint8_t *expected = malloc(memorySize), *actual = malloc(memorySize);
+  uint64_t elapsed = 0;
+
+  *mismatches = 0;
+  for (uint64_t lane = 0; lane < y86BatchLanes(batch); lane++)
+  {
+    y86_machine_t *machine = y86CreateFromFile(inputFile);
+    y86_stop_t stop;
+    int same;
+
+    if (!machine || !expected || !actual)
+    {
+      fprintf(stderr, "Failed to create a machine: %s\n", strerror(errno));
+      (*mismatches)++;
+      y86Destroy(machine);
+      break;
+    }
+
+    for (int i = 0; i < settingCount; i++)
+    {
+      uint64_t size = settingValue(&settings[i], lane, buffer);
+      if (size)
+	y86WriteMemory(machine, settings[i].address, buffer, size);
+      else
+	y86SetRegister(machine, settings[i].reg, buffer[0]);
+    }
+
+    uint64_t start = monotonicTime();
+    stop = y86Run(machine, limit);
+    elapsed += monotonicTime() - start;
+
+    same = stop == y86BatchGetStop(batch, lane) &&
+      y86GetPC(machine) == y86BatchGetPC(batch, lane) &&
+      y86GetConditionCodes(machine) ==
+      y86BatchGetConditionCodes(batch, lane) &&
+      y86GetInstructionCount(machine) ==
+      y86BatchGetInstructionCount(batch, lane);
+    for (int reg = R_RAX; reg < R_NONE && same; reg++)
+    {
+      uint64_t value;
+      y86GetRegister(machine, reg, &value);
+      same = value == y86BatchGetRegister(batch, lane, reg);
+    }
+    if (same)
+    {
+      y86ReadMemory(machine, 0, expected, memorySize);
+      y86BatchReadMemory(batch, lane, 0, actual, memorySize);
+      same = memcmp(expected, actual, memorySize) == 0;
+    }
+    if (!same)
+    {
+      if (*mismatches < 10)
+	fprintf(stderr, "Lane %lu differs: %s at PC 0x%lx after %lu "
+		"instructions on its own, %s at PC 0x%lx after %lu in the "
+		"batch\n", lane, y86StopName(stop), y86GetPC(machine),
+		y86GetInstructionCount(machine),
+		y86StopName(y86BatchGetStop(batch, lane)),
+		y86BatchGetPC(batch, lane),
+		y86BatchGetInstructionCount(batch, lane));
+      (*mismatches)++;
+    }
+    y86Destroy(machine);
+  }
+
+  free(expected);
+  free(actual);
+  return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+
+  const char *inputFile = NULL;
+  uint64_t lanes = DEFAULT_LANES, limit = 0, maxCount = 1;
+  int compare = 0, verbose = 0, badUsage = 0, settingCount = 0;
+  setting_t settings[argc];
+  symbol_table_t symbols;
+  char *end;
+
+  // Labels of the image, for addresses given by name.
+  symbolTableInit(&symbols);
+  for (int i = 1; i < argc; i++)
+    if (argv[i][0] != '-' && (i == 1 || argv[i - 1][0] != '-' ||
+			      !strcmp(argv[i - 1], "--compare") ||
+			      !strcmp(argv[i - 1], "--verbose")))
+    {
+      char source[strlen(argv[i]) + sizeof(".sym")];
+      char *extension;
+
+      strcpy(source, argv[i]);
+      extension = strrchr(source, '.');
+      if (extension && !strchr(extension, '/'))
+	*extension = '\0';
+      strcat(source, ".sym");
+      if (access(source, R_OK) == 0)
+	loadSymbolsFromMap(&symbols, source);
+      break;
+    }
+
+  for (int i = 1; i < argc && !badUsage; i++)
+  {
+    if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc)
+    {
+      lanes = strtoull(argv[++i], &end, 0);
+      badUsage = *end || lanes == 0;
+    }
+    else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc)
+    {
+      limit = strtoull(argv[++i], &end, 0);
+      badUsage = *end != '\0';
+    }
+    else if ((strcmp(argv[i], "--reg") == 0 || strcmp(argv[i], "--mem") == 0 ||
+	      strcmp(argv[i], "--random") == 0) && i + 1 < argc)
+    {
+      setting_kind_t kind = argv[i][2] == 'r' && argv[i][3] == 'e' ?
+	SET_REGISTER : argv[i][2] == 'm' ? SET_MEMORY : SET_RANDOM;
+      badUsage = !parseSetting(argv[i + 1], kind, &symbols,
+			       &settings[settingCount]);
+      if (settings[settingCount].count > maxCount)
+	maxCount = settings[settingCount].count;
+      settingCount++;
+      i++;
+    }
+    else if (strcmp(argv[i], "--compare") == 0)
+      compare = 1;
+    else if (strcmp(argv[i], "--verbose") == 0)
+      verbose = 1;
+    else if (!inputFile && argv[i][0] != '-')
+      inputFile = argv[i];
+    else
+      badUsage = 1;
+  }
+  symbolTableFree(&symbols);
+
+  if (badUsage || !inputFile)
+  {
+    fprintf(stderr, "Usage: %s [--lanes N] [--limit N] [--reg REG=START[:STEP]]"
+	    " [--mem ADDRESS=START[:STEP]] [--random ADDRESS:COUNT] [--compare]"
+	    " [--verbose] InputFilename\n", argv[0]);
+    return ERROR_RETURN;
+  }
+
+  y86_batch_t *batch = y86BatchCreateFromFile(inputFile, lanes);
+  uint64_t *buffer = malloc(maxCount * sizeof(uint64_t));
+  if (!batch || !buffer)
+  {
+    fprintf(stderr, "Failed to load %s: %s\n", inputFile, strerror(errno));
+    return ERROR_RETURN;
+  }
+
+  for (uint64_t lane = 0; lane < lanes; lane++)
+    for (int i = 0; i < settingCount; i++)
+    {
+      uint64_t size = settingValue(&settings[i], lane, buffer);
+      if (size ? !y86BatchWriteMemory(batch, lane, settings[i].address, buffer,
+				      size) :
+	  !y86BatchSetRegister(batch, lane, settings[i].reg, buffer[0]))
+      {
+	fprintf(stderr, "Failed to set up lane %lu: %s\n", lane,
+		strerror(errno));
+	return ERROR_RETURN;
+      }
+    }
+
+  uint64_t start = monotonicTime();
+  y86BatchRun(batch, limit);
+  uint64_t elapsed = monotonicTime() - start;
+
+  uint64_t stops[Y86_STOP_INTERRUPTED + 1] = {0};
+  y86_batch_stats_t stats;
+  y86BatchGetStats(batch, &stats);
+  for (uint64_t lane = 0; lane < lanes; lane++)
+  {
+    y86_stop_t stop = y86BatchGetStop(batch, lane);
+    stops[stop]++;
+    if (verbose)
+      printf("Lane %lu: %s at PC 0x%lx after %lu instructions, %%rax = 0x%lx\n",
+	     lane, y86StopName(stop), y86BatchGetPC(batch, lane),
+	     y86BatchGetInstructionCount(batch, lane),
+	     y86BatchGetRegister(batch, lane, R_RAX));
+  }
+
+  printf("%lu lanes:", lanes);
+  for (int stop = 0; stop <= Y86_STOP_INTERRUPTED; stop++)
+    if (stops[stop])
+      printf(" %lu %s", stops[stop], y86StopName(stop));
+  printf("\n%lu instructions in %.3f ms, %.1f million per second\n",
+	 stats.laneInstructions, elapsed / 1e6,
+	 stats.laneInstructions * 1e3 / (elapsed ? elapsed : 1));
+  printf("%lu groups, %lu vectorized, %.1f lanes per group\n", stats.groups,
+	 stats.vectorGroups,
+	 stats.groups ? (double)stats.laneInstructions / stats.groups : 0.0);
+
+  int status = SUCCESS;
+  if (compare)
+  {
+    uint64_t mismatches;
+    uint64_t alone = compareLanes(batch, inputFile, settings, settingCount,
+				  buffer, limit, &mismatches);
+    printf("Separate machines: %.3f ms, batch %.1f times faster, %lu lanes "
+	   "differ\n", alone / 1e6, (double)alone / (elapsed ? elapsed : 1),
+	   mismatches);
+    if (mismatches)
+      status = ERROR_RETURN;
+  }
+
+  free(buffer);
+  y86BatchDestroy(batch);
+  return status;
+}
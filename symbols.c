@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "symbols.h"
+
+/* FNV-1a hash of a symbol name. */
+static uint64_t hashName(const char *name, size_t length)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= (uint8_t)name[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* Returns the hash slot holding the symbol with the given name, or
+   the empty slot where it would be inserted. Slots hold an index into
+   the symbol array plus one, so zero marks an empty slot. */
+static uint64_t *findSlot(const symbol_table_t *table, const char *name,
+			  size_t length)
+{
+  uint64_t mask = table->slotCount - 1;
+  uint64_t i = hashName(name, length) & mask;
+
+  while (table->slots[i])
+  {
+    const symbol_t *symbol = &table->symbols[table->slots[i] - 1];
+    if (strncmp(symbol->name, name, length) == 0 && !symbol->name[length])
+      break;
+    i = (i + 1) & mask;
+  }
+  return &table->slots[i];
+}
+
+/* Rebuilds the hash table with the given (power of two) number of
+   slots from the symbol array. Returns 1 in case of success, or 0 if
+   memory could not be allocated. */
+static int rehash(symbol_table_t *table, uint64_t slotCount)
+{
+  uint64_t *slots = calloc(slotCount, sizeof(uint64_t));
+  if (!slots)
+    return 0;
+
+  free(table->slots);
+  table->slots = slots;
+  table->slotCount = slotCount;
+
+  for (uint64_t i = 0; i < table->count; i++)
+  {
+    symbol_t *symbol = &table->symbols[i];
+    *findSlot(table, symbol->name, strlen(symbol->name)) = i + 1;
+  }
+  return 1;
+}
+
+void symbolTableInit(symbol_table_t *table)
+{
+  memset(table, 0, sizeof(*table));
+}
+
+void symbolTableFree(symbol_table_t *table)
+{
+  for (uint64_t i = 0; i < table->count; i++)
+    free(table->symbols[i].name);
+  free(table->symbols);
+  free(table->slots);
+  symbolTableInit(table);
+}
+
+/* Adds a symbol with the given name (not necessarily null-terminated)
+   and address to the table. Returns 1 in case of success, or 0 if a
+   symbol with the same name already exists or memory could not be
+   allocated. symbolTableFinalize must be called once all symbols are
+   added and before any address lookup. */
+int symbolTableAdd(symbol_table_t *table, const char *name, size_t length,
+		   uint64_t address)
+{
+  if (2 * (table->count + 1) > table->slotCount &&
+      !rehash(table, table->slotCount ? 2 * table->slotCount : 64))
+    return 0;
+
+  uint64_t *slot = findSlot(table, name, length);
+  if (*slot)
+    return 0;
+
+  if (table->count == table->capacity)
+  {
+    uint64_t capacity = table->capacity ? 2 * table->capacity : 64;
+    symbol_t *symbols = realloc(table->symbols, capacity * sizeof(symbol_t));
+    if (!symbols)
+      return 0;
+    table->symbols = symbols;
+    table->capacity = capacity;
+  }
+
+  symbol_t *symbol = &table->symbols[table->count];
+  symbol->name = malloc(length + 1);
+  if (!symbol->name)
+    return 0;
+  memcpy(symbol->name, name, length);
+  symbol->name[length] = '\0';
+  symbol->address = address;
+  symbol->order = table->count;
+
+  *slot = ++table->count;
+  return 1;
+}
+
+static int compareSymbols(const void *a, const void *b)
+{
+  const symbol_t *left = a, *right = b;
+  if (left->address != right->address)
+    return left->address < right->address ? -1 : 1;
+  return left->order < right->order ? -1 : left->order > right->order;
+}
+
+/* Sorts the symbols by address (keeping definition order among
+   symbols at the same address) and rebuilds the name index. */
+void symbolTableFinalize(symbol_table_t *table)
+{
+  if (table->count == 0)
+    return;
+  qsort(table->symbols, table->count, sizeof(symbol_t), compareSymbols);
+  rehash(table, table->slotCount);
+}
+
+/* Returns the symbol with the given name (not necessarily
+   null-terminated), or NULL if there is no such symbol. */
+const symbol_t *symbolLookupName(const symbol_table_t *table,
+				 const char *name, size_t length)
+{
+  if (table->count == 0)
+    return NULL;
+
+  uint64_t index = *findSlot(table, name, length);
+  return index ? &table->symbols[index - 1] : NULL;
+}
+
+/* Returns the symbol whose interval contains the given address, that
+   is, the symbol with the highest address not above it, and stores
+   the distance from that symbol into *offset. Returns NULL if the
+   address is below every symbol. */
+const symbol_t *symbolLookupAddress(const symbol_table_t *table,
+				    uint64_t address, uint64_t *offset)
+{
+  uint64_t low = 0, high = table->count;
+
+  // Find the first symbol above the address.
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (table->symbols[middle].address <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  if (low == 0)
+    return NULL;
+
+  // Prefer the first symbol defined at that address.
+  uint64_t found = low - 1;
+  while (found > 0 &&
+	 table->symbols[found - 1].address == table->symbols[found].address)
+    found--;
+
+  *offset = address - table->symbols[found].address;
+  return &table->symbols[found];
+}
+
+static int isSymbolStart(char c)
+{
+  return isalpha((unsigned char)c) || c == '_';
+}
+
+static int isSymbolChar(char c)
+{
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Writes the symbols of a finalized table as a symbol map: one line
+   per symbol, with its address in hexadecimal and its name. Returns 1
+   in case of success, or 0 in case of a write error. */
+int writeSymbolMap(FILE *file, const symbol_table_t *table)
+{
+  for (uint64_t i = 0; i < table->count; i++)
+    fprintf(file, "0x%016lx %s\n", table->symbols[i].address,
+	    table->symbols[i].name);
+  return !ferror(file);
+}
+
+/* Reads a symbol map written by writeSymbolMap and adds its symbols
+   to the table, which is finalized on return. Returns 1 in case of
+   success, or 0 if the file could not be read (with errno set). */
+int loadSymbolsFromMap(symbol_table_t *table, const char *filename)
+{
+  FILE *file = fopen(filename, "r");
+  char *line = NULL, *p, *start;
+  size_t size = 0;
+
+  if (!file)
+    return 0;
+
+  while (getline(&line, &size, file) >= 0)
+  {
+    uint64_t address = strtoull(line, &p, 16);
+    while (isspace((unsigned char)*p))
+      p++;
+    for (start = p; isSymbolChar(*p); p++)
+      ;
+    if (p > start && isSymbolStart(*start))
+      symbolTableAdd(table, start, p - start, address);
+  }
+
+  free(line);
+  fclose(file);
+  symbolTableFinalize(table);
+  return 1;
+}
+
+/* Converts a command parameter into an address. The parameter may be
+   a symbol name, optionally followed by +offset, or a number; both are
+   hexadecimal (with or without 0x), as addresses are shown. A symbol
+   takes precedence over a number spelled the same way, such as "a".
+   Returns 1 in case of success, or 0 if the parameter is not a valid
+   address. */
+int parseAddress(const symbol_table_t *table, const char *text,
+		 uint64_t *address)
+{
+  const char *p = text, *start;
+  char *end;
+
+  while (isspace((unsigned char)*p))
+    p++;
+
+  if (isSymbolStart(*p))
+  {
+    for (start = p; isSymbolChar(*p); p++)
+      ;
+    const symbol_t *symbol = symbolLookupName(table, start, p - start);
+    if (symbol)
+    {
+      uint64_t offset = 0;
+      if (*p == '+')
+      {
+	if (!isxdigit((unsigned char)p[1]))
+	  return 0;
+	offset = strtoull(p + 1, &end, 16);
+	p = end;
+      }
+      while (isspace((unsigned char)*p))
+	p++;
+      if (*p)
+	return 0;
+      *address = symbol->address + offset;
+      return 1;
+    }
+    p = start;
+  }
+
+  if (!isxdigit((unsigned char)*p))
+    return 0;
+  *address = strtoull(p, &end, 16);
+  while (isspace((unsigned char)*end))
+    end++;
+  return *end == '\0';
+}
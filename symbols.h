@@ -0,0 +1,48 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in symbols.c
+*/
+
+#ifndef _SYMBOLS_H_
+#define _SYMBOLS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct symbol {
+
+  char     *name;
+  uint64_t  address;
+  uint64_t  order;
+} symbol_t;
+
+/* Symbols are kept in an array sorted by address, where each symbol
+   covers the interval up to the next symbol, for address lookups. A
+   separate open-addressing hash table of indices into that array is
+   used for name lookups. */
+typedef struct symbol_table {
+
+  symbol_t *symbols;
+  uint64_t  count;
+  uint64_t  capacity;
+
+  uint64_t *slots;
+  uint64_t  slotCount;
+} symbol_table_t;
+
+void symbolTableInit(symbol_table_t *table);
+void symbolTableFree(symbol_table_t *table);
+int symbolTableAdd(symbol_table_t *table, const char *name, size_t length,
+		   uint64_t address);
+void symbolTableFinalize(symbol_table_t *table);
+
+const symbol_t *symbolLookupName(const symbol_table_t *table,
+				 const char *name, size_t length);
+const symbol_t *symbolLookupAddress(const symbol_table_t *table,
+				    uint64_t address, uint64_t *offset);
+
+int writeSymbolMap(FILE *file, const symbol_table_t *table);
+int loadSymbolsFromMap(symbol_table_t *table, const char *filename);
+int parseAddress(const symbol_table_t *table, const char *text,
+		 uint64_t *address);
+
+#endif /* SYMBOLS */
@@ -0,0 +1,736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "y86batch.h"
+
+/* On x86-64, the lanes of a group are executed four at a time with
+   AVX2 when the host supports it, checked at run time. Other hosts use
+   the plain loops, which the compiler may vectorize by itself. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+/* Lanes are padded to a whole number of vectors of quad-words. */
+#define BATCH_VECTOR_LANES 4
+
+/* The memory of each lane is a whole number of pages, so stores just
+   past the end of the image behave as they do in a mapped image. */
+#define BATCH_PAGE_SIZE 4096
+
+/* Bytes of memory per bit of the map of lines written by the lanes. */
+#define BATCH_LINE_SHIFT 6
+
+/* A group is executed by the vector kernels, over every lane, if at
+   least one lane in this many is in it; smaller groups are executed
+   lane by lane. */
+#define BATCH_VECTOR_SHARE 8
+
+/* Stop reason of the lanes still running. */
+#define BATCH_RUNNING 0xff
+
+struct y86_batch {
+
+  uint64_t  laneCount;
+  uint64_t  stride;           // lanes, padded
+  uint64_t  memorySize;       // size of the image
+  uint64_t  laneMemory;       // bytes of memory per lane
+  uint8_t  *memory;
+
+  // one row of stride lanes per register, then one row per field
+  uint64_t *registers;
+  uint64_t *pc;
+  uint64_t *cc;
+  uint64_t *instructionCount;
+  uint64_t *deadline;         // instruction count ending the run
+  uint64_t *running;          // all ones while the lane runs
+  uint64_t *mask;             // all ones for the lanes in the group
+  uint64_t *group;            // indices of the lanes in the group
+  uint8_t  *stop;
+
+  // lines of memory stored to by some lane, where lanes may hold
+  // different code
+  uint64_t *written;
+
+  y86_batch_stats_t stats;
+};
+
+/* Tested bits of the condition codes for each condition, and whether
+   the condition holds when one of them is set or when none is. */
+static const uint64_t conditionBits[C_G + 1] = {0, 3, 2, 1, 1, 2, 3};
+static const uint64_t conditionIfSet[C_G + 1] = {0, 1, 1, 1, 0, 0, 0};
+
+static inline uint64_t *registerRow(const y86_batch_t *batch,
+				    y86_register_t reg)
+{
+  return batch->registers + (uint64_t)reg * batch->stride;
+}
+
+static inline uint8_t *laneMemory(const y86_batch_t *batch, uint64_t lane)
+{
+  return batch->memory + lane * batch->laneMemory;
+}
+
+/* Returns all ones if the condition holds for the condition codes,
+   zero otherwise. */
+static inline uint64_t conditionMask(uint8_t ifun, uint64_t cc)
+{
+  return -(uint64_t)(((cc & conditionBits[ifun]) != 0) ==
+		     conditionIfSet[ifun]);
+}
+
+/* The condition codes set by an operation, as setCC sets them. */
+static inline uint64_t conditionCodes(uint64_t value)
+{
+  return ((value & 0x80000000) ? 2 : 0) | (value == 0);
+}
+
+/* Sets up the lanes, each with a copy of the image, starting at the
+   first non-zero byte like the debugger. Returns NULL (with errno
+   set) in case of failure. */
+y86_batch_t *y86BatchCreateFromBuffer(const void *image, uint64_t size,
+				      uint64_t lanes)
+{
+  const uint8_t *bytes = image;
+  y86_batch_t *batch;
+  uint64_t start = 0;
+
+  if (size == 0 || lanes == 0)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  batch = calloc(1, sizeof(*batch));
+  if (!batch)
+    return NULL;
+
+  batch->laneCount = lanes;
+  batch->stride = (lanes + BATCH_VECTOR_LANES - 1) / BATCH_VECTOR_LANES *
+    BATCH_VECTOR_LANES;
+  batch->memorySize = size;
+  batch->laneMemory = (size + BATCH_PAGE_SIZE - 1) / BATCH_PAGE_SIZE *
+    BATCH_PAGE_SIZE;
+
+  batch->memory = mmap(NULL, batch->laneMemory * lanes, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (batch->memory == MAP_FAILED)
+  {
+    batch->memory = NULL;
+    y86BatchDestroy(batch);
+    return NULL;
+  }
+
+  batch->registers = calloc((R_NONE + 8) * batch->stride, sizeof(uint64_t));
+  batch->stop = malloc(batch->stride);
+  batch->written = calloc((batch->laneMemory >> BATCH_LINE_SHIFT) / 64 + 1,
+			  sizeof(uint64_t));
+  if (!batch->registers || !batch->stop || !batch->written)
+  {
+    y86BatchDestroy(batch);
+    errno = ENOMEM;
+    return NULL;
+  }
+  batch->pc = registerRow(batch, R_NONE + 1);
+  batch->cc = batch->pc + batch->stride;
+  batch->instructionCount = batch->cc + batch->stride;
+  batch->deadline = batch->instructionCount + batch->stride;
+  batch->running = batch->deadline + batch->stride;
+  batch->mask = batch->running + batch->stride;
+  batch->group = batch->mask + batch->stride;
+
+  while (start < size && !bytes[start])
+    start++;
+  memset(batch->stop, Y86_STOP_LIMIT, batch->stride);
+  for (uint64_t lane = 0; lane < lanes; lane++)
+  {
+    memcpy(laneMemory(batch, lane), image, size);
+    batch->pc[lane] = start;
+    batch->running[lane] = ~0ULL;
+    batch->stop[lane] = BATCH_RUNNING;
+  }
+  return batch;
+}
+
+/* Sets up the lanes from an image file. Returns NULL (with errno set)
+   in case of failure. */
+y86_batch_t *y86BatchCreateFromFile(const char *filename, uint64_t lanes)
+{
+  struct stat st;
+  y86_batch_t *batch;
+  void *image;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size == 0)
+  {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return NULL;
+  batch = y86BatchCreateFromBuffer(image, st.st_size, lanes);
+  munmap(image, st.st_size);
+  return batch;
+}
+
+void y86BatchDestroy(y86_batch_t *batch)
+{
+  if (!batch)
+    return;
+  if (batch->memory)
+    munmap(batch->memory, batch->laneMemory * batch->laneCount);
+  free(batch->registers);
+  free(batch->stop);
+  free(batch->written);
+  free(batch);
+}
+
+static inline void stopLane(y86_batch_t *batch, uint64_t lane, y86_stop_t stop)
+{
+  batch->running[lane] = 0;
+  batch->mask[lane] = 0;
+  batch->stop[lane] = stop;
+}
+
+/* Marks the line of memory at the address as possibly holding
+   different contents in different lanes. */
+static inline void markWritten(y86_batch_t *batch, uint64_t address)
+{
+  uint64_t line = address >> BATCH_LINE_SHIFT;
+  batch->written[line >> 6] |= 1ULL << (line & 63);
+}
+
+/* Returns 1 if a lane may have changed the bytes of an instruction at
+   the address. */
+static int codeWritten(const y86_batch_t *batch, uint64_t address)
+{
+  uint64_t first = address >> BATCH_LINE_SHIFT;
+  uint64_t last = (address + 9) >> BATCH_LINE_SHIFT;
+
+  if (address >= batch->laneMemory)
+    return 0;
+  if (last >= batch->laneMemory >> BATCH_LINE_SHIFT)
+    last = first;
+  for (uint64_t line = first; line <= last; line++)
+    if (batch->written[line >> 6] & (1ULL << (line & 63)))
+      return 1;
+  return 0;
+}
+
+/* Executes one instruction of one lane through executeInstruction,
+   on a machine made of the lane's registers and memory. The
+   instruction is fetched from the lane's memory if instr is NULL.
+   Accesses outside the lane's memory, and divisions by zero, stop the
+   lane with an error. */
+static void stepLane(y86_batch_t *batch, uint64_t lane,
+		     const y86_instruction_t *instr)
+{
+  machine_state_t state;
+  y86_instruction_t fetched;
+  uint64_t address;
+  int store = 0;
+
+  memset(&state, 0, sizeof(state));
+  state.programMap = laneMemory(batch, lane);
+  state.programSize = batch->memorySize;
+  state.programCounter = batch->pc[lane];
+  state.conditionCodes = batch->cc[lane];
+  state.instructionCount = batch->instructionCount[lane];
+  for (int reg = 0; reg <= R_NONE; reg++)
+    state.registerFile[reg] = registerRow(batch, reg)[lane];
+
+  if (!instr)
+  {
+    fetchInstruction(&state, &fetched);
+    instr = &fetched;
+    switch (instr->icode)
+    {
+    case I_HALT:
+      stopLane(batch, lane, Y86_STOP_HALT);
+      return;
+    case I_INVALID:
+      stopLane(batch, lane, Y86_STOP_INVALID);
+      return;
+    case I_TOO_SHORT:
+      stopLane(batch, lane, Y86_STOP_TOO_SHORT);
+      return;
+    default:
+      break;
+    }
+    if (state.instructionCount >= batch->deadline[lane])
+    {
+      stopLane(batch, lane, Y86_STOP_LIMIT);
+      return;
+    }
+  }
+
+  if (instructionFaults(instr, &state, batch->laneMemory))
+  {
+    stopLane(batch, lane, Y86_STOP_ERROR);
+    return;
+  }
+  // Instructions executeInstruction fails on (nop among them) still
+  // move the PC past them, as they do on a machine of its own.
+  if (!executeInstruction(&state, (y86_instruction_t *)instr))
+  {
+    batch->pc[lane] = state.programCounter;
+    stopLane(batch, lane, Y86_STOP_ERROR);
+    return;
+  }
+  if (memoryAccess(instr, &state, &address, &store) && store)
+    markWritten(batch, address);
+
+  batch->pc[lane] = state.programCounter;
+  batch->cc[lane] = state.conditionCodes;
+  batch->instructionCount[lane] = state.instructionCount;
+  for (int reg = 0; reg <= R_NONE; reg++)
+    registerRow(batch, reg)[lane] = state.registerFile[reg];
+  batch->stats.laneInstructions++;
+}
+
+/* Returns 1 if the vector kernels execute the instruction. */
+static int vectorizable(const y86_instruction_t *instr)
+{
+  switch (instr->icode)
+  {
+  case I_IRMOVQ:
+    return 1;
+  case I_RRMVXX:
+  case I_JXX:
+    return instr->ifun <= C_G;
+  case I_OPQ:
+    return instr->ifun <= A_MULQ;
+  default:
+    return 0;
+  }
+}
+
+/* Executes a vectorizable instruction for the lanes in the group,
+   going over every lane and keeping the others as they were. */
+static void executeGroup(y86_batch_t *batch, const y86_instruction_t *instr)
+{
+  uint64_t *rA = registerRow(batch, instr->rA);
+  uint64_t *rB = registerRow(batch, instr->rB);
+  uint64_t *mask = batch->mask, *cc = batch->cc, *pc = batch->pc;
+  uint64_t valC = instr->valC, valP = instr->valP;
+  uint8_t ifun = instr->ifun;
+  uint64_t n = batch->stride;
+
+#define BLEND(old, new, mask) (((old) & ~(mask)) | ((new) & (mask)))
+#define OPQ_LOOP(expression)						\
+  for (uint64_t i = 0; i < n; i++)					\
+  {									\
+    uint64_t a = rA[i], b = rB[i], value = (expression);		\
+    rB[i] = BLEND(b, value, mask[i]);					\
+    cc[i] = BLEND(cc[i], conditionCodes(value), mask[i]);		\
+  }
+
+  switch (instr->icode)
+  {
+  case I_IRMOVQ:
+    for (uint64_t i = 0; i < n; i++)
+      rB[i] = BLEND(rB[i], valC, mask[i]);
+    break;
+  case I_RRMVXX:
+    for (uint64_t i = 0; i < n; i++)
+      rB[i] = BLEND(rB[i], rA[i], mask[i] & conditionMask(ifun, cc[i]));
+    break;
+  case I_OPQ:
+    switch (ifun)
+    {
+    case A_ADDQ:
+      OPQ_LOOP(b + a);
+      break;
+    case A_SUBQ:
+      OPQ_LOOP(b - a);
+      break;
+    case A_ANDQ:
+      OPQ_LOOP(b & a);
+      break;
+    case A_XORQ:
+      OPQ_LOOP(b ^ a);
+      break;
+    case A_MULQ:
+      OPQ_LOOP(b * a);
+      break;
+    }
+    break;
+  case I_JXX:
+    for (uint64_t i = 0; i < n; i++)
+      pc[i] = BLEND(pc[i], BLEND(valP, valC, conditionMask(ifun, cc[i])),
+		    mask[i]);
+    break;
+  default:
+    break;
+  }
+
+  if (instr->icode != I_JXX)
+    for (uint64_t i = 0; i < n; i++)
+      pc[i] = BLEND(pc[i], valP, mask[i]);
+  for (uint64_t i = 0; i < n; i++)
+    batch->instructionCount[i] -= mask[i];
+
+#undef OPQ_LOOP
+#undef BLEND
+}
+
+#ifdef BATCH_X86
+
+__attribute__((target("avx2")))
+static inline __m256i conditionAVX2(uint8_t ifun, __m256i cc)
+{
+  __m256i tested = _mm256_and_si256(cc, _mm256_set1_epi64x(conditionBits[ifun]));
+  __m256i none = _mm256_cmpeq_epi64(tested, _mm256_setzero_si256());
+
+  return conditionIfSet[ifun] ?
+    _mm256_xor_si256(none, _mm256_set1_epi64x(-1)) : none;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i conditionCodesAVX2(__m256i value)
+{
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sign = _mm256_cmpeq_epi64(
+    _mm256_and_si256(value, _mm256_set1_epi64x(0x80000000)), zero);
+
+  return _mm256_or_si256(
+    _mm256_andnot_si256(sign, _mm256_set1_epi64x(2)),
+    _mm256_and_si256(_mm256_cmpeq_epi64(value, zero), _mm256_set1_epi64x(1)));
+}
+
+/* The low 64 bits of the products, from 32-bit multiplications. */
+__attribute__((target("avx2")))
+static inline __m256i multiplyAVX2(__m256i a, __m256i b)
+{
+  __m256i low = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(
+    _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+    _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+  return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+/* executeGroup, four lanes at a time; vectors without a lane in the
+   group are skipped. */
+__attribute__((target("avx2")))
+static void executeGroupAVX2(y86_batch_t *batch, const y86_instruction_t *instr)
+{
+  uint64_t *rA = registerRow(batch, instr->rA);
+  uint64_t *rB = registerRow(batch, instr->rB);
+  __m256i valC = _mm256_set1_epi64x(instr->valC);
+  __m256i valP = _mm256_set1_epi64x(instr->valP);
+  uint8_t ifun = instr->ifun;
+
+  for (uint64_t i = 0; i < batch->stride; i += BATCH_VECTOR_LANES)
+  {
+    __m256i mask = _mm256_loadu_si256((__m256i *)(batch->mask + i));
+    __m256i pc = valP, a, b, value;
+
+    if (_mm256_testz_si256(mask, mask))
+      continue;
+
+    switch (instr->icode)
+    {
+    case I_IRMOVQ:
+      b = _mm256_loadu_si256((__m256i *)(rB + i));
+      _mm256_storeu_si256((__m256i *)(rB + i),
+			  _mm256_blendv_epi8(b, valC, mask));
+      break;
+
+    case I_RRMVXX:
+      a = _mm256_loadu_si256((__m256i *)(rA + i));
+      b = _mm256_loadu_si256((__m256i *)(rB + i));
+      value = _mm256_and_si256(mask, conditionAVX2(
+	ifun, _mm256_loadu_si256((__m256i *)(batch->cc + i))));
+      _mm256_storeu_si256((__m256i *)(rB + i),
+			  _mm256_blendv_epi8(b, a, value));
+      break;
+
+    case I_OPQ:
+      a = _mm256_loadu_si256((__m256i *)(rA + i));
+      b = _mm256_loadu_si256((__m256i *)(rB + i));
+      switch (ifun)
+      {
+      case A_ADDQ:
+	value = _mm256_add_epi64(b, a);
+	break;
+      case A_SUBQ:
+	value = _mm256_sub_epi64(b, a);
+	break;
+      case A_ANDQ:
+	value = _mm256_and_si256(b, a);
+	break;
+      case A_XORQ:
+	value = _mm256_xor_si256(b, a);
+	break;
+      default:
+	value = multiplyAVX2(b, a);
+	break;
+      }
+      _mm256_storeu_si256((__m256i *)(rB + i),
+			  _mm256_blendv_epi8(b, value, mask));
+      _mm256_storeu_si256((__m256i *)(batch->cc + i),
+			  _mm256_blendv_epi8(
+			    _mm256_loadu_si256((__m256i *)(batch->cc + i)),
+			    conditionCodesAVX2(value), mask));
+      break;
+
+    case I_JXX:
+      pc = _mm256_blendv_epi8(valP, valC, conditionAVX2(
+	ifun, _mm256_loadu_si256((__m256i *)(batch->cc + i))));
+      break;
+
+    default:
+      break;
+    }
+
+    _mm256_storeu_si256((__m256i *)(batch->pc + i), _mm256_blendv_epi8(
+      _mm256_loadu_si256((__m256i *)(batch->pc + i)), pc, mask));
+    _mm256_storeu_si256((__m256i *)(batch->instructionCount + i),
+			_mm256_sub_epi64(_mm256_loadu_si256(
+			  (__m256i *)(batch->instructionCount + i)), mask));
+  }
+}
+
+static int haveAVX2(void)
+{
+  static int supported = -1;
+
+  if (supported < 0)
+    supported = __builtin_cpu_supports("avx2") != 0;
+  return supported;
+}
+
+#endif
+
+/* Finds the lowest PC of the running lanes and puts the lanes at it in
+   the group, so lanes behind catch up with the others and lanes that
+   took different paths come together again where the paths meet.
+   Returns the number of lanes in the group, 0 once every lane has
+   stopped. */
+static uint64_t selectGroup(y86_batch_t *batch, uint64_t *pc)
+{
+  uint64_t lowest = 0, count = 0;
+  int found = 0;
+
+  for (uint64_t i = 0; i < batch->laneCount; i++)
+    if (batch->running[i] && (!found || batch->pc[i] < lowest))
+    {
+      lowest = batch->pc[i];
+      found = 1;
+    }
+  if (!found)
+    return 0;
+
+  for (uint64_t i = 0; i < batch->stride; i++)
+  {
+    uint64_t in = batch->running[i] & -(uint64_t)(batch->pc[i] == lowest);
+    batch->mask[i] = in;
+    batch->group[count] = i;
+    count += in & 1;
+  }
+  *pc = lowest;
+  return count;
+}
+
+/* Runs every lane until it halts, fails, or has executed limit more
+   instructions (0 for no limit), executing the lanes at the same PC
+   together. Lanes stopped by the limit go on at the next call; lanes
+   stopped otherwise stay stopped. Returns the number of lanes stopped
+   by the limit. */
+uint64_t y86BatchRun(y86_batch_t *batch, uint64_t limit)
+{
+  y86_instruction_t instr;
+  uint64_t count, pc, limited = 0;
+
+  for (uint64_t lane = 0; lane < batch->laneCount; lane++)
+  {
+    if (batch->stop[lane] == Y86_STOP_LIMIT)
+    {
+      batch->stop[lane] = BATCH_RUNNING;
+      batch->running[lane] = ~0ULL;
+    }
+    batch->deadline[lane] = limit ? batch->instructionCount[lane] + limit :
+      UINT64_MAX;
+  }
+
+  while ((count = selectGroup(batch, &pc)))
+  {
+    batch->stats.groups++;
+
+    // Lanes may disagree on the code there: fetch it for each.
+    if (codeWritten(batch, pc))
+    {
+      for (uint64_t k = 0; k < count; k++)
+	stepLane(batch, batch->group[k], NULL);
+      continue;
+    }
+
+    machine_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.programMap = laneMemory(batch, batch->group[0]);
+    state.programSize = batch->memorySize;
+    state.programCounter = pc;
+    fetchInstruction(&state, &instr);
+
+    y86_stop_t stop = instr.icode == I_HALT ? Y86_STOP_HALT :
+      instr.icode == I_INVALID ? Y86_STOP_INVALID :
+      instr.icode == I_TOO_SHORT ? Y86_STOP_TOO_SHORT : Y86_STOP_LIMIT;
+    uint64_t kept = 0;
+    for (uint64_t k = 0; k < count; k++)
+    {
+      uint64_t lane = batch->group[k];
+      if (stop != Y86_STOP_LIMIT)
+	stopLane(batch, lane, stop);
+      else if (batch->instructionCount[lane] >= batch->deadline[lane])
+	stopLane(batch, lane, Y86_STOP_LIMIT);
+      else
+	batch->group[kept++] = lane;
+    }
+    if (!kept)
+      continue;
+
+    if (kept * BATCH_VECTOR_SHARE >= batch->stride && vectorizable(&instr))
+    {
+#ifdef BATCH_X86
+      if (haveAVX2())
+	executeGroupAVX2(batch, &instr);
+      else
+#endif
+	executeGroup(batch, &instr);
+      batch->stats.vectorGroups++;
+      batch->stats.laneInstructions += kept;
+    }
+    else
+      for (uint64_t k = 0; k < kept; k++)
+	stepLane(batch, batch->group[k], &instr);
+  }
+
+  for (uint64_t lane = 0; lane < batch->laneCount; lane++)
+    limited += batch->stop[lane] == Y86_STOP_LIMIT;
+  return limited;
+}
+
+void y86BatchGetStats(const y86_batch_t *batch, y86_batch_stats_t *stats)
+{
+  *stats = batch->stats;
+}
+
+uint64_t y86BatchLanes(const y86_batch_t *batch)
+{
+  return batch->laneCount;
+}
+
+y86_stop_t y86BatchGetStop(const y86_batch_t *batch, uint64_t lane)
+{
+  return batch->stop[lane] == BATCH_RUNNING ? Y86_STOP_LIMIT :
+    (y86_stop_t)batch->stop[lane];
+}
+
+uint64_t y86BatchGetPC(const y86_batch_t *batch, uint64_t lane)
+{
+  return batch->pc[lane];
+}
+
+/* Moves a lane's PC, which makes a stopped lane run again. Returns 1
+   in case of success, or 0 if the address is outside memory. */
+int y86BatchSetPC(y86_batch_t *batch, uint64_t lane, uint64_t address)
+{
+  if (address >= batch->memorySize)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  batch->pc[lane] = address;
+  batch->stop[lane] = Y86_STOP_LIMIT;
+  return 1;
+}
+
+uint64_t y86BatchGetRegister(const y86_batch_t *batch, uint64_t lane,
+			     y86_register_t reg)
+{
+  return reg < R_NONE ? registerRow(batch, reg)[lane] : 0;
+}
+
+int y86BatchSetRegister(y86_batch_t *batch, uint64_t lane, y86_register_t reg,
+			uint64_t value)
+{
+  if (reg >= R_NONE)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  registerRow(batch, reg)[lane] = value;
+  return 1;
+}
+
+uint8_t y86BatchGetConditionCodes(const y86_batch_t *batch, uint64_t lane)
+{
+  return batch->cc[lane];
+}
+
+void y86BatchSetConditionCodes(y86_batch_t *batch, uint64_t lane,
+			       uint8_t conditionCodes)
+{
+  batch->cc[lane] = conditionCodes;
+}
+
+uint64_t y86BatchGetInstructionCount(const y86_batch_t *batch, uint64_t lane)
+{
+  return batch->instructionCount[lane];
+}
+
+uint64_t y86BatchGetMemorySize(const y86_batch_t *batch)
+{
+  return batch->memorySize;
+}
+
+/* Copies size bytes of a lane's memory from the address. Returns 1 in
+   case of success, or 0 if the range goes past the end of memory. */
+int y86BatchReadMemory(const y86_batch_t *batch, uint64_t lane,
+		       uint64_t address, void *buffer, uint64_t size)
+{
+  if (address > batch->memorySize || size > batch->memorySize - address)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  memcpy(buffer, laneMemory(batch, lane) + address, size);
+  return 1;
+}
+
+/* Copies size bytes into a lane's memory at the address; the lines
+   written are then fetched lane by lane. Returns 1 in case of
+   success, or 0 if the range goes past the end of memory. */
+int y86BatchWriteMemory(y86_batch_t *batch, uint64_t lane, uint64_t address,
+			const void *buffer, uint64_t size)
+{
+  if (address > batch->memorySize || size > batch->memorySize - address)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  memcpy(laneMemory(batch, lane) + address, buffer, size);
+  for (uint64_t offset = 0; offset < size; offset += 1 << BATCH_LINE_SHIFT)
+    markWritten(batch, address + offset);
+  if (size)
+    markWritten(batch, address + size - 1);
+  return 1;
+}
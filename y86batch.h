@@ -0,0 +1,59 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in y86batch.c, the lockstep batch engine of the
+   Y86 machine library (libY86).
+
+   A batch holds many machines (lanes) started from the same image,
+   each with its own memory, registers and condition codes, stored
+   lane by lane so an instruction can be executed for every lane at
+   the same PC at once. Lanes are meant to differ only in their data,
+   as when sweeping one program over many inputs.
+*/
+
+#ifndef _Y86BATCH_H_
+#define _Y86BATCH_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+#include "y86machine.h"
+
+typedef struct y86_batch y86_batch_t;
+
+/* How the lanes were executed: instructions dispatched, each for a
+   group of lanes at the same PC, those of them executed by the vector
+   kernels, and the instructions executed over all lanes. */
+typedef struct y86_batch_stats {
+
+  uint64_t groups;
+  uint64_t vectorGroups;
+  uint64_t laneInstructions;
+} y86_batch_stats_t;
+
+y86_batch_t *y86BatchCreateFromBuffer(const void *image, uint64_t size,
+				      uint64_t lanes);
+y86_batch_t *y86BatchCreateFromFile(const char *filename, uint64_t lanes);
+void y86BatchDestroy(y86_batch_t *batch);
+
+uint64_t y86BatchRun(y86_batch_t *batch, uint64_t limit);
+void y86BatchGetStats(const y86_batch_t *batch, y86_batch_stats_t *stats);
+
+uint64_t y86BatchLanes(const y86_batch_t *batch);
+y86_stop_t y86BatchGetStop(const y86_batch_t *batch, uint64_t lane);
+uint64_t y86BatchGetPC(const y86_batch_t *batch, uint64_t lane);
+int y86BatchSetPC(y86_batch_t *batch, uint64_t lane, uint64_t address);
+uint64_t y86BatchGetRegister(const y86_batch_t *batch, uint64_t lane,
+			     y86_register_t reg);
+int y86BatchSetRegister(y86_batch_t *batch, uint64_t lane, y86_register_t reg,
+			uint64_t value);
+uint8_t y86BatchGetConditionCodes(const y86_batch_t *batch, uint64_t lane);
+void y86BatchSetConditionCodes(y86_batch_t *batch, uint64_t lane,
+			       uint8_t conditionCodes);
+uint64_t y86BatchGetInstructionCount(const y86_batch_t *batch, uint64_t lane);
+
+uint64_t y86BatchGetMemorySize(const y86_batch_t *batch);
+int y86BatchReadMemory(const y86_batch_t *batch, uint64_t lane,
+		       uint64_t address, void *buffer, uint64_t size);
+int y86BatchWriteMemory(y86_batch_t *batch, uint64_t lane, uint64_t address,
+			const void *buffer, uint64_t size);
+
+#endif /* Y86BATCH */
@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "y86machine.h"
+#include "fusion.h"
+#include "dirty.h"
+#include "runcache.h"
+
+/* Instructions executed between checks of the interrupt flag. */
+#define Y86_INTERRUPT_INTERVAL 1024
+
+struct y86_machine {
+
+  machine_state_t   state;
+  y86_instruction_t next;        // instruction at the PC, fetched
+
+  // sorted addresses of the breakpoints
+  uint64_t *breakpoints;
+  uint64_t  breakpointCount;
+  uint64_t  breakpointCapacity;
+
+  // decoded and fused instructions, set up on the first run
+  fusion_cache_t fusion;
+
+  // runs kept on disk, if enabled, and the file the memory was mapped
+  // from while the memory is still its contents
+  run_cache_t *cache;
+  struct stat  file;
+  int          unmodified;
+
+  int interrupted;
+};
+
+/* Sets up a machine around a mapping of its memory, starting at the
+   first non-zero byte like the debugger. Returns NULL, with the
+   memory unmapped, if the machine could not be allocated. */
+static y86_machine_t *createMachine(uint8_t *memory, uint64_t size)
+{
+  y86_machine_t *machine = calloc(1, sizeof(*machine));
+
+  if (!machine)
+  {
+    munmap(memory, size);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  machine->state.programMap = memory;
+  machine->state.programSize = size;
+  while (machine->state.programCounter < size &&
+	 !memory[machine->state.programCounter])
+    machine->state.programCounter++;
+  fetchInstruction(&machine->state, &machine->next);
+  return machine;
+}
+
+/* Creates a machine whose memory is a copy of the image. The copy is
+   mapped, like a file, so stores just past the end of the image reach
+   the rest of the last page as they do in the debugger. Returns NULL
+   (with errno set) in case of failure. */
+y86_machine_t *y86CreateFromBuffer(const void *image, uint64_t size)
+{
+  uint8_t *memory;
+
+  if (size == 0)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return NULL;
+  memcpy(memory, image, size);
+  return createMachine(memory, size);
+}
+
+/* Creates a machine whose memory is a private mapping of the file;
+   the file itself is never modified. Returns NULL (with errno set) in
+   case of failure. */
+y86_machine_t *y86CreateFromFile(const char *filename)
+{
+  struct stat st;
+  uint8_t *memory;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size == 0)
+  {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  y86_machine_t *machine;
+
+  memory = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    return NULL;
+  machine = createMachine(memory, st.st_size);
+  if (machine)
+  {
+    machine->file = st;
+    machine->unmodified = 1;
+  }
+  return machine;
+}
+
+void y86Destroy(y86_machine_t *machine)
+{
+  if (!machine)
+    return;
+  y86SetRunCache(machine, NULL, 0);
+  munmap(machine->state.programMap, machine->state.programSize);
+  free(machine->breakpoints);
+  fusionFree(&machine->fusion);
+  free(machine);
+}
+
+/* Returns why execution cannot go on from the fetched instruction, or
+   Y86_STOP_LIMIT if it can. */
+static y86_stop_t fetchedStop(const y86_machine_t *machine)
+{
+  switch (machine->next.icode)
+  {
+  case I_HALT:
+    return Y86_STOP_HALT;
+  case I_INVALID:
+    return Y86_STOP_INVALID;
+  case I_TOO_SHORT:
+    return Y86_STOP_TOO_SHORT;
+  default:
+    return Y86_STOP_LIMIT;
+  }
+}
+
+static int breakpointStop(void *context, uint64_t address)
+{
+  return y86HasBreakpoint(context, address);
+}
+
+/* Drops the decoded instructions, after memory or the breakpoints
+   changed other than through the guest. */
+static void resetFusion(y86_machine_t *machine)
+{
+  if (machine->state.fusion)
+    fusionReset(&machine->fusion);
+}
+
+/* Executes instructions as described for y86Run. Sequences of
+   instructions that are fused are executed as one when the limit
+   allows. */
+static y86_stop_t runMachine(y86_machine_t *machine, uint64_t limit)
+{
+  machine_state_t *state = &machine->state;
+  // Memory is mapped up to the end of its last page; anything past
+  // that would fault on the host.
+  uint64_t mapped = (state->programSize + DIRTY_PAGE_SIZE - 1) /
+    DIRTY_PAGE_SIZE * DIRTY_PAGE_SIZE;
+  uint64_t nextCheck = 0;
+  y86_stop_t stop;
+
+  // A cache is not worth setting up for a single step.
+  if (limit != 1 && !state->fusion &&
+      fusionInit(&machine->fusion, state->programSize))
+    state->fusion = &machine->fusion;
+
+  for (uint64_t executed = 0; ; )
+  {
+    if ((stop = fetchedStop(machine)) != Y86_STOP_LIMIT)
+      return stop;
+    if (executed > 0 && y86HasBreakpoint(machine, state->programCounter))
+      return Y86_STOP_BREAKPOINT;
+    if (limit && executed == limit)
+      return Y86_STOP_LIMIT;
+    if (executed >= nextCheck)
+    {
+      nextCheck = executed + Y86_INTERRUPT_INTERVAL;
+      if (__atomic_exchange_n(&machine->interrupted, 0, __ATOMIC_RELAXED))
+	return Y86_STOP_INTERRUPTED;
+    }
+
+    if (state->fusion)
+    {
+      const fusion_entry_t *entry = fusionLookup(state->fusion, state,
+						 breakpointStop, machine);
+      if (entry->count > 1 && (!limit || limit - executed >= entry->count) &&
+	  !instructionFaults(&entry->instr[0], state, mapped))
+      {
+	fusionExecute(state->fusion, state, entry);
+	executed += entry->count;
+	fetchInstruction(state, &machine->next);
+	continue;
+      }
+      state->fusion->instructions++;
+    }
+
+    if (instructionFaults(&machine->next, state, mapped) ||
+	!executeInstruction(state, &machine->next))
+      return Y86_STOP_ERROR;
+    executed++;
+    fetchInstruction(state, &machine->next);
+  }
+}
+
+/* Executes instructions until the machine halts, fails, reaches a
+   breakpoint (other than the one it starts at), is interrupted, or
+   has executed limit instructions (0 for no limit). Returns the
+   reason it stopped. With a run cache, a run made before from the
+   same state is not executed again, but its outcome taken from the
+   cache; single steps and interrupted runs are not cached. */
+y86_stop_t y86Run(y86_machine_t *machine, uint64_t limit)
+{
+  machine_state_t *state = &machine->state;
+  uint64_t start = state->instructionCount;
+  run_cache_t *cache = machine->cache;
+  run_cache_entry_t cached, actual;
+  run_cache_key_t key;
+  y86_stop_t stop;
+  int found;
+
+  machine->unmodified = 0;
+  if (!cache || limit == 1 ||
+      __atomic_load_n(&machine->interrupted, __ATOMIC_RELAXED))
+    return runMachine(machine, limit);
+
+  runCacheKey(cache, state, limit, machine->breakpoints,
+	      machine->breakpointCount, &key);
+  found = runCacheLoad(cache, &key, &cached);
+  if (found && !cache->verify && runCacheApply(&cached, state))
+  {
+    stop = cached.stop;
+    runCacheEntryFree(&cached);
+    fetchInstruction(state, &machine->next);
+    resetFusion(machine);
+    return stop;
+  }
+
+  runCacheBegin(cache, state);
+  stop = runMachine(machine, limit);
+  if (stop != Y86_STOP_INTERRUPTED &&
+      runCacheCollect(cache, state, stop, state->instructionCount - start,
+		      &actual))
+  {
+    if (!found || !runCacheSame(&cached, &actual))
+    {
+      cache->mismatches += found;
+      runCacheStore(cache, &key, &actual);
+    }
+    runCacheEntryFree(&actual);
+  }
+  else
+    dirtyDetach(state, &cache->run);
+  runCacheEntryFree(&cached);
+  return stop;
+}
+
+/* Executes a single instruction. Returns Y86_STOP_LIMIT if execution
+   can go on, or the reason it cannot. */
+y86_stop_t y86Step(y86_machine_t *machine)
+{
+  return y86Run(machine, 1);
+}
+
+/* Asks a running machine to stop; y86Run returns within a few
+   thousand instructions, or the next call to it returns at once if
+   the machine is not running. Safe to call from another thread. */
+void y86Interrupt(y86_machine_t *machine)
+{
+  __atomic_store_n(&machine->interrupted, 1, __ATOMIC_RELAXED);
+}
+
+const char *y86StopName(y86_stop_t stop)
+{
+  static const char *names[] = {
+    [Y86_STOP_LIMIT]       = "limit",
+    [Y86_STOP_HALT]        = "halt",
+    [Y86_STOP_BREAKPOINT]  = "breakpoint",
+    [Y86_STOP_INVALID]     = "invalid instruction",
+    [Y86_STOP_TOO_SHORT]   = "incomplete instruction",
+    [Y86_STOP_ERROR]       = "execution error",
+    [Y86_STOP_INTERRUPTED] = "interrupted"
+  };
+
+  return stop <= Y86_STOP_INTERRUPTED ? names[stop] : "unknown";
+}
+
+/* Stores the instruction at the PC into *instr. Returns 1 if it can
+   be executed, or 0 if it is a halt, invalid or incomplete. */
+int y86GetNextInstruction(const y86_machine_t *machine,
+			  y86_instruction_t *instr)
+{
+  *instr = machine->next;
+  return fetchedStop(machine) == Y86_STOP_LIMIT;
+}
+
+uint64_t y86GetPC(const y86_machine_t *machine)
+{
+  return machine->state.programCounter;
+}
+
+/* Moves the PC to the address. Returns 1 in case of success, or 0
+   (with errno set) if the address is outside memory. */
+int y86SetPC(y86_machine_t *machine, uint64_t address)
+{
+  if (address >= machine->state.programSize)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  machine->state.programCounter = address;
+  fetchInstruction(&machine->state, &machine->next);
+  return 1;
+}
+
+int y86GetRegister(const y86_machine_t *machine, y86_register_t reg,
+		   uint64_t *value)
+{
+  if (reg >= R_NONE)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  *value = machine->state.registerFile[reg];
+  return 1;
+}
+
+int y86SetRegister(y86_machine_t *machine, y86_register_t reg,
+		   uint64_t value)
+{
+  if (reg >= R_NONE)
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  machine->state.registerFile[reg] = value;
+  return 1;
+}
+
+uint8_t y86GetConditionCodes(const y86_machine_t *machine)
+{
+  return machine->state.conditionCodes;
+}
+
+void y86SetConditionCodes(y86_machine_t *machine, uint8_t conditionCodes)
+{
+  machine->state.conditionCodes = conditionCodes;
+}
+
+uint64_t y86GetInstructionCount(const y86_machine_t *machine)
+{
+  return machine->state.instructionCount;
+}
+
+uint64_t y86GetMemorySize(const y86_machine_t *machine)
+{
+  return machine->state.programSize;
+}
+
+/* Returns 1 if the range is entirely inside the machine's memory. */
+static int validRange(const y86_machine_t *machine, uint64_t address,
+		      uint64_t size)
+{
+  return address <= machine->state.programSize &&
+    size <= machine->state.programSize - address;
+}
+
+/* Copies size bytes of memory from the address into the buffer.
+   Returns 1 in case of success, or 0 (with errno set) if the range is
+   not entirely inside memory. */
+int y86ReadMemory(const y86_machine_t *machine, uint64_t address,
+		  void *buffer, uint64_t size)
+{
+  if (!validRange(machine, address, size))
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  memcpy(buffer, machine->state.programMap + address, size);
+  return 1;
+}
+
+/* Copies size bytes from the buffer into memory at the address. The
+   instruction at the PC is fetched again, in case it was overwritten.
+   Returns 1 in case of success, or 0 (with errno set) if the range is
+   not entirely inside memory. */
+int y86WriteMemory(y86_machine_t *machine, uint64_t address,
+		   const void *buffer, uint64_t size)
+{
+  if (!validRange(machine, address, size))
+  {
+    errno = EINVAL;
+    return 0;
+  }
+  if (machine->state.trackers)
+    dirtyRecordRange(&machine->state, address, size);
+  memcpy(machine->state.programMap + address, buffer, size);
+  machine->unmodified = 0;
+  fetchInstruction(&machine->state, &machine->next);
+  resetFusion(machine);
+  return 1;
+}
+
+/* Returns the position of the first breakpoint at or after the
+   address in the sorted array. */
+static uint64_t findBreakpoint(const y86_machine_t *machine, uint64_t address)
+{
+  uint64_t low = 0, high = machine->breakpointCount;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (machine->breakpoints[middle] < address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+/* Adds a breakpoint at the address, if there is none there yet.
+   Returns 1 in case of success, or 0 (with errno set) if memory could
+   not be allocated. */
+int y86AddBreakpoint(y86_machine_t *machine, uint64_t address)
+{
+  uint64_t position = findBreakpoint(machine, address);
+
+  if (position < machine->breakpointCount &&
+      machine->breakpoints[position] == address)
+    return 1;
+
+  if (machine->breakpointCount == machine->breakpointCapacity)
+  {
+    uint64_t capacity = machine->breakpointCapacity ?
+      2 * machine->breakpointCapacity : 16;
+    uint64_t *breakpoints = realloc(machine->breakpoints,
+				    capacity * sizeof(uint64_t));
+    if (!breakpoints)
+    {
+      errno = ENOMEM;
+      return 0;
+    }
+    machine->breakpoints = breakpoints;
+    machine->breakpointCapacity = capacity;
+  }
+
+  memmove(machine->breakpoints + position + 1,
+	  machine->breakpoints + position,
+	  (machine->breakpointCount - position) * sizeof(uint64_t));
+  machine->breakpoints[position] = address;
+  machine->breakpointCount++;
+  resetFusion(machine);
+  return 1;
+}
+
+/* Removes the breakpoint at the address. Returns 1 if there was one,
+   or 0 otherwise. */
+int y86DeleteBreakpoint(y86_machine_t *machine, uint64_t address)
+{
+  uint64_t position = findBreakpoint(machine, address);
+
+  if (position == machine->breakpointCount ||
+      machine->breakpoints[position] != address)
+    return 0;
+
+  machine->breakpointCount--;
+  memmove(machine->breakpoints + position,
+	  machine->breakpoints + position + 1,
+	  (machine->breakpointCount - position) * sizeof(uint64_t));
+  resetFusion(machine);
+  return 1;
+}
+
+int y86HasBreakpoint(const y86_machine_t *machine, uint64_t address)
+{
+  uint64_t position = findBreakpoint(machine, address);
+
+  return position < machine->breakpointCount &&
+    machine->breakpoints[position] == address;
+}
+
+void y86ClearBreakpoints(y86_machine_t *machine)
+{
+  machine->breakpointCount = 0;
+  resetFusion(machine);
+}
+
+/* Points *addresses to the breakpoints, in increasing order, valid
+   until the breakpoints change. Returns the number of breakpoints. */
+uint64_t y86GetBreakpoints(const y86_machine_t *machine,
+			   const uint64_t **addresses)
+{
+  *addresses = machine->breakpoints;
+  return machine->breakpointCount;
+}
+
+/* Keeps the outcome of runs in the directory (created if needed), so
+   that a run from the same memory, registers, condition codes and PC,
+   with the same limit and breakpoints, is looked up instead of
+   executed; the directory can be shared by any number of machines and
+   processes. Memory is hashed once, here, unless the machine was
+   created from a file that is unchanged and whose hash the directory
+   already has. With verify set, runs found are executed anyway and
+   compared with the cache, which is corrected if they differ. A NULL
+   directory turns the cache off. Returns 1 in case of success, or 0
+   (with errno set) if the cache could not be set up. */
+int y86SetRunCache(y86_machine_t *machine, const char *directory, int verify)
+{
+  if (machine->cache)
+  {
+    runCacheFree(machine->cache, &machine->state);
+    free(machine->cache);
+    machine->cache = NULL;
+  }
+  if (!directory)
+    return 1;
+
+  machine->cache = malloc(sizeof(run_cache_t));
+  if (!machine->cache)
+  {
+    errno = ENOMEM;
+    return 0;
+  }
+  if (!runCacheInit(machine->cache, directory, verify, &machine->state,
+		    machine->unmodified ? &machine->file : NULL))
+  {
+    free(machine->cache);
+    machine->cache = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/* Stores the counts of the run cache into *stats, all 0 if there is
+   none. */
+void y86GetRunCacheStats(const y86_machine_t *machine,
+			 y86_cache_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  if (!machine->cache)
+    return;
+  stats->hits = machine->cache->hits;
+  stats->misses = machine->cache->misses;
+  stats->stores = machine->cache->stores;
+  stats->mismatches = machine->cache->mismatches;
+}
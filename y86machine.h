@@ -0,0 +1,79 @@
+/* This file contains the prototypes and constants needed to use the
+   routines defined in y86machine.c, the Y86 machine library (libY86).
+
+   A machine holds its own memory, registers and breakpoints; nothing
+   is shared between machines and nothing is printed, so any number of
+   machines can be driven from any number of threads, as long as each
+   machine is used by one thread at a time (y86Interrupt excepted).
+*/
+
+#ifndef _Y86MACHINE_H_
+#define _Y86MACHINE_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+typedef struct y86_machine y86_machine_t;
+
+/* Why y86Run or y86Step returned. */
+typedef enum y86_stop {
+  Y86_STOP_LIMIT       = 0x0, // the requested instructions were executed
+  Y86_STOP_HALT        = 0x1, // the next instruction is halt
+  Y86_STOP_BREAKPOINT  = 0x2, // the PC reached a breakpoint
+  Y86_STOP_INVALID     = 0x3, // the next instruction is invalid
+  Y86_STOP_TOO_SHORT   = 0x4, // the next instruction goes past memory
+  Y86_STOP_ERROR       = 0x5, // the instruction could not be executed
+  Y86_STOP_INTERRUPTED = 0x6  // y86Interrupt was called
+} y86_stop_t;
+
+y86_machine_t *y86CreateFromBuffer(const void *image, uint64_t size);
+y86_machine_t *y86CreateFromFile(const char *filename);
+void y86Destroy(y86_machine_t *machine);
+
+y86_stop_t y86Step(y86_machine_t *machine);
+y86_stop_t y86Run(y86_machine_t *machine, uint64_t limit);
+void y86Interrupt(y86_machine_t *machine);
+const char *y86StopName(y86_stop_t stop);
+int y86GetNextInstruction(const y86_machine_t *machine,
+			  y86_instruction_t *instr);
+
+uint64_t y86GetPC(const y86_machine_t *machine);
+int y86SetPC(y86_machine_t *machine, uint64_t address);
+int y86GetRegister(const y86_machine_t *machine, y86_register_t reg,
+		   uint64_t *value);
+int y86SetRegister(y86_machine_t *machine, y86_register_t reg,
+		   uint64_t value);
+uint8_t y86GetConditionCodes(const y86_machine_t *machine);
+void y86SetConditionCodes(y86_machine_t *machine, uint8_t conditionCodes);
+uint64_t y86GetInstructionCount(const y86_machine_t *machine);
+
+uint64_t y86GetMemorySize(const y86_machine_t *machine);
+int y86ReadMemory(const y86_machine_t *machine, uint64_t address,
+		  void *buffer, uint64_t size);
+int y86WriteMemory(y86_machine_t *machine, uint64_t address,
+		   const void *buffer, uint64_t size);
+
+int y86AddBreakpoint(y86_machine_t *machine, uint64_t address);
+int y86DeleteBreakpoint(y86_machine_t *machine, uint64_t address);
+int y86HasBreakpoint(const y86_machine_t *machine, uint64_t address);
+void y86ClearBreakpoints(y86_machine_t *machine);
+uint64_t y86GetBreakpoints(const y86_machine_t *machine,
+			   const uint64_t **addresses);
+
+/* Counts kept by the run cache: runs found and not found in it, runs
+   written to it, and runs found that came out differently when
+   verified. */
+typedef struct y86_cache_stats {
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t mismatches;
+} y86_cache_stats_t;
+
+int y86SetRunCache(y86_machine_t *machine, const char *directory, int verify);
+void y86GetRunCacheStats(const y86_machine_t *machine,
+			 y86_cache_stats_t *stats);
+
+#endif /* Y86MACHINE */
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "assembler.h"
+#include "symbols.h"
+
+#define ERROR_RETURN -1
+#define SUCCESS 0
+
+/* Writes a file through a temporary name and renames it into place,
+   so a debugger watching the file never sees it half-written. The
+   contents are produced by the callback. Returns 1 in case of
+   success, or 0 in case of failure (with errno set). */
+static int writeAtomically(const char *filename,
+			   int (*write)(FILE *file, void *data), void *data)
+{
+  char temporary[strlen(filename) + sizeof(".tmp")];
+  FILE *file;
+
+  sprintf(temporary, "%s.tmp", filename);
+  file = fopen(temporary, "w");
+  if (!file)
+    return 0;
+
+  if (!write(file, data) || fclose(file) != 0)
+  {
+    int saved = errno;
+    remove(temporary);
+    errno = saved;
+    return 0;
+  }
+  return rename(temporary, filename) == 0;
+}
+
+static int writeImage(FILE *file, void *data)
+{
+  assembly_t *assembly = data;
+  return fwrite(assembly->image, 1, assembly->size, file) == assembly->size;
+}
+
+static int writeSymbols(FILE *file, void *data)
+{
+  assembly_t *assembly = data;
+  return writeSymbolMap(file, &assembly->symbols);
+}
+
+int main(int argc, char **argv)
+{
+
+  const char *inputFile = NULL, *outputFile = NULL;
+  assembly_t assembly;
+  char *base, *extension;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      outputFile = argv[++i];
+    else if (!inputFile)
+      inputFile = argv[i];
+    else
+    {
+      inputFile = NULL;
+      break;
+    }
+  }
+
+  if (!inputFile)
+  {
+    fprintf(stderr, "Usage: %s [-o OutputFilename] InputFilename\n", argv[0]);
+    return ERROR_RETURN;
+  }
+
+  // By default the image goes next to the source, named *.mem, and the
+  // symbol map next to the image, named *.sym.
+  base = malloc(strlen(outputFile ? outputFile : inputFile) + sizeof(".mem"));
+  strcpy(base, outputFile ? outputFile : inputFile);
+  extension = strrchr(base, '.');
+  if (extension && !strchr(extension, '/'))
+    *extension = '\0';
+  extension = base + strlen(base);
+
+  assemblyInit(&assembly);
+  if (!assembleFile(&assembly, inputFile))
+  {
+    fprintf(stderr, "%s: %s\n", inputFile, assembly.error);
+    assemblyFree(&assembly);
+    free(base);
+    return ERROR_RETURN;
+  }
+
+  if (!outputFile)
+  {
+    strcpy(extension, ".mem");
+    outputFile = base;
+  }
+  if (!writeAtomically(outputFile, writeImage, &assembly))
+  {
+    fprintf(stderr, "Failed to write %s: %s\n", outputFile, strerror(errno));
+    assemblyFree(&assembly);
+    free(base);
+    return ERROR_RETURN;
+  }
+
+  strcpy(extension, ".sym");
+  if (!writeAtomically(base, writeSymbols, &assembly))
+  {
+    fprintf(stderr, "Failed to write %s: %s\n", base, strerror(errno));
+    assemblyFree(&assembly);
+    free(base);
+    return ERROR_RETURN;
+  }
+
+  assemblyFree(&assembly);
+  free(base);
+  return SUCCESS;
+}